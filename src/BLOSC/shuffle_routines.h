@@ -26,14 +26,7 @@
  See src/BLOSC_shuffle/BLOSC for details about copyright and rights to use. 
  */
 
-
-#if defined (__AVX2__)
-#include "immintrin.h"
-#elif defined(__SSE2__)
-#include "emmintrin.h"
-#else
-//no other includes necessary
-#endif
+// intrinsics headers and the kernel selection are in simd_dispatch.h
 
 static inline void shuffle_generic_inline(const uint64_t type_size,
                                           const uint64_t vectorizable_elements, const uint64_t blocksize,
@@ -49,9 +42,9 @@ static inline void shuffle_generic_inline(const uint64_t type_size,
   }
 }
 
-#if defined (__AVX2__)
+#if defined(QS_AVX2_KERNELS)
 
-static void shuffle8_avx2(uint8_t* const dest, const uint8_t* const src,
+QS_TARGET_AVX2 static void shuffle8_avx2(uint8_t* const dest, const uint8_t* const src,
                           const uint64_t vectorizable_elements, const uint64_t total_elements) {
   static const uint64_t bytesoftype = 8;
   uint64_t j;
@@ -94,7 +87,7 @@ static void shuffle8_avx2(uint8_t* const dest, const uint8_t* const src,
   }
 }
 
-static void shuffle4_avx2(uint8_t* const dest, const uint8_t* const src,
+QS_TARGET_AVX2 static void shuffle4_avx2(uint8_t* const dest, const uint8_t* const src,
                           const uint64_t vectorizable_elements, const uint64_t total_elements) {
   static const uint64_t bytesoftype = 4;
   uint64_t i;
@@ -139,7 +132,9 @@ static void shuffle4_avx2(uint8_t* const dest, const uint8_t* const src,
   }
 }
 
-#elif defined(__SSE2__)
+#endif
+
+#if defined(__SSE2__)
 
 static void
   shuffle8_sse2(uint8_t* const dest, const uint8_t* const src,
@@ -217,41 +212,127 @@ static void shuffle4_sse2(uint8_t* const dest, const uint8_t* const src,
   }
 }
 
-#else
-// if neither supported, no other functions needed
 #endif
 
-// shuffle dispatcher
-static void blosc_shuffle(const uint8_t * const src, uint8_t * const dest, const uint64_t blocksize, const uint64_t bytesoftype) {
-  #if defined (__AVX2__)
-  uint64_t total_elements = blocksize / bytesoftype;
-  uint64_t vectorized_chunk_size = bytesoftype * sizeof(__m256i);
-  uint64_t vectorizable_bytes = blocksize - (blocksize % vectorized_chunk_size);
-  uint64_t vectorizable_elements = vectorizable_bytes / bytesoftype;
-  switch(bytesoftype) {
-  case 4:
-    shuffle4_avx2(dest, src, vectorizable_elements, total_elements);
-    break;
-  case 8:
-    shuffle8_avx2(dest, src, vectorizable_elements, total_elements);
-    break;
+#if defined(QS_AVX512BW_KERNELS)
+
+/* AVX-512BW kernels: bytes are transposed within 128 bit lanes, grouped by byte position within each register, and the groups are
+ then transposed across registers
+ (the maskz forms of the intrinsics avoid spurious -Wmaybe-uninitialized warnings from GCC 12 headers) */
+
+QS_TARGET_AVX512BW static void shuffle4_avx512(uint8_t* const dest, const uint8_t* const src,
+                                               const uint64_t vectorizable_elements, const uint64_t total_elements) {
+  static const uint64_t bytesoftype = 4;
+  alignas(64) static const uint8_t byte_mask[64] = {
+    0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15, 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+    0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15, 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15};
+  alignas(64) static const uint32_t dword_index[16] = {0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15};
+  const __m512i bmask = _mm512_load_si512(reinterpret_cast<const void*>(byte_mask));
+  const __m512i didx = _mm512_load_si512(reinterpret_cast<const void*>(dword_index));
+  __m512i zmm0[4], zmm1[4];
+  for (uint64_t i = 0; i < vectorizable_elements; i += 64) {
+    /* Fetch 64 elements (256 bytes); lane k of zmm0[j] then holds byte k of its 16 elements */
+    for (int j = 0; j < 4; j++) {
+      zmm0[j] = _mm512_loadu_si512(reinterpret_cast<const void*>(src + (i * bytesoftype) + (j * sizeof(__m512i))));
+      zmm0[j] = _mm512_maskz_permutexvar_epi32(0xFFFF, didx, _mm512_shuffle_epi8(zmm0[j], bmask));
+    }
+    /* Transpose 128 bit lanes */
+    zmm1[0] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm0[0], zmm0[1], 0x44);
+    zmm1[1] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm0[0], zmm0[1], 0xEE);
+    zmm1[2] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm0[2], zmm0[3], 0x44);
+    zmm1[3] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm0[2], zmm0[3], 0xEE);
+    zmm0[0] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm1[0], zmm1[2], 0x88);
+    zmm0[1] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm1[0], zmm1[2], 0xDD);
+    zmm0[2] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm1[1], zmm1[3], 0x88);
+    zmm0[3] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm1[1], zmm1[3], 0xDD);
+    for (int j = 0; j < 4; j++) {
+      _mm512_storeu_si512(reinterpret_cast<void*>(dest + i + (j * total_elements)), zmm0[j]);
+    }
   }
-  if(blocksize != vectorizable_bytes) shuffle_generic_inline(bytesoftype, vectorizable_elements, blocksize, src, dest);
-#elif defined(__SSE2__)
-  uint64_t total_elements = blocksize / bytesoftype;
-  uint64_t vectorized_chunk_size = bytesoftype * sizeof(__m128i);
-  uint64_t vectorizable_bytes = blocksize - (blocksize % vectorized_chunk_size);
-  uint64_t vectorizable_elements = vectorizable_bytes / bytesoftype;
-  switch(bytesoftype) {
-  case 4:
-    shuffle4_sse2(dest, src, vectorizable_elements, total_elements);
-    break;
-  case 8:
-    shuffle8_sse2(dest, src, vectorizable_elements, total_elements);
-    break;
+}
+
+// 8x8 transpose of 64 bit words, in three steps that each exchange one bit of the row and column index
+QS_TARGET_AVX512BW static inline void transpose8x8_epi64(__m512i * const zmm) {
+  alignas(64) static const uint64_t lo_index[3][8] = {{0, 8, 2, 10, 4, 12, 6, 14}, {0, 1, 8, 9, 4, 5, 12, 13}, {0, 1, 2, 3, 8, 9, 10, 11}};
+  alignas(64) static const uint64_t hi_index[3][8] = {{1, 9, 3, 11, 5, 13, 7, 15}, {2, 3, 10, 11, 6, 7, 14, 15}, {4, 5, 6, 7, 12, 13, 14, 15}};
+  for (int step = 0; step < 3; step++) {
+    const int stride = 1 << step;
+    const __m512i lo = _mm512_load_si512(reinterpret_cast<const void*>(lo_index[step]));
+    const __m512i hi = _mm512_load_si512(reinterpret_cast<const void*>(hi_index[step]));
+    for (int k = 0; k < 8; k++) {
+      if (k & stride) continue;
+      __m512i a = zmm[k];
+      zmm[k] = _mm512_permutex2var_epi64(a, lo, zmm[k + stride]);
+      zmm[k + stride] = _mm512_permutex2var_epi64(a, hi, zmm[k + stride]);
+    }
+  }
+}
+
+QS_TARGET_AVX512BW static void shuffle8_avx512(uint8_t* const dest, const uint8_t* const src,
+                                               const uint64_t vectorizable_elements, const uint64_t total_elements) {
+  static const uint64_t bytesoftype = 8;
+  alignas(64) static const uint8_t byte_mask[64] = {
+    0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15, 0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15,
+    0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15, 0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15};
+  alignas(64) static const uint16_t word_index[32] = {0, 8, 16, 24, 1, 9, 17, 25, 2, 10, 18, 26, 3, 11, 19, 27,
+                                                      4, 12, 20, 28, 5, 13, 21, 29, 6, 14, 22, 30, 7, 15, 23, 31};
+  const __m512i bmask = _mm512_load_si512(reinterpret_cast<const void*>(byte_mask));
+  const __m512i widx = _mm512_load_si512(reinterpret_cast<const void*>(word_index));
+  __m512i zmm[8];
+  for (uint64_t i = 0; i < vectorizable_elements; i += 64) {
+    /* Fetch 64 elements (512 bytes); each 64 bit word k of zmm[j] then holds byte k of 8 elements */
+    for (int j = 0; j < 8; j++) {
+      zmm[j] = _mm512_loadu_si512(reinterpret_cast<const void*>(src + (i * bytesoftype) + (j * sizeof(__m512i))));
+      zmm[j] = _mm512_maskz_permutexvar_epi16(0xFFFFFFFF, widx, _mm512_shuffle_epi8(zmm[j], bmask));
+    }
+    transpose8x8_epi64(zmm);
+    for (int j = 0; j < 8; j++) {
+      _mm512_storeu_si512(reinterpret_cast<void*>(dest + i + (j * total_elements)), zmm[j]);
+    }
   }
-  if(blocksize != vectorizable_bytes) shuffle_generic_inline(bytesoftype, vectorizable_elements, blocksize, src, dest);
-#else
-  shuffle_generic_inline(bytesoftype, 0, blocksize, src, dest);
+}
+
 #endif
+
+// shuffle dispatcher, using the kernels selected by init_simd_dispatch
+static void blosc_shuffle(const uint8_t * const src, uint8_t * const dest, const uint64_t blocksize, const uint64_t bytesoftype) {
+  uint64_t total_elements = blocksize / bytesoftype;
+  uint64_t vectorizable_elements = 0;
+  if(bytesoftype == 4 || bytesoftype == 8) {
+    switch(shuffle_simd_level) {
+#if defined(QS_AVX512BW_KERNELS)
+    case simd_level::avx512bw:
+      vectorizable_elements = total_elements - (total_elements % 64);
+      if(bytesoftype == 4) {
+        shuffle4_avx512(dest, src, vectorizable_elements, total_elements);
+      } else {
+        shuffle8_avx512(dest, src, vectorizable_elements, total_elements);
+      }
+      break;
+#endif
+#if defined(QS_AVX2_KERNELS)
+    case simd_level::avx2:
+      vectorizable_elements = total_elements - (total_elements % sizeof(__m256i));
+      if(bytesoftype == 4) {
+        shuffle4_avx2(dest, src, vectorizable_elements, total_elements);
+      } else {
+        shuffle8_avx2(dest, src, vectorizable_elements, total_elements);
+      }
+      break;
+#endif
+#if defined(__SSE2__)
+    case simd_level::sse2:
+      vectorizable_elements = total_elements - (total_elements % sizeof(__m128i));
+      if(bytesoftype == 4) {
+        shuffle4_sse2(dest, src, vectorizable_elements, total_elements);
+      } else {
+        shuffle8_sse2(dest, src, vectorizable_elements, total_elements);
+      }
+      break;
+#endif
+    default:
+      break;
+    }
+  }
+  if(vectorizable_elements < total_elements) shuffle_generic_inline(bytesoftype, vectorizable_elements, blocksize, src, dest);
 }
@@ -6,14 +6,7 @@
  See src/BLOSC_shuffle/BLOSC for details about copyright and rights to use. 
  */
 
-
-#if defined (__AVX2__)
-#include "immintrin.h"
-#elif defined(__SSE2__)
-#include "emmintrin.h"
-#else
-//no other includes necessary
-#endif
+// intrinsics headers and the kernel selection are in simd_dispatch.h
 
 static inline void unshuffle_generic_inline(const uint64_t type_size,
                                      const uint64_t vectorizable_elements, const uint64_t blocksize,
@@ -31,9 +24,9 @@ static inline void unshuffle_generic_inline(const uint64_t type_size,
   }
 }
 
-#if defined (__AVX2__)
+#if defined(QS_AVX2_KERNELS)
 
-static void unshuffle4_avx2(uint8_t* const dest, const uint8_t* const src,
+QS_TARGET_AVX2 static void unshuffle4_avx2(uint8_t* const dest, const uint8_t* const src,
                             const uint64_t vectorizable_elements, const uint64_t total_elements) {
   static const uint64_t bytesoftype = 4;
   uint64_t i;
@@ -72,7 +65,7 @@ static void unshuffle4_avx2(uint8_t* const dest, const uint8_t* const src,
   }
 }
 
-static void unshuffle8_avx2(uint8_t* const dest, const uint8_t* const src,
+QS_TARGET_AVX2 static void unshuffle8_avx2(uint8_t* const dest, const uint8_t* const src,
                   const uint64_t vectorizable_elements, const uint64_t total_elements) {
   static const uint64_t bytesoftype = 8;
   uint64_t i;
@@ -123,9 +116,9 @@ static void unshuffle8_avx2(uint8_t* const dest, const uint8_t* const src,
   }
 }
 
+#endif
 
-
-#elif defined(__SSE2__)
+#if defined(__SSE2__)
 
 static void unshuffle4_sse2(uint8_t* const dest, const uint8_t* const src,
                   const uint64_t vectorizable_elements, const uint64_t total_elements) {
@@ -209,41 +202,110 @@ static void unshuffle8_sse2(uint8_t* const dest, const uint8_t* const src,
     }
   }
 
-#else
-// if neither supported, no other functions needed
 #endif
 
-// shuffle dispatcher
-static void blosc_unshuffle(const uint8_t * const src, uint8_t * const dest, const uint64_t blocksize, const uint64_t bytesoftype) {
-  #if defined (__AVX2__)
-  uint64_t total_elements = blocksize / bytesoftype;
-  uint64_t vectorized_chunk_size = bytesoftype * sizeof(__m256i);
-  uint64_t vectorizable_bytes = blocksize - (blocksize % vectorized_chunk_size);
-  uint64_t vectorizable_elements = vectorizable_bytes / bytesoftype;
-  switch(bytesoftype) {
-  case 4:
-    unshuffle4_avx2(dest, src, vectorizable_elements, total_elements);
-    break;
-  case 8:
-    unshuffle8_avx2(dest, src, vectorizable_elements, total_elements);
-    break;
+#if defined(QS_AVX512BW_KERNELS)
+
+/* AVX-512BW kernels: the inverse of the steps in shuffle4_avx512 and shuffle8_avx512
+ (the maskz forms of the intrinsics avoid spurious -Wmaybe-uninitialized warnings from GCC 12 headers) */
+
+QS_TARGET_AVX512BW static void unshuffle4_avx512(uint8_t* const dest, const uint8_t* const src,
+                                                 const uint64_t vectorizable_elements, const uint64_t total_elements) {
+  static const uint64_t bytesoftype = 4;
+  alignas(64) static const uint8_t byte_mask[64] = {
+    0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15, 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+    0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15, 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15};
+  alignas(64) static const uint32_t dword_index[16] = {0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15};
+  const __m512i bmask = _mm512_load_si512(reinterpret_cast<const void*>(byte_mask));
+  const __m512i didx = _mm512_load_si512(reinterpret_cast<const void*>(dword_index));
+  __m512i zmm0[4], zmm1[4];
+  for (uint64_t i = 0; i < vectorizable_elements; i += 64) {
+    /* Load byte j of 64 elements into zmm0[j] */
+    for (int j = 0; j < 4; j++) {
+      zmm0[j] = _mm512_loadu_si512(reinterpret_cast<const void*>(src + i + (j * total_elements)));
+    }
+    /* Transpose 128 bit lanes */
+    zmm1[0] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm0[0], zmm0[1], 0x44);
+    zmm1[1] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm0[0], zmm0[1], 0xEE);
+    zmm1[2] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm0[2], zmm0[3], 0x44);
+    zmm1[3] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm0[2], zmm0[3], 0xEE);
+    zmm0[0] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm1[0], zmm1[2], 0x88);
+    zmm0[1] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm1[0], zmm1[2], 0xDD);
+    zmm0[2] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm1[1], zmm1[3], 0x88);
+    zmm0[3] = _mm512_maskz_shuffle_i32x4(0xFFFF, zmm1[1], zmm1[3], 0xDD);
+    /* Both permutations are their own inverse */
+    for (int j = 0; j < 4; j++) {
+      zmm0[j] = _mm512_shuffle_epi8(_mm512_maskz_permutexvar_epi32(0xFFFF, didx, zmm0[j]), bmask);
+      _mm512_storeu_si512(reinterpret_cast<void*>(dest + (i * bytesoftype) + (j * sizeof(__m512i))), zmm0[j]);
+    }
   }
-  unshuffle_generic_inline(bytesoftype, vectorizable_elements, blocksize, src, dest);
-#elif defined(__SSE2__)
+}
+
+QS_TARGET_AVX512BW static void unshuffle8_avx512(uint8_t* const dest, const uint8_t* const src,
+                                                 const uint64_t vectorizable_elements, const uint64_t total_elements) {
+  static const uint64_t bytesoftype = 8;
+  alignas(64) static const uint8_t byte_mask[64] = {
+    0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15, 0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15,
+    0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15, 0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15};
+  alignas(64) static const uint16_t word_index[32] = {0, 4, 8, 12, 16, 20, 24, 28, 1, 5, 9, 13, 17, 21, 25, 29,
+                                                      2, 6, 10, 14, 18, 22, 26, 30, 3, 7, 11, 15, 19, 23, 27, 31};
+  const __m512i bmask = _mm512_load_si512(reinterpret_cast<const void*>(byte_mask));
+  const __m512i widx = _mm512_load_si512(reinterpret_cast<const void*>(word_index));
+  __m512i zmm[8];
+  for (uint64_t i = 0; i < vectorizable_elements; i += 64) {
+    /* Load byte j of 64 elements into zmm[j] */
+    for (int j = 0; j < 8; j++) {
+      zmm[j] = _mm512_loadu_si512(reinterpret_cast<const void*>(src + i + (j * total_elements)));
+    }
+    transpose8x8_epi64(zmm);
+    for (int j = 0; j < 8; j++) {
+      zmm[j] = _mm512_shuffle_epi8(_mm512_maskz_permutexvar_epi16(0xFFFFFFFF, widx, zmm[j]), bmask);
+      _mm512_storeu_si512(reinterpret_cast<void*>(dest + (i * bytesoftype) + (j * sizeof(__m512i))), zmm[j]);
+    }
+  }
+}
+
+#endif
+
+// unshuffle dispatcher, using the kernels selected by init_simd_dispatch
+static void blosc_unshuffle(const uint8_t * const src, uint8_t * const dest, const uint64_t blocksize, const uint64_t bytesoftype) {
   uint64_t total_elements = blocksize / bytesoftype;
-  uint64_t vectorized_chunk_size = bytesoftype * sizeof(__m128i);
-  uint64_t vectorizable_bytes = blocksize - (blocksize % vectorized_chunk_size);
-  uint64_t vectorizable_elements = vectorizable_bytes / bytesoftype;
-  switch(bytesoftype) {
-  case 4:
-    unshuffle4_sse2(dest, src, vectorizable_elements, total_elements);
-    break;
-  case 8:
-    unshuffle8_sse2(dest, src, vectorizable_elements, total_elements);
-    break;
+  uint64_t vectorizable_elements = 0;
+  if(bytesoftype == 4 || bytesoftype == 8) {
+    switch(shuffle_simd_level) {
+#if defined(QS_AVX512BW_KERNELS)
+    case simd_level::avx512bw:
+      vectorizable_elements = total_elements - (total_elements % 64);
+      if(bytesoftype == 4) {
+        unshuffle4_avx512(dest, src, vectorizable_elements, total_elements);
+      } else {
+        unshuffle8_avx512(dest, src, vectorizable_elements, total_elements);
+      }
+      break;
+#endif
+#if defined(QS_AVX2_KERNELS)
+    case simd_level::avx2:
+      vectorizable_elements = total_elements - (total_elements % sizeof(__m256i));
+      if(bytesoftype == 4) {
+        unshuffle4_avx2(dest, src, vectorizable_elements, total_elements);
+      } else {
+        unshuffle8_avx2(dest, src, vectorizable_elements, total_elements);
+      }
+      break;
+#endif
+#if defined(__SSE2__)
+    case simd_level::sse2:
+      vectorizable_elements = total_elements - (total_elements % sizeof(__m128i));
+      if(bytesoftype == 4) {
+        unshuffle4_sse2(dest, src, vectorizable_elements, total_elements);
+      } else {
+        unshuffle8_sse2(dest, src, vectorizable_elements, total_elements);
+      }
+      break;
+#endif
+    default:
+      break;
+    }
   }
   unshuffle_generic_inline(bytesoftype, vectorizable_elements, blocksize, src, dest);
-#else
-  unshuffle_generic_inline(bytesoftype, 0, blocksize, src, dest);
-#endif
 }
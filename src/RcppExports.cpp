@@ -511,8 +511,8 @@ RcppExport SEXP _qs_is_big_endian() {
     return rcpp_result_gen;
 }
 // qsave
-double qsave(SEXP const x, const std::string& file, const std::string preset, const std::string algorithm, const int compress_level, const int shuffle_control, const bool check_hash, const int nthreads);
-static SEXP _qs_qsave_try(SEXP xSEXP, SEXP fileSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP, SEXP nthreadsSEXP) {
+double qsave(SEXP const x, const std::string& file, const std::string preset, const std::string algorithm, const int compress_level, const int shuffle_control, const bool check_hash, const int nthreads, const bool block_index, const bool dedup, const bool preserve_sharing, const bool block_checksum);
+static SEXP _qs_qsave_try(SEXP xSEXP, SEXP fileSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP, SEXP nthreadsSEXP, SEXP block_indexSEXP, SEXP dedupSEXP, SEXP preserve_sharingSEXP, SEXP block_checksumSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::traits::input_parameter< SEXP const >::type x(xSEXP);
@@ -523,14 +523,18 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const int >::type shuffle_control(shuffle_controlSEXP);
     Rcpp::traits::input_parameter< const bool >::type check_hash(check_hashSEXP);
     Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
-    rcpp_result_gen = Rcpp::wrap(qsave(x, file, preset, algorithm, compress_level, shuffle_control, check_hash, nthreads));
+    Rcpp::traits::input_parameter< const bool >::type block_index(block_indexSEXP);
+    Rcpp::traits::input_parameter< const bool >::type dedup(dedupSEXP);
+    Rcpp::traits::input_parameter< const bool >::type preserve_sharing(preserve_sharingSEXP);
+    Rcpp::traits::input_parameter< const bool >::type block_checksum(block_checksumSEXP);
+    rcpp_result_gen = Rcpp::wrap(qsave(x, file, preset, algorithm, compress_level, shuffle_control, check_hash, nthreads, block_index, dedup, preserve_sharing, block_checksum));
     return rcpp_result_gen;
 END_RCPP_RETURN_ERROR
 }
-RcppExport SEXP _qs_qsave(SEXP xSEXP, SEXP fileSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP, SEXP nthreadsSEXP) {
+RcppExport SEXP _qs_qsave(SEXP xSEXP, SEXP fileSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP, SEXP nthreadsSEXP, SEXP block_indexSEXP, SEXP dedupSEXP, SEXP preserve_sharingSEXP, SEXP block_checksumSEXP) {
     SEXP rcpp_result_gen;
     {
-        rcpp_result_gen = PROTECT(_qs_qsave_try(xSEXP, fileSEXP, presetSEXP, algorithmSEXP, compress_levelSEXP, shuffle_controlSEXP, check_hashSEXP, nthreadsSEXP));
+        rcpp_result_gen = PROTECT(_qs_qsave_try(xSEXP, fileSEXP, presetSEXP, algorithmSEXP, compress_levelSEXP, shuffle_controlSEXP, check_hashSEXP, nthreadsSEXP, block_indexSEXP, dedupSEXP, preserve_sharingSEXP, block_checksumSEXP));
     }
     Rboolean rcpp_isInterrupt_gen = Rf_inherits(rcpp_result_gen, "interrupted-error");
     if (rcpp_isInterrupt_gen) {
@@ -591,8 +595,8 @@ RcppExport SEXP _qs_c_qsave(SEXP xSEXP, SEXP fileSEXP, SEXP presetSEXP, SEXP alg
     return rcpp_result_gen;
 }
 // qsave_fd
-double qsave_fd(SEXP const x, const int fd, const std::string preset, const std::string algorithm, const int compress_level, const int shuffle_control, const bool check_hash);
-static SEXP _qs_qsave_fd_try(SEXP xSEXP, SEXP fdSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP) {
+double qsave_fd(SEXP const x, const int fd, const std::string preset, const std::string algorithm, const int compress_level, const int shuffle_control, const bool check_hash, const int nthreads);
+static SEXP _qs_qsave_fd_try(SEXP xSEXP, SEXP fdSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::traits::input_parameter< SEXP const >::type x(xSEXP);
@@ -602,14 +606,15 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const int >::type compress_level(compress_levelSEXP);
     Rcpp::traits::input_parameter< const int >::type shuffle_control(shuffle_controlSEXP);
     Rcpp::traits::input_parameter< const bool >::type check_hash(check_hashSEXP);
-    rcpp_result_gen = Rcpp::wrap(qsave_fd(x, fd, preset, algorithm, compress_level, shuffle_control, check_hash));
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(qsave_fd(x, fd, preset, algorithm, compress_level, shuffle_control, check_hash, nthreads));
     return rcpp_result_gen;
 END_RCPP_RETURN_ERROR
 }
-RcppExport SEXP _qs_qsave_fd(SEXP xSEXP, SEXP fdSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP) {
+RcppExport SEXP _qs_qsave_fd(SEXP xSEXP, SEXP fdSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP, SEXP nthreadsSEXP) {
     SEXP rcpp_result_gen;
     {
-        rcpp_result_gen = PROTECT(_qs_qsave_fd_try(xSEXP, fdSEXP, presetSEXP, algorithmSEXP, compress_levelSEXP, shuffle_controlSEXP, check_hashSEXP));
+        rcpp_result_gen = PROTECT(_qs_qsave_fd_try(xSEXP, fdSEXP, presetSEXP, algorithmSEXP, compress_levelSEXP, shuffle_controlSEXP, check_hashSEXP, nthreadsSEXP));
     }
     Rboolean rcpp_isInterrupt_gen = Rf_inherits(rcpp_result_gen, "interrupted-error");
     if (rcpp_isInterrupt_gen) {
@@ -630,8 +635,8 @@ RcppExport SEXP _qs_qsave_fd(SEXP xSEXP, SEXP fdSEXP, SEXP presetSEXP, SEXP algo
     return rcpp_result_gen;
 }
 // qsave_handle
-double qsave_handle(SEXP const x, SEXP const handle, const std::string preset, const std::string algorithm, const int compress_level, const int shuffle_control, const bool check_hash);
-static SEXP _qs_qsave_handle_try(SEXP xSEXP, SEXP handleSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP) {
+double qsave_handle(SEXP const x, SEXP const handle, const std::string preset, const std::string algorithm, const int compress_level, const int shuffle_control, const bool check_hash, const int nthreads);
+static SEXP _qs_qsave_handle_try(SEXP xSEXP, SEXP handleSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::traits::input_parameter< SEXP const >::type x(xSEXP);
@@ -641,14 +646,15 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const int >::type compress_level(compress_levelSEXP);
     Rcpp::traits::input_parameter< const int >::type shuffle_control(shuffle_controlSEXP);
     Rcpp::traits::input_parameter< const bool >::type check_hash(check_hashSEXP);
-    rcpp_result_gen = Rcpp::wrap(qsave_handle(x, handle, preset, algorithm, compress_level, shuffle_control, check_hash));
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(qsave_handle(x, handle, preset, algorithm, compress_level, shuffle_control, check_hash, nthreads));
     return rcpp_result_gen;
 END_RCPP_RETURN_ERROR
 }
-RcppExport SEXP _qs_qsave_handle(SEXP xSEXP, SEXP handleSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP) {
+RcppExport SEXP _qs_qsave_handle(SEXP xSEXP, SEXP handleSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP, SEXP nthreadsSEXP) {
     SEXP rcpp_result_gen;
     {
-        rcpp_result_gen = PROTECT(_qs_qsave_handle_try(xSEXP, handleSEXP, presetSEXP, algorithmSEXP, compress_levelSEXP, shuffle_controlSEXP, check_hashSEXP));
+        rcpp_result_gen = PROTECT(_qs_qsave_handle_try(xSEXP, handleSEXP, presetSEXP, algorithmSEXP, compress_levelSEXP, shuffle_controlSEXP, check_hashSEXP, nthreadsSEXP));
     }
     Rboolean rcpp_isInterrupt_gen = Rf_inherits(rcpp_result_gen, "interrupted-error");
     if (rcpp_isInterrupt_gen) {
@@ -669,8 +675,8 @@ RcppExport SEXP _qs_qsave_handle(SEXP xSEXP, SEXP handleSEXP, SEXP presetSEXP, S
     return rcpp_result_gen;
 }
 // qserialize
-RawVector qserialize(SEXP const x, const std::string preset, const std::string algorithm, const int compress_level, const int shuffle_control, const bool check_hash);
-static SEXP _qs_qserialize_try(SEXP xSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP) {
+RawVector qserialize(SEXP const x, const std::string preset, const std::string algorithm, const int compress_level, const int shuffle_control, const bool check_hash, const int nthreads);
+static SEXP _qs_qserialize_try(SEXP xSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::traits::input_parameter< SEXP const >::type x(xSEXP);
@@ -679,14 +685,15 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const int >::type compress_level(compress_levelSEXP);
     Rcpp::traits::input_parameter< const int >::type shuffle_control(shuffle_controlSEXP);
     Rcpp::traits::input_parameter< const bool >::type check_hash(check_hashSEXP);
-    rcpp_result_gen = Rcpp::wrap(qserialize(x, preset, algorithm, compress_level, shuffle_control, check_hash));
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(qserialize(x, preset, algorithm, compress_level, shuffle_control, check_hash, nthreads));
     return rcpp_result_gen;
 END_RCPP_RETURN_ERROR
 }
-RcppExport SEXP _qs_qserialize(SEXP xSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP) {
+RcppExport SEXP _qs_qserialize(SEXP xSEXP, SEXP presetSEXP, SEXP algorithmSEXP, SEXP compress_levelSEXP, SEXP shuffle_controlSEXP, SEXP check_hashSEXP, SEXP nthreadsSEXP) {
     SEXP rcpp_result_gen;
     {
-        rcpp_result_gen = PROTECT(_qs_qserialize_try(xSEXP, presetSEXP, algorithmSEXP, compress_levelSEXP, shuffle_controlSEXP, check_hashSEXP));
+        rcpp_result_gen = PROTECT(_qs_qserialize_try(xSEXP, presetSEXP, algorithmSEXP, compress_levelSEXP, shuffle_controlSEXP, check_hashSEXP, nthreadsSEXP));
     }
     Rboolean rcpp_isInterrupt_gen = Rf_inherits(rcpp_result_gen, "interrupted-error");
     if (rcpp_isInterrupt_gen) {
@@ -745,22 +752,26 @@ RcppExport SEXP _qs_c_qserialize(SEXP xSEXP, SEXP presetSEXP, SEXP algorithmSEXP
     return rcpp_result_gen;
 }
 // qread
-SEXP qread(const std::string& file, const bool use_alt_rep, const bool strict, const int nthreads);
-static SEXP _qs_qread_try(SEXP fileSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP, SEXP nthreadsSEXP) {
+SEXP qread(const std::string& file, const bool use_alt_rep, const bool strict, const int nthreads, const bool use_mmap, const bool lazy, SEXP select, SEXP elements);
+static SEXP _qs_qread_try(SEXP fileSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP, SEXP nthreadsSEXP, SEXP use_mmapSEXP, SEXP lazySEXP, SEXP selectSEXP, SEXP elementsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::traits::input_parameter< const std::string& >::type file(fileSEXP);
     Rcpp::traits::input_parameter< const bool >::type use_alt_rep(use_alt_repSEXP);
     Rcpp::traits::input_parameter< const bool >::type strict(strictSEXP);
     Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
-    rcpp_result_gen = Rcpp::wrap(qread(file, use_alt_rep, strict, nthreads));
+    Rcpp::traits::input_parameter< const bool >::type use_mmap(use_mmapSEXP);
+    Rcpp::traits::input_parameter< const bool >::type lazy(lazySEXP);
+    Rcpp::traits::input_parameter< SEXP >::type select(selectSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type elements(elementsSEXP);
+    rcpp_result_gen = Rcpp::wrap(qread(file, use_alt_rep, strict, nthreads, use_mmap, lazy, select, elements));
     return rcpp_result_gen;
 END_RCPP_RETURN_ERROR
 }
-RcppExport SEXP _qs_qread(SEXP fileSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP, SEXP nthreadsSEXP) {
+RcppExport SEXP _qs_qread(SEXP fileSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP, SEXP nthreadsSEXP, SEXP use_mmapSEXP, SEXP lazySEXP, SEXP selectSEXP, SEXP elementsSEXP) {
     SEXP rcpp_result_gen;
     {
-        rcpp_result_gen = PROTECT(_qs_qread_try(fileSEXP, use_alt_repSEXP, strictSEXP, nthreadsSEXP));
+        rcpp_result_gen = PROTECT(_qs_qread_try(fileSEXP, use_alt_repSEXP, strictSEXP, nthreadsSEXP, use_mmapSEXP, lazySEXP, selectSEXP, elementsSEXP));
     }
     Rboolean rcpp_isInterrupt_gen = Rf_inherits(rcpp_result_gen, "interrupted-error");
     if (rcpp_isInterrupt_gen) {
@@ -853,21 +864,22 @@ RcppExport SEXP _qs_c_qread(SEXP fileSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP
     return rcpp_result_gen;
 }
 // qread_fd
-SEXP qread_fd(const int fd, const bool use_alt_rep, const bool strict);
-static SEXP _qs_qread_fd_try(SEXP fdSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP) {
+SEXP qread_fd(const int fd, const bool use_alt_rep, const bool strict, const int nthreads);
+static SEXP _qs_qread_fd_try(SEXP fdSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::traits::input_parameter< const int >::type fd(fdSEXP);
     Rcpp::traits::input_parameter< const bool >::type use_alt_rep(use_alt_repSEXP);
     Rcpp::traits::input_parameter< const bool >::type strict(strictSEXP);
-    rcpp_result_gen = Rcpp::wrap(qread_fd(fd, use_alt_rep, strict));
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(qread_fd(fd, use_alt_rep, strict, nthreads));
     return rcpp_result_gen;
 END_RCPP_RETURN_ERROR
 }
-RcppExport SEXP _qs_qread_fd(SEXP fdSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP) {
+RcppExport SEXP _qs_qread_fd(SEXP fdSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP, SEXP nthreadsSEXP) {
     SEXP rcpp_result_gen;
     {
-        rcpp_result_gen = PROTECT(_qs_qread_fd_try(fdSEXP, use_alt_repSEXP, strictSEXP));
+        rcpp_result_gen = PROTECT(_qs_qread_fd_try(fdSEXP, use_alt_repSEXP, strictSEXP, nthreadsSEXP));
     }
     Rboolean rcpp_isInterrupt_gen = Rf_inherits(rcpp_result_gen, "interrupted-error");
     if (rcpp_isInterrupt_gen) {
@@ -888,21 +900,22 @@ RcppExport SEXP _qs_qread_fd(SEXP fdSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP)
     return rcpp_result_gen;
 }
 // qread_handle
-SEXP qread_handle(SEXP const handle, const bool use_alt_rep, const bool strict);
-static SEXP _qs_qread_handle_try(SEXP handleSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP) {
+SEXP qread_handle(SEXP const handle, const bool use_alt_rep, const bool strict, const int nthreads);
+static SEXP _qs_qread_handle_try(SEXP handleSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::traits::input_parameter< SEXP const >::type handle(handleSEXP);
     Rcpp::traits::input_parameter< const bool >::type use_alt_rep(use_alt_repSEXP);
     Rcpp::traits::input_parameter< const bool >::type strict(strictSEXP);
-    rcpp_result_gen = Rcpp::wrap(qread_handle(handle, use_alt_rep, strict));
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(qread_handle(handle, use_alt_rep, strict, nthreads));
     return rcpp_result_gen;
 END_RCPP_RETURN_ERROR
 }
-RcppExport SEXP _qs_qread_handle(SEXP handleSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP) {
+RcppExport SEXP _qs_qread_handle(SEXP handleSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP, SEXP nthreadsSEXP) {
     SEXP rcpp_result_gen;
     {
-        rcpp_result_gen = PROTECT(_qs_qread_handle_try(handleSEXP, use_alt_repSEXP, strictSEXP));
+        rcpp_result_gen = PROTECT(_qs_qread_handle_try(handleSEXP, use_alt_repSEXP, strictSEXP, nthreadsSEXP));
     }
     Rboolean rcpp_isInterrupt_gen = Rf_inherits(rcpp_result_gen, "interrupted-error");
     if (rcpp_isInterrupt_gen) {
@@ -923,22 +936,23 @@ RcppExport SEXP _qs_qread_handle(SEXP handleSEXP, SEXP use_alt_repSEXP, SEXP str
     return rcpp_result_gen;
 }
 // qread_ptr
-SEXP qread_ptr(SEXP const pointer, const double length, const bool use_alt_rep, const bool strict);
-static SEXP _qs_qread_ptr_try(SEXP pointerSEXP, SEXP lengthSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP) {
+SEXP qread_ptr(SEXP const pointer, const double length, const bool use_alt_rep, const bool strict, const int nthreads);
+static SEXP _qs_qread_ptr_try(SEXP pointerSEXP, SEXP lengthSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::traits::input_parameter< SEXP const >::type pointer(pointerSEXP);
     Rcpp::traits::input_parameter< const double >::type length(lengthSEXP);
     Rcpp::traits::input_parameter< const bool >::type use_alt_rep(use_alt_repSEXP);
     Rcpp::traits::input_parameter< const bool >::type strict(strictSEXP);
-    rcpp_result_gen = Rcpp::wrap(qread_ptr(pointer, length, use_alt_rep, strict));
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(qread_ptr(pointer, length, use_alt_rep, strict, nthreads));
     return rcpp_result_gen;
 END_RCPP_RETURN_ERROR
 }
-RcppExport SEXP _qs_qread_ptr(SEXP pointerSEXP, SEXP lengthSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP) {
+RcppExport SEXP _qs_qread_ptr(SEXP pointerSEXP, SEXP lengthSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP, SEXP nthreadsSEXP) {
     SEXP rcpp_result_gen;
     {
-        rcpp_result_gen = PROTECT(_qs_qread_ptr_try(pointerSEXP, lengthSEXP, use_alt_repSEXP, strictSEXP));
+        rcpp_result_gen = PROTECT(_qs_qread_ptr_try(pointerSEXP, lengthSEXP, use_alt_repSEXP, strictSEXP, nthreadsSEXP));
     }
     Rboolean rcpp_isInterrupt_gen = Rf_inherits(rcpp_result_gen, "interrupted-error");
     if (rcpp_isInterrupt_gen) {
@@ -959,21 +973,22 @@ RcppExport SEXP _qs_qread_ptr(SEXP pointerSEXP, SEXP lengthSEXP, SEXP use_alt_re
     return rcpp_result_gen;
 }
 // qdeserialize
-SEXP qdeserialize(SEXP const x, const bool use_alt_rep, const bool strict);
-static SEXP _qs_qdeserialize_try(SEXP xSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP) {
+SEXP qdeserialize(SEXP const x, const bool use_alt_rep, const bool strict, const int nthreads);
+static SEXP _qs_qdeserialize_try(SEXP xSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::traits::input_parameter< SEXP const >::type x(xSEXP);
     Rcpp::traits::input_parameter< const bool >::type use_alt_rep(use_alt_repSEXP);
     Rcpp::traits::input_parameter< const bool >::type strict(strictSEXP);
-    rcpp_result_gen = Rcpp::wrap(qdeserialize(x, use_alt_rep, strict));
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(qdeserialize(x, use_alt_rep, strict, nthreads));
     return rcpp_result_gen;
 END_RCPP_RETURN_ERROR
 }
-RcppExport SEXP _qs_qdeserialize(SEXP xSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP) {
+RcppExport SEXP _qs_qdeserialize(SEXP xSEXP, SEXP use_alt_repSEXP, SEXP strictSEXP, SEXP nthreadsSEXP) {
     SEXP rcpp_result_gen;
     {
-        rcpp_result_gen = PROTECT(_qs_qdeserialize_try(xSEXP, use_alt_repSEXP, strictSEXP));
+        rcpp_result_gen = PROTECT(_qs_qdeserialize_try(xSEXP, use_alt_repSEXP, strictSEXP, nthreadsSEXP));
     }
     Rboolean rcpp_isInterrupt_gen = Rf_inherits(rcpp_result_gen, "interrupted-error");
     if (rcpp_isInterrupt_gen) {
@@ -1530,6 +1545,38 @@ RcppExport SEXP _qs_set_trust_promises(SEXP valueSEXP) {
     UNPROTECT(1);
     return rcpp_result_gen;
 }
+// charsxp_cache_stats
+NumericVector charsxp_cache_stats();
+static SEXP _qs_charsxp_cache_stats_try() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(charsxp_cache_stats());
+    return rcpp_result_gen;
+END_RCPP_RETURN_ERROR
+}
+RcppExport SEXP _qs_charsxp_cache_stats() {
+    SEXP rcpp_result_gen;
+    {
+        rcpp_result_gen = PROTECT(_qs_charsxp_cache_stats_try());
+    }
+    Rboolean rcpp_isInterrupt_gen = Rf_inherits(rcpp_result_gen, "interrupted-error");
+    if (rcpp_isInterrupt_gen) {
+        UNPROTECT(1);
+        Rf_onintr();
+    }
+    bool rcpp_isLongjump_gen = Rcpp::internal::isLongjumpSentinel(rcpp_result_gen);
+    if (rcpp_isLongjump_gen) {
+        Rcpp::internal::resumeJump(rcpp_result_gen);
+    }
+    Rboolean rcpp_isError_gen = Rf_inherits(rcpp_result_gen, "try-error");
+    if (rcpp_isError_gen) {
+        SEXP rcpp_msgSEXP_gen = Rf_asChar(rcpp_result_gen);
+        UNPROTECT(1);
+        Rf_error("%s", CHAR(rcpp_msgSEXP_gen));
+    }
+    UNPROTECT(1);
+    return rcpp_result_gen;
+}
 
 // validate (ensure exported C++ functions exist before calling them)
 static int _qs_RcppExport_validate(const char* sig) { 
@@ -1550,19 +1597,19 @@ static int _qs_RcppExport_validate(const char* sig) {
         signatures.insert("std::string(*c_base91_encode)(const RawVector&)");
         signatures.insert("RawVector(*c_base91_decode)(const std::string&)");
         signatures.insert("bool(*is_big_endian)()");
-        signatures.insert("double(*qsave)(SEXP const,const std::string&,const std::string,const std::string,const int,const int,const bool,const int)");
+        signatures.insert("double(*qsave)(SEXP const,const std::string&,const std::string,const std::string,const int,const int,const bool,const int,const bool,const bool,const bool,const bool)");
         signatures.insert("double(*c_qsave)(SEXP const,const std::string&,const std::string,const std::string,const int,const int,const bool,const int)");
-        signatures.insert("double(*qsave_fd)(SEXP const,const int,const std::string,const std::string,const int,const int,const bool)");
-        signatures.insert("double(*qsave_handle)(SEXP const,SEXP const,const std::string,const std::string,const int,const int,const bool)");
-        signatures.insert("RawVector(*qserialize)(SEXP const,const std::string,const std::string,const int,const int,const bool)");
+        signatures.insert("double(*qsave_fd)(SEXP const,const int,const std::string,const std::string,const int,const int,const bool,const int)");
+        signatures.insert("double(*qsave_handle)(SEXP const,SEXP const,const std::string,const std::string,const int,const int,const bool,const int)");
+        signatures.insert("RawVector(*qserialize)(SEXP const,const std::string,const std::string,const int,const int,const bool,const int)");
         signatures.insert("RawVector(*c_qserialize)(SEXP const,const std::string,const std::string,const int,const int,const bool)");
-        signatures.insert("SEXP(*qread)(const std::string&,const bool,const bool,const int)");
+        signatures.insert("SEXP(*qread)(const std::string&,const bool,const bool,const int,const bool,const bool,SEXP,SEXP)");
         signatures.insert("SEXP(*c_qattributes)(const std::string&,const bool,const bool,const int)");
         signatures.insert("SEXP(*c_qread)(const std::string&,const bool,const bool,const int)");
-        signatures.insert("SEXP(*qread_fd)(const int,const bool,const bool)");
-        signatures.insert("SEXP(*qread_handle)(SEXP const,const bool,const bool)");
-        signatures.insert("SEXP(*qread_ptr)(SEXP const,const double,const bool,const bool)");
-        signatures.insert("SEXP(*qdeserialize)(SEXP const,const bool,const bool)");
+        signatures.insert("SEXP(*qread_fd)(const int,const bool,const bool,const int)");
+        signatures.insert("SEXP(*qread_handle)(SEXP const,const bool,const bool,const int)");
+        signatures.insert("SEXP(*qread_ptr)(SEXP const,const double,const bool,const bool,const int)");
+        signatures.insert("SEXP(*qdeserialize)(SEXP const,const bool,const bool,const int)");
         signatures.insert("SEXP(*c_qdeserialize)(SEXP const,const bool,const bool)");
         signatures.insert("RObject(*qdump)(const std::string&)");
         signatures.insert("int(*openFd)(const std::string&,const std::string&)");
@@ -1579,6 +1626,7 @@ static int _qs_RcppExport_validate(const char* sig) {
         signatures.insert("void(*unregister_altrep_class)(const std::string&,const std::string&)");
         signatures.insert("SEXP(*get_altrep_class_info)(SEXP)");
         signatures.insert("bool(*set_trust_promises)(bool)");
+        signatures.insert("NumericVector(*charsxp_cache_stats)()");
     }
     return signatures.find(sig) != signatures.end();
 }
@@ -1629,6 +1677,7 @@ RcppExport SEXP _qs_RcppExport_registerCCallable() {
     R_RegisterCCallable("qs", "_qs_unregister_altrep_class", (DL_FUNC)_qs_unregister_altrep_class_try);
     R_RegisterCCallable("qs", "_qs_get_altrep_class_info", (DL_FUNC)_qs_get_altrep_class_info_try);
     R_RegisterCCallable("qs", "_qs_set_trust_promises", (DL_FUNC)_qs_set_trust_promises_try);
+    R_RegisterCCallable("qs", "_qs_charsxp_cache_stats", (DL_FUNC)_qs_charsxp_cache_stats_try);
     R_RegisterCCallable("qs", "_qs_RcppExport_validate", (DL_FUNC)_qs_RcppExport_validate);
     return R_NilValue;
 }
@@ -1649,19 +1698,19 @@ static const R_CallMethodDef CallEntries[] = {
     {"_qs_c_base91_encode", (DL_FUNC) &_qs_c_base91_encode, 1},
     {"_qs_c_base91_decode", (DL_FUNC) &_qs_c_base91_decode, 1},
     {"_qs_is_big_endian", (DL_FUNC) &_qs_is_big_endian, 0},
-    {"_qs_qsave", (DL_FUNC) &_qs_qsave, 8},
+    {"_qs_qsave", (DL_FUNC) &_qs_qsave, 12},
     {"_qs_c_qsave", (DL_FUNC) &_qs_c_qsave, 8},
-    {"_qs_qsave_fd", (DL_FUNC) &_qs_qsave_fd, 7},
-    {"_qs_qsave_handle", (DL_FUNC) &_qs_qsave_handle, 7},
-    {"_qs_qserialize", (DL_FUNC) &_qs_qserialize, 6},
+    {"_qs_qsave_fd", (DL_FUNC) &_qs_qsave_fd, 8},
+    {"_qs_qsave_handle", (DL_FUNC) &_qs_qsave_handle, 8},
+    {"_qs_qserialize", (DL_FUNC) &_qs_qserialize, 7},
     {"_qs_c_qserialize", (DL_FUNC) &_qs_c_qserialize, 6},
-    {"_qs_qread", (DL_FUNC) &_qs_qread, 4},
+    {"_qs_qread", (DL_FUNC) &_qs_qread, 8},
     {"_qs_c_qattributes", (DL_FUNC) &_qs_c_qattributes, 4},
     {"_qs_c_qread", (DL_FUNC) &_qs_c_qread, 4},
-    {"_qs_qread_fd", (DL_FUNC) &_qs_qread_fd, 3},
-    {"_qs_qread_handle", (DL_FUNC) &_qs_qread_handle, 3},
-    {"_qs_qread_ptr", (DL_FUNC) &_qs_qread_ptr, 4},
-    {"_qs_qdeserialize", (DL_FUNC) &_qs_qdeserialize, 3},
+    {"_qs_qread_fd", (DL_FUNC) &_qs_qread_fd, 4},
+    {"_qs_qread_handle", (DL_FUNC) &_qs_qread_handle, 4},
+    {"_qs_qread_ptr", (DL_FUNC) &_qs_qread_ptr, 5},
+    {"_qs_qdeserialize", (DL_FUNC) &_qs_qdeserialize, 4},
     {"_qs_c_qdeserialize", (DL_FUNC) &_qs_c_qdeserialize, 3},
     {"_qs_qdump", (DL_FUNC) &_qs_qdump, 1},
     {"_qs_openFd", (DL_FUNC) &_qs_openFd, 2},
@@ -1678,11 +1727,16 @@ static const R_CallMethodDef CallEntries[] = {
     {"_qs_unregister_altrep_class", (DL_FUNC) &_qs_unregister_altrep_class, 2},
     {"_qs_get_altrep_class_info", (DL_FUNC) &_qs_get_altrep_class_info, 1},
     {"_qs_set_trust_promises", (DL_FUNC) &_qs_set_trust_promises, 1},
+    {"_qs_charsxp_cache_stats", (DL_FUNC) &_qs_charsxp_cache_stats, 0},
     {"_qs_RcppExport_registerCCallable", (DL_FUNC) &_qs_RcppExport_registerCCallable, 0},
     {NULL, NULL, 0}
 };
 
+void qs_init_simd(DllInfo* dll);
+void qs_init_altrep(DllInfo* dll);
 RcppExport void R_init_qs(DllInfo *dll) {
     R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
     R_useDynamicSymbols(dll, FALSE);
+    qs_init_simd(dll);
+    qs_init_altrep(dll);
 }
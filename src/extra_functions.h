@@ -26,15 +26,15 @@
 
 // [[Rcpp::interfaces(r, cpp)]]
 
+// the byte shuffle kernels in use, chosen when the package is loaded (see simd_dispatch.h)
 // [[Rcpp::export(rng = false)]]
 std::string check_SIMD() {
-#if defined (__AVX2__)
-  return "AVX2";
-#elif defined (__SSE2__)
-  return "SSE2";
-#else
-  return "no SIMD";
-#endif
+  return simd_level_name(shuffle_simd_level);
+}
+
+// [[Rcpp::init]]
+void qs_init_simd(DllInfo* dll) {
+  init_simd_dispatch();
 }
 
 // [[Rcpp::export(rng = false)]]
@@ -59,6 +59,7 @@ https://github.com/qsbase/qs
 #endif
 #else
 #include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
 #endif
 
 #include <atomic>
@@ -73,8 +74,10 @@ https://github.com/qsbase/qs
 #include "zstd.h"
 #include "lz4.h"
 #include "lz4hc.h"
+#include "simd_dispatch.h"
 #include "BLOSC/shuffle_routines.h"
 #include "BLOSC/unshuffle_routines.h"
+#include "transform_routines.h"
 
 #include "xxhash/xxhash.c"
 #include <R_ext/Rdynload.h>
@@ -108,8 +111,102 @@ static constexpr uint64_t MIN_SHUFFLE_ELEMENTS = 4ULL;
 static constexpr uint64_t BLOCKSIZE = 524288ULL;
 static constexpr uint64_t MAX_SAFE_INTEGER = 9007199254740991ULL; // 2^53-1 -- the largest integer that can be "safely" represented as a double ~ (about 9000 terabytes)
 
+// data for shuffle_push_temporary: source(offset, length) returns the bytes [offset, offset + length) of the vector
+// they are requested at most BLOCKSIZE bytes and whole elements at a time, and only need to stay valid until the next request
+// byte shuffled vectors are requested in order once for each byte plane, starting again from offset 0 (see blosc_shuffle_range)
+struct PointerSource {
+  const char * const data;
+  const char * operator()(const uint64_t offset, const uint64_t length) const {
+    return data + offset;
+  }
+};
+
+template <uint64_t bytesoftype>
+inline void gather_byte_plane(const uint8_t * const src, uint8_t * const dest, const uint64_t n, const uint64_t k) {
+  for(uint64_t i=0; i<n; i++) dest[i] = src[i*bytesoftype + k];
+}
+
+template <uint64_t bytesoftype>
+inline void scatter_byte_plane(const uint8_t * const src, uint8_t * const dest, const uint64_t n, const uint64_t k) {
+  for(uint64_t i=0; i<n; i++) dest[i*bytesoftype + k] = src[i];
+}
+
+// A byte shuffled vector of len bytes is stored as blosc_shuffle of the whole vector: byte k of element i is at k * n + i
+// (n = len / bytesoftype), followed by the last len % bytesoftype bytes as is
+// Writes the bytes [offset, offset + length) of the shuffled vector to dest, gathering them from every bytesoftype-th byte of source,
+// so that a vector is shuffled block by block into the compression buffers without a shuffled copy of the whole vector
+template <class Source>
+inline void blosc_shuffle_range(Source && source, char * dest, const uint64_t len, const uint64_t bytesoftype,
+                                uint64_t offset, const uint64_t length) {
+  const uint64_t n = len / bytesoftype;
+  const uint64_t end = offset + length;
+  while(offset < end) {
+    if(offset >= n * bytesoftype) {
+      std::memcpy(dest, source(offset, end - offset), end - offset);
+      return;
+    }
+    uint64_t k = offset / n;
+    uint64_t i = offset % n;
+    uint64_t add_length = std::min(std::min(n - i, end - offset), BLOCKSIZE / bytesoftype);
+    const uint8_t * const src = reinterpret_cast<const uint8_t *>(source(i * bytesoftype, add_length * bytesoftype));
+    uint8_t * const out = reinterpret_cast<uint8_t *>(dest);
+    switch(bytesoftype) {
+    case 4:
+      gather_byte_plane<4>(src, out, add_length, k);
+      break;
+    case 8:
+      gather_byte_plane<8>(src, out, add_length, k);
+      break;
+    default:
+      for(uint64_t j=0; j<add_length; j++) out[j] = src[j*bytesoftype + k];
+      break;
+    }
+    dest += add_length;
+    offset += add_length;
+  }
+}
+
+// The inverse of blosc_shuffle_range: scatters the bytes [offset, offset + length) of the shuffled vector in src into the vector dest
+// Only the bytes of dest that come from the range are written, one at a time, so different ranges of a vector can be unshuffled by
+// different threads at the same time
+inline void blosc_unshuffle_range(const char * src, char * const dest, const uint64_t len, const uint64_t bytesoftype,
+                                  uint64_t offset, const uint64_t length) {
+  const uint64_t n = len / bytesoftype;
+  const uint64_t end = offset + length;
+  while(offset < end) {
+    if(offset >= n * bytesoftype) {
+      std::memcpy(dest + offset, src, end - offset);
+      return;
+    }
+    uint64_t k = offset / n;
+    uint64_t i = offset % n;
+    uint64_t add_length = std::min(n - i, end - offset);
+    const uint8_t * const in = reinterpret_cast<const uint8_t *>(src);
+    uint8_t * const out = reinterpret_cast<uint8_t *>(dest) + i * bytesoftype;
+    switch(bytesoftype) {
+    case 4:
+      scatter_byte_plane<4>(in, out, add_length, k);
+      break;
+    case 8:
+      scatter_byte_plane<8>(in, out, add_length, k);
+      break;
+    default:
+      for(uint64_t j=0; j<add_length; j++) out[j*bytesoftype + k] = in[j];
+      break;
+    }
+    src += add_length;
+    offset += add_length;
+  }
+}
+
 static const std::array<uint8_t,4> magic_bits = {0x0B,0x0E,0x0A,0x0C};
-static const std::array<uint8_t,4> empty_bits = {0,0,0,0};
+// flags stored in the first byte of the second header word (empty in prior versions, older versions of qs skip it)
+static constexpr uint8_t FLAG_BLOCK_INDEX = 0x01;
+// each compressed block is followed by an 8 byte XXH3-64 checksum of the compressed data, and the 4 byte hash after the data
+// is replaced by an 8 byte digest of all block checksums (see BlockChecksums); only for block compressed formats
+static constexpr uint8_t FLAG_BLOCK_CHECKSUM = 0x04;
+// magic bits + extension bits + reserve bits + clength
+static constexpr uint64_t QS_HEADER_SIZE = 20ULL;
 
 static constexpr uint8_t list_header_5 = 0x20_u8;
 static constexpr uint8_t list_header_8 = 0x01_u8;
@@ -194,6 +291,30 @@ static constexpr uint8_t clos_wf_header = 0x13_u8;
 static constexpr uint8_t prom_wf_header = 0x14_u8;
 static constexpr uint8_t dot_wf_header = 0x15_u8;
 
+// character vector stored as a table of unique values followed by 1, 2 or 4 byte codes
+// [extension_header][character_dict_header][8 byte length][4 byte number of unique values][1 byte code width]
+static constexpr uint8_t character_dict_header = 0x16_u8;
+
+// prefix of an object that can be referenced later with reference_object_header (e.g. factor levels), followed by a 4 byte index
+// environments carry their index in their own header instead
+static constexpr uint8_t shared_object_header = 0x17_u8;
+
+// compact integer or numeric sequence (ALTREP), rebuilt without materializing the data
+// [extension_header][compact_seq_header][8 byte length][1 byte type: 0 integer, 1 numeric][8 byte double start][8 byte double step]
+static constexpr uint8_t compact_seq_header = 0x18_u8;
+
+// integer or numeric vector stored as deltas or XOR of consecutive values, always byte shuffled
+// [extension_header][transformed_vector_header][8 byte length][1 byte type: 0 integer, 1 numeric][1 byte vector_transform]
+static constexpr uint8_t transformed_vector_header = 0x19_u8;
+
+// logical vector packed to 2 bits per element (see transform_routines.h), not shuffled
+// [extension_header][packed_logical_header][8 byte length]
+static constexpr uint8_t packed_logical_header = 0x1A_u8;
+
+// integer or numeric vector, optionally transformed as for transformed_vector_header, then bit shuffled instead of byte shuffled
+// [extension_header][bitshuffled_vector_header][8 byte length][1 byte type: 0 integer, 1 numeric][1 byte vector_transform]
+static constexpr uint8_t bitshuffled_vector_header = 0x1B_u8;
+
 
 
 // static constexpr std::array<uint8_t,2> s4_header_with_ext {{ extension_header, s4_header }};
@@ -223,7 +344,7 @@ static constexpr uint8_t dot_wf_header = 0x15_u8;
 enum class qstype {NUMERIC, INTEGER, LOGICAL, CHARACTER, NIL, LIST, COMPLEX, RAW, PAIRLIST, LANG, CLOS, PROM, DOT, SYM,
                    PAIRLIST_WF, LANG_WF, CLOS_WF, PROM_WF, DOT_WF, // with flags
                    S4, S4FLAG, LOCKED_ENV, UNLOCKED_ENV, REFERENCE,
-                   ATTRIBUTE, RSERIALIZED};
+                   ATTRIBUTE, RSERIALIZED, CHARACTER_DICT, SHARED, COMPACT_SEQ, TRANSFORMED, PACKED_LOGICAL, BITSHUFFLED};
 
 // global variable to trust promises for both serialization and de-serialization
 static bool trust_promises_global = false;
@@ -328,7 +449,10 @@ struct fd_wrapper {
     while(remaining_bytes > buffered_bytes - buffer_offset) {
       std::memcpy(ptr + count - remaining_bytes, buffer.data() + buffer_offset, buffered_bytes - buffer_offset);
       remaining_bytes -= buffered_bytes - buffer_offset;
-      ssize_t temp = ::read(fd, buffer.data(), FD_BUFFER_SIZE);
+      ssize_t temp;
+      do { // retry interrupted reads before the buffer is refilled
+        temp = ::read(fd, buffer.data(), FD_BUFFER_SIZE);
+      } while(temp < 0 && errno == EINTR);
       if(temp < 0) throw std::runtime_error("error reading fd");
       bytes_processed += temp;
       buffered_bytes = temp;
@@ -354,12 +478,10 @@ struct fd_wrapper {
         uint64_t bytes_to_write = FD_BUFFER_SIZE - buffered_bytes;
         if(buffered_bytes == 0) {
           // skip memcpy since nothing in buffer
-          ssize_t temp = ::write(fd, ptr + ptr_offset, FD_BUFFER_SIZE);
-          if(temp < 0) throw std::runtime_error("error writing to fd");
+          write_all(ptr + ptr_offset, FD_BUFFER_SIZE);
         } else {
           std::memcpy(buffer.data() + buffered_bytes, ptr + ptr_offset, bytes_to_write);
-          ssize_t temp = ::write(fd, buffer.data(), FD_BUFFER_SIZE);
-          if(temp < 0) throw std::runtime_error("error writing to fd");
+          write_all(buffer.data(), FD_BUFFER_SIZE);
         }
         remaining_bytes -= bytes_to_write;
         buffered_bytes = 0;
@@ -376,10 +498,19 @@ struct fd_wrapper {
     return count;
   }
   inline void flush() {
-    ssize_t temp = ::write(fd, buffer.data(), buffered_bytes);
-    if(temp < 0) throw std::runtime_error("error writing to fd");
+    write_all(buffer.data(), buffered_bytes);
     buffered_bytes = 0;
   }
+  // pipes and sockets may accept fewer bytes than requested
+  inline void write_all(const char * ptr, uint64_t count) {
+    while(count > 0) {
+      ssize_t temp = ::write(fd, ptr, count);
+      if(temp < 0 && errno == EINTR) continue;
+      if(temp < 0) throw std::runtime_error("error writing to fd");
+      ptr += temp;
+      count -= temp;
+    }
+  }
   fd_wrapper * seekp(uint64_t pos) {
     throw std::runtime_error("file descriptor is not seekable");
     return nullptr;
@@ -486,31 +617,117 @@ inline bool isSeekable(mem_wrapper & myFile) {
   return false;
 }
 
+// returns a pointer to the next count bytes of compressed data
+// streams read the data into buffer; data in memory is used in place without copying
+template <class stream_reader>
+inline const char * read_block_data(stream_reader & con, char * const buffer, const uint64_t count) {
+  read_allow(con, buffer, count);
+  return buffer;
+}
+inline const char * read_block_data(mem_wrapper & con, char * const buffer, const uint64_t count) {
+  if(count > con.available_bytes - con.bytes_processed) {
+    throw std::runtime_error("Unexpected end of file while reading next block");
+  }
+  const char * data = con.start + con.bytes_processed;
+  con.bytes_processed += count;
+  return data;
+}
+
+#ifndef _WIN32
+// read-only memory map of a whole file, to be read through a mem_wrapper
+struct mmap_file {
+  void * map;
+  uint64_t length;
+  dev_t device; // identifies the mapped file, even if it is later renamed
+  ino_t inode;
+  // sequential: the file is read front to back, otherwise pages are read on demand
+  mmap_file(const std::string & file, const bool sequential = true) : map(nullptr), length(0), device(0), inode(0) {
+    int fd = open(R_ExpandFileName(file.c_str()), O_RDONLY);
+    if(fd == -1) throw std::runtime_error("For file " + file + ": failed to open for reading");
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0) {
+      close(fd);
+      throw std::runtime_error("For file " + file + ": could not determine file size");
+    }
+    length = static_cast<uint64_t>(file_stat.st_size);
+    device = file_stat.st_dev;
+    inode = file_stat.st_ino;
+    if(length > 0) {
+      map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+      if(map == MAP_FAILED) {
+        map = nullptr;
+        close(fd);
+        throw std::runtime_error("For file " + file + ": mmap failed");
+      }
+      if(sequential) {
+        // blocks are consumed front to back; ask the kernel to read ahead and drop pages behind
+        madvise(map, length, MADV_SEQUENTIAL);
+        madvise(map, length, MADV_WILLNEED);
+      } else {
+        madvise(map, length, MADV_RANDOM);
+      }
+    }
+    close(fd); // the mapping stays valid
+  }
+  ~mmap_file() {
+    if(map != nullptr) munmap(map, length);
+  }
+  mmap_file(const mmap_file &) = delete;
+  mmap_file & operator=(const mmap_file &) = delete;
+};
+#endif
+
 ///////////////////////////////////////////////////////
-// helper functions for writing to std::vector
+// helper functions for writing to memory
 // This is only used for writing
-// since we don't know the serialized size ahead of time, we need a resizable memory buffer
+// since we don't know the serialized size ahead of time, data is appended to a list of chunks
+// chunks are never reallocated, so data is copied exactly once, into the output raw vector (see copy_and_clear)
+// the output vector is allocated while all chunks are alive, so peak memory is about twice the serialized size
+// (a growing std::vector peaks at up to three times the size when it is reallocated)
 // reading -- use mem_wrapper
 
+static constexpr uint64_t VEC_CHUNK_MIN = BLOCKSIZE;
+static constexpr uint64_t VEC_CHUNK_MAX = 67108864; // 2^26
+
 struct vec_wrapper {
-  std::vector<char> buffer;
+  std::vector< std::unique_ptr<char[]> > chunks;
+  std::vector<uint64_t> chunk_sizes;
+  uint64_t chunk_bytes = 0; // bytes used in the last chunk, all other chunks are full
   uint64_t bytes_processed = 0;
-  vec_wrapper() : buffer(std::vector<char>(BLOCKSIZE)) {}
+  vec_wrapper() {}
   inline uint64_t write(const char * const ptr, uint64_t count) {
-    if(count + bytes_processed > buffer.size()) {
-      uint64_t new_buffer_size = buffer.size() * 3/2;
-      while(new_buffer_size < count*3/2 + bytes_processed) {
-        new_buffer_size = new_buffer_size * 3/2;
+    uint64_t current_pointer_consumed = 0;
+    while(current_pointer_consumed < count) {
+      if(chunks.empty() || chunk_bytes == chunk_sizes.back()) {
+        // grow with the amount of data written so far to keep the number of chunks small, but bounded so the unused end of the last chunk stays small
+        uint64_t new_chunk_size = std::min(std::max(bytes_processed, VEC_CHUNK_MIN), VEC_CHUNK_MAX);
+        chunks.push_back(std::unique_ptr<char[]>(new char[new_chunk_size]));
+        chunk_sizes.push_back(new_chunk_size);
+        chunk_bytes = 0;
       }
-      buffer.resize(new_buffer_size);
+      uint64_t add_length = std::min(count - current_pointer_consumed, chunk_sizes.back() - chunk_bytes);
+      std::memcpy(chunks.back().get() + chunk_bytes, ptr + current_pointer_consumed, add_length);
+      chunk_bytes += add_length;
+      current_pointer_consumed += add_length;
+      bytes_processed += add_length;
     }
-    std::memcpy(buffer.data() + bytes_processed, ptr, count);
-    bytes_processed += count;
-    // std::cout << static_cast<void*>(buffer.data()) << " " << count << std::endl;
     return count;
   }
-  inline void writeDirect(const char * const ptr, uint64_t count, uint64_t offset) {
-    std::memcpy(buffer.data() + offset, ptr, count);
+  inline void writeDirect(const char * ptr, uint64_t count, uint64_t offset) {
+    uint64_t i = 0;
+    while(count > 0) {
+      if(offset >= chunk_sizes[i]) {
+        offset -= chunk_sizes[i];
+        i++;
+        continue;
+      }
+      uint64_t add_length = std::min(count, chunk_sizes[i] - offset);
+      std::memcpy(chunks[i].get() + offset, ptr, add_length);
+      ptr += add_length;
+      count -= add_length;
+      offset = 0;
+      i++;
+    }
   }
   vec_wrapper * seekp(uint64_t pos) {
     throw std::runtime_error("not seekable");
@@ -520,8 +737,19 @@ struct vec_wrapper {
     throw std::runtime_error("not seekable");
     return nullptr;
   }
-  void shrink() {
-    buffer.resize(bytes_processed);
+  // copies all data to dst (bytes_processed bytes), releasing each chunk after it is copied
+  // dst is allocated before this is called, so releasing chunks lowers memory use sooner, not the peak
+  void copy_and_clear(char * const dst) {
+    uint64_t dst_offset = 0;
+    for(uint64_t i=0; i < chunks.size(); i++) {
+      uint64_t chunk_used = i + 1 == chunks.size() ? chunk_bytes : chunk_sizes[i];
+      std::memcpy(dst + dst_offset, chunks[i].get(), chunk_used);
+      dst_offset += chunk_used;
+      chunks[i].reset();
+    }
+    chunks.clear();
+    chunk_sizes.clear();
+    chunk_bytes = 0;
   }
 };
 
@@ -650,7 +878,10 @@ enum class compalg : uint8_t {
 // reserve[2] (low byte) shuffle control: 0x01 = logical shuffle, 0x02 = integer shuffle, 0x04 = double shuffle
 // reserve[2] (high byte) algorithm: 0x01 = lz4, 0x00 = zstd, 0x02 = "lz4hc", 0x03 = zstd_stream
 // reserve[3] endian: 1 = big endian, 0 = little endian
-static constexpr int CURRENT_FORMAT_VER = 3;
+// format version 4 (qs 0.27.3): FLAG_BLOCK_CHECKSUM
+// files without block checksums are still written as version 3, since earlier versions warn about any newer version
+static constexpr int CURRENT_FORMAT_VER = 4;
+static constexpr int COMPATIBLE_FORMAT_VER = 3;
 struct QsMetadata {
   uint64_t clength; // compressed length -- for comparing bytes_read / blocks_read with recorded # ..
   bool check_hash;
@@ -662,10 +893,19 @@ struct QsMetadata {
   bool int_shuffle;
   bool real_shuffle;
   bool cplx_shuffle;
+  bool block_index; // block offset index trailer after the hash, only for block compressed formats
+  bool block_checksum; // see FLAG_BLOCK_CHECKSUM, replaces check_hash
+  bool dedup; // writer only, not stored in the file: write identical atomic vectors once
+  bool preserve_sharing; // writer only, not stored in the file: write vectors and lists referenced from several places once
+  bool int_transform; // writer only, recorded per vector: delta transforms of integer vectors
+  bool real_transform; // writer only, recorded per vector: XOR and delta transforms of numeric vectors
+  bool int_bitshuffle; // writer only, recorded per vector: bit shuffle instead of byte shuffle integer vectors
+  bool real_bitshuffle; // writer only, recorded per vector: bit shuffle instead of byte shuffle numeric vectors
+  bool lgl_pack; // writer only, recorded per vector: pack logical vectors to 2 bits per element
 
   //constructor from qsave
   QsMetadata(const std::string & preset, const std::string & algorithm, const int compress_level, int shuffle_control, const bool check_hash) :
-    clength(0), check_hash(check_hash), endian(is_big_endian()) {
+    clength(0), check_hash(check_hash), endian(is_big_endian()), block_index(false), block_checksum(false), dedup(false), preserve_sharing(false) {
     if(preset == "fast") {
       compress_algorithm = static_cast<uint8_t>(compalg::lz4);
       this->compress_level = 100;
@@ -712,12 +952,17 @@ struct QsMetadata {
     } else {
       throw std::runtime_error("preset must be one of fast, balanced (default), high, archive or custom");
     }
-    if(shuffle_control < 0 || shuffle_control > 15) throw std::runtime_error("shuffle_control must be an integer between 0 and 15");
+    if(shuffle_control < 0 || shuffle_control > 511) throw std::runtime_error("shuffle_control must be an integer between 0 and 511");
     lgl_shuffle = shuffle_control & 0x01;
     int_shuffle = shuffle_control & 0x02;
     real_shuffle = shuffle_control & 0x04;
     cplx_shuffle = shuffle_control & 0x08;
-    format_version = CURRENT_FORMAT_VER;
+    int_transform = shuffle_control & 0x10;
+    real_transform = shuffle_control & 0x20;
+    int_bitshuffle = shuffle_control & 0x40;
+    real_bitshuffle = shuffle_control & 0x80;
+    lgl_pack = shuffle_control & 0x100;
+    format_version = COMPATIBLE_FORMAT_VER;
   }
 
   // 0x0B0E0A0C
@@ -738,21 +983,24 @@ struct QsMetadata {
              const bool lgl_shuffle,
              const bool int_shuffle,
              const bool real_shuffle,
-             const bool cplx_shuffle) :
+             const bool cplx_shuffle,
+             const bool block_index,
+             const bool block_checksum) :
     clength(clength), check_hash(check_hash), endian(endian), compress_algorithm(compress_algorithm),
     compress_level(compress_level), format_version(format_version), lgl_shuffle(lgl_shuffle), int_shuffle(int_shuffle),
-    real_shuffle(real_shuffle), cplx_shuffle(cplx_shuffle) {}
+    real_shuffle(real_shuffle), cplx_shuffle(cplx_shuffle), block_index(block_index), block_checksum(block_checksum), dedup(false), preserve_sharing(false),
+    int_transform(false), real_transform(false), int_bitshuffle(false), real_bitshuffle(false), lgl_pack(false) {}
 
   // constructor from q_read
   template <class stream_reader>
   static QsMetadata create(stream_reader & myFile) {
     std::array<uint8_t,4> reserve_bits;
+    std::array<uint8_t,4> extension_bits = {0,0,0,0};
     read_check(myFile, reinterpret_cast<char*>(reserve_bits.data()),4);
     // version 2
     if(reserve_bits[0] != 0) {
-      std::array<uint8_t,4> reserve_bits2;
       if(!checkMagicNumber(reserve_bits)) throw std::runtime_error("QS format not detected");
-      read_check(myFile, reinterpret_cast<char*>(reserve_bits2.data()),4); // empty reserve bits for now
+      read_check(myFile, reinterpret_cast<char*>(extension_bits.data()),4);
       read_check(myFile, reinterpret_cast<char*>(reserve_bits.data()),4);
     }
     uint8_t sys_endian = is_big_endian() ? 0x01 : 0x00;
@@ -767,6 +1015,10 @@ struct QsMetadata {
     bool check_hash = reserve_bits[1];
     uint8_t endian = reserve_bits[3];
     int format_version = reserve_bits[0];
+    bool block_index = extension_bits[0] & FLAG_BLOCK_INDEX;
+    bool block_checksum = extension_bits[0] & FLAG_BLOCK_CHECKSUM;
+    if(block_index && compress_algorithm > static_cast<uint8_t>(compalg::lz4hc)) throw std::runtime_error("Block index is only valid for block compressed formats");
+    if(block_checksum && compress_algorithm > static_cast<uint8_t>(compalg::lz4hc)) throw std::runtime_error("Block checksums are only valid for block compressed formats");
     uint64_t clength = readSize8(myFile);
     return {clength,
             check_hash,
@@ -777,14 +1029,19 @@ struct QsMetadata {
             lgl_shuffle,
             int_shuffle,
             real_shuffle,
-            cplx_shuffle};
+            cplx_shuffle,
+            block_index,
+            block_checksum};
   }
 
   // version 2
   template <class stream_writer>
   void writeToFile(stream_writer & myFile) {
     write_check(myFile, reinterpret_cast<const char*>(magic_bits.data()), 4);
-    write_check(myFile, reinterpret_cast<const char*>(empty_bits.data()),4);
+    std::array<uint8_t,4> extension_bits = {0,0,0,0};
+    if(block_index) extension_bits[0] |= FLAG_BLOCK_INDEX;
+    if(block_checksum) extension_bits[0] |= FLAG_BLOCK_CHECKSUM;
+    write_check(myFile, reinterpret_cast<char*>(extension_bits.data()),4);
     std::array<uint8_t,4> reserve_bits = {0,0,0,0};
     reserve_bits[0] = static_cast<uint8_t>(format_version);
     reserve_bits[1] = check_hash;
@@ -793,6 +1050,72 @@ struct QsMetadata {
     reserve_bits[2] += (lgl_shuffle) + (int_shuffle << 1) + (real_shuffle << 2) + (cplx_shuffle << 3);
     write_check(myFile, reinterpret_cast<char*>(reserve_bits.data()),4);
   }
+
+  // bytes after each compressed block
+  uint64_t block_checksum_size() const {
+    return block_checksum ? 8 : 0;
+  }
+  // bytes of the hash or checksum digest after the data
+  uint64_t hash_size() const {
+    return block_checksum ? 8 : (check_hash ? 4 : 0);
+  }
+};
+
+// Block offset index, written after the hash when QsMetadata::block_index is set
+// Layout: for each block [8 byte compressed offset][8 byte uncompressed offset], then [8 byte number of blocks][8 byte total uncompressed size]
+// Compressed offsets point to the 4 byte zsize prefix of a block and are relative to the start of the header (magic bits)
+struct BlockIndex {
+  std::vector<uint64_t> zoffsets;
+  std::vector<uint64_t> offsets;
+  uint64_t current_zoffset = QS_HEADER_SIZE;
+  uint64_t current_offset = 0;
+  uint64_t checksum_size = 0; // writer only, see QsMetadata::block_checksum_size
+  void add_block(const uint64_t zsize, const uint64_t block_size) {
+    zoffsets.push_back(current_zoffset);
+    offsets.push_back(current_offset);
+    current_zoffset += 4 + zsize + checksum_size;
+    current_offset += block_size;
+  }
+  uint64_t size() const {
+    return zoffsets.size();
+  }
+  uint64_t total_size() const {
+    return current_offset;
+  }
+  static uint64_t trailer_size(const uint64_t nblocks) {
+    return 16 * nblocks + 16;
+  }
+  template <class stream_writer>
+  void write(stream_writer & myFile) const {
+    for(uint64_t i=0; i<zoffsets.size(); i++) {
+      writeSize8(myFile, zoffsets[i]);
+      writeSize8(myFile, offsets[i]);
+    }
+    writeSize8(myFile, zoffsets.size());
+    writeSize8(myFile, current_offset);
+  }
+  // reads a trailer for a file with nblocks blocks; returns false if the trailer is not consistent
+  template <class stream_reader>
+  bool read(stream_reader & myFile, const uint64_t nblocks) {
+    zoffsets.resize(nblocks);
+    offsets.resize(nblocks);
+    for(uint64_t i=0; i<nblocks; i++) {
+      zoffsets[i] = readSize8(myFile);
+      offsets[i] = readSize8(myFile);
+    }
+    uint64_t recorded_blocks = readSize8(myFile);
+    current_offset = readSize8(myFile);
+    if(recorded_blocks != nblocks) return false;
+    for(uint64_t i=0; i<nblocks; i++) {
+      if(i == 0) {
+        if(zoffsets[i] != QS_HEADER_SIZE || offsets[i] != 0) return false;
+      } else {
+        if(zoffsets[i] <= zoffsets[i-1] || offsets[i] < offsets[i-1] || offsets[i] - offsets[i-1] > BLOCKSIZE) return false;
+      }
+    }
+    if(nblocks > 0 && (current_offset < offsets[nblocks-1] || current_offset - offsets[nblocks-1] > BLOCKSIZE)) return false;
+    return true;
+  }
 };
 
 // Normalize lz4/zstd function arguments so we can use function types
@@ -845,6 +1168,20 @@ template <class stream_reader>
 uint32_t validate_data(const QsMetadata & qm, stream_reader & myFile, const uint32_t recorded_hash,
                        const uint32_t computed_hash, const uint64_t computed_length, const bool strict,
                        const std::string & file = "") {
+  if(qm.block_index) {
+    BlockIndex index;
+    if(!index.read(myFile, qm.clength)) {
+      std::string msg = "Block index is not consistent with data, file may be corrupted";
+      if(file != "") {
+        msg = "In file " + file + ": " + msg;
+      }
+      if(strict) {
+        throw std::runtime_error(msg);
+      } else {
+        Rcerr << "Warning: " << msg << std::endl;
+      }
+    }
+  }
   // destructively check EOF -- cannot putback data
   std::array<char,4> temp;
   uint64_t remaining_bytes = read_allow(myFile, temp.data(), 4);
@@ -968,17 +1305,47 @@ struct xxhash_env {
   }
 };
 
+// Block checksums (FLAG_BLOCK_CHECKSUM)
+// The checksum of a block is computed from its compressed data, so it can be checked before the block is decompressed
+// The digest written after the data is the checksum of all block checksums in block order, so missing or reordered blocks are detected
+struct BlockChecksums {
+  std::vector<uint64_t> checksums;
+  static uint64_t compute(const char * const zdata, const uint64_t zsize) {
+    return XXH3_64bits_withSeed(zdata, zsize, XXH_SEED);
+  }
+  // throws if the recorded checksum of the block (counted from 0) does not match its data
+  static void verify(const char * const zdata, const uint64_t zsize, const uint64_t recorded, const uint64_t block) {
+    if(compute(zdata, zsize) != recorded) {
+      throw std::runtime_error("Checksum mismatch in block " + std::to_string(block + 1) + ", file is corrupted");
+    }
+  }
+  static void verify_digest(const uint64_t computed, const uint64_t recorded) {
+    if(computed != recorded) throw std::runtime_error("Block checksum digest mismatch, blocks are missing or out of order, file is corrupted");
+  }
+  void add(const uint64_t checksum) {
+    checksums.push_back(checksum);
+  }
+  uint64_t digest() const {
+    return XXH3_64bits_withSeed(checksums.data(), checksums.size() * sizeof(uint64_t), XXH_SEED);
+  }
+};
+
+// Compression and decompression contexts are allocated once per env and reused for every block
+// Each env should only be used by one thread at a time; multithreaded contexts hold one env per worker
 struct zstd_compress_env {
-  // ZSTD_CCtx* zcs;
-  // zstd_compress_env() : zcs(ZSTD_createCCtx()) {}
-  // ~zstd_compress_env() {
-  //   ZSTD_freeCCtx(zcs);
-  // }
+  ZSTD_CCtx* zcs;
+  zstd_compress_env() : zcs(ZSTD_createCCtx()) {
+    if(zcs == nullptr) throw std::runtime_error("could not allocate zstd compression context");
+  }
+  ~zstd_compress_env() {
+    ZSTD_freeCCtx(zcs);
+  }
+  zstd_compress_env(const zstd_compress_env &) = delete;
+  zstd_compress_env & operator=(const zstd_compress_env &) = delete;
   uint64_t compress( void * dst, size_t dstCapacity,
                    const void * src, size_t srcSize,
                    int compressionLevel) {
-    // return ZSTD_compressCCtx(zcs, dst, dstCapacity, src, srcSize, compressionLevel);
-    uint64_t return_value = ZSTD_compress(dst, dstCapacity, src, srcSize, compressionLevel);
+    uint64_t return_value = ZSTD_compressCCtx(zcs, dst, dstCapacity, src, srcSize, compressionLevel);
     if(ZSTD_isError(return_value)) throw std::runtime_error("zstd compression error");
     return return_value;
   }
@@ -988,19 +1355,15 @@ struct zstd_compress_env {
 };
 
 struct lz4_compress_env {
-  // std::vector<char> zcs;
-  // char* state;
-  // lz4_compress_env() {
-  //   zcs = std::vector<char>(LZ4_sizeofState());
-  //   state = zcs.data();
-  // }
+  std::vector<char> zcs;
+  char* state;
+  lz4_compress_env() : zcs(LZ4_sizeofState()), state(zcs.data()) {}
+  lz4_compress_env(const lz4_compress_env &) = delete;
+  lz4_compress_env & operator=(const lz4_compress_env &) = delete;
   uint64_t compress( char * dst, int dstCapacity,
                    const char * src, int srcSize,
                    int compressionLevel) {
-    // return LZ4_compress_fast_extState(state, reinterpret_cast<char*>(const_cast<void*>(src)),
-    //                          reinterpret_cast<char*>(const_cast<void*>(dst)),
-    //                          static_cast<int>(srcSize), static_cast<int>(dstCapacity), compressionLevel);
-    int return_value = LZ4_compress_fast(src, dst, srcSize, dstCapacity, compressionLevel);
+    int return_value = LZ4_compress_fast_extState(state, src, dst, srcSize, dstCapacity, compressionLevel);
     if(return_value == 0) throw std::runtime_error("lz4 compression error");
     return return_value;
   }
@@ -1010,20 +1373,15 @@ struct lz4_compress_env {
 };
 
 struct lz4hc_compress_env {
-  // std::vector<char> zcs;
-  // char* state;
-  // lz4hc_compress_env() {
-  //   zcs = std::vector<char>(LZ4_sizeofStateHC());
-  //   state = zcs.data();
-  // }
+  std::vector<char> zcs;
+  char* state;
+  lz4hc_compress_env() : zcs(LZ4_sizeofStateHC()), state(zcs.data()) {}
+  lz4hc_compress_env(const lz4hc_compress_env &) = delete;
+  lz4hc_compress_env & operator=(const lz4hc_compress_env &) = delete;
   uint64_t compress( char * dst, int dstCapacity,
                    const char * src, int srcSize,
                    int compressionLevel) {
-    // xenv.update(src, srcSize);
-    // return LZ4_compress_HC_extStateHC(state, reinterpret_cast<char*>(const_cast<void*>(src)),
-    //                                   reinterpret_cast<char*>(const_cast<void*>(dst)),
-    //                                   static_cast<int>(srcSize), static_cast<int>(dstCapacity), compressionLevel);
-    int return_value = LZ4_compress_HC(src, dst, srcSize, dstCapacity, compressionLevel);
+    int return_value = LZ4_compress_HC_extStateHC(state, src, dst, srcSize, dstCapacity, compressionLevel);
     if(return_value == 0) throw std::runtime_error("lz4hc compression error");
     return return_value;
   }
@@ -1035,20 +1393,21 @@ struct lz4hc_compress_env {
 
 // Explicit decompression context (zstd v. 1.4.0)
 struct zstd_decompress_env {
-  // ZSTD_DCtx* zcs;
-  // zstd_decompress_env() : zcs(ZSTD_createDCtx()) {}
-  // ~zstd_decompress_env() {
-  //   ZSTD_freeDCtx(zcs);
-  // }
+  ZSTD_DCtx* zcs;
   uint64_t bound;
-  zstd_decompress_env() : bound(ZSTD_compressBound(BLOCKSIZE)) {}
+  zstd_decompress_env() : zcs(ZSTD_createDCtx()), bound(ZSTD_compressBound(BLOCKSIZE)) {
+    if(zcs == nullptr) throw std::runtime_error("could not allocate zstd decompression context");
+  }
+  ~zstd_decompress_env() {
+    ZSTD_freeDCtx(zcs);
+  }
+  zstd_decompress_env(const zstd_decompress_env &) = delete;
+  zstd_decompress_env & operator=(const zstd_decompress_env &) = delete;
   uint64_t decompress( void* dst, size_t dstCapacity,
                      const void* src, size_t compressedSize) {
-    // return ZSTD_decompress(dst, dstCapacity, src, compressedSize);
-    // return ZSTD_decompressDCtx(zcs, dst, dstCapacity, src, compressedSize);
     if(compressedSize > bound) throw std::runtime_error("Malformed compress block: compressed size > compress bound");
     // std::cout << "decompressing " << dst << " " << dstCapacity << " " << src << " " << compressedSize << "\n";
-    uint64_t return_value = ZSTD_decompress(dst, dstCapacity, src, compressedSize);
+    uint64_t return_value = ZSTD_decompressDCtx(zcs, dst, dstCapacity, src, compressedSize);
     if(ZSTD_isError(return_value)) throw std::runtime_error("zstd decompression error");
     if(return_value > BLOCKSIZE) throw std::runtime_error("Malformed compress block: decompressed size > max blocksize " + std::to_string(return_value));
     return return_value;
@@ -1112,6 +1471,8 @@ void dumpMetadata(List & output, const QsMetadata & qm) {
   output["endian"] = static_cast<int>(qm.endian);
   output["check_hash"] = qm.check_hash;
   output["format_version"] = qm.format_version;
+  output["block_index"] = qm.block_index;
+  output["block_checksum"] = qm.block_checksum;
 }
 
 // simple decompress stream context
@@ -33,7 +33,8 @@ struct Data_Context {
 
   decompress_env denv; // default constructor
   xxhash_env xenv; // default constructor
-  std::unordered_map<uint32_t, SEXP> object_ref_hash;
+  BlockChecksums checksums; // only filled if qm.block_checksum
+  IndexToObjectMap object_ref_hash;
 
   std::vector<char> zblock = std::vector<char>(denv.compressBound(BLOCKSIZE));
   std::vector<char> block = std::vector<char>(BLOCKSIZE);
@@ -60,27 +61,56 @@ struct Data_Context {
     char* header = block.data();
     readFlags_common(packed_flags, data_offset, header);
   }
-  void decompress_direct(char* bpointer) {
+  // reads the next compressed block and checks its checksum (FLAG_BLOCK_CHECKSUM)
+  // the checksum digest follows the last block and is checked when the last block is read
+  const char * read_zblock(uint64_t & zsize) {
     blocks_read++;
     std::array<char, 4> zsize_ar;
     read_allow(myFile, zsize_ar.data(), 4);
-    uint64_t zsize = *reinterpret_cast<uint32_t*>(zsize_ar.data());
-    read_allow(myFile, zblock.data(), zsize);
-    block_size = denv.decompress(bpointer, BLOCKSIZE, zblock.data(), zsize);
+    zsize = *reinterpret_cast<uint32_t*>(zsize_ar.data());
+    if(zsize > zblock.size()) throw std::runtime_error("Malformed compress block: compressed size > compress bound");
+    const char * zdata = read_block_data(myFile, zblock.data(), zsize);
+    if(qm.block_checksum) {
+      uint64_t recorded_checksum = readSize8(myFile);
+      BlockChecksums::verify(zdata, zsize, recorded_checksum, blocks_read - 1);
+      checksums.add(recorded_checksum);
+      if(blocks_read == qm.clength) BlockChecksums::verify_digest(checksums.digest(), readSize8(myFile));
+    }
+    return zdata;
+  }
+  void decompress_direct(char* bpointer) {
+    uint64_t zsize;
+    const char * zdata = read_zblock(zsize);
+    block_size = denv.decompress(bpointer, BLOCKSIZE, zdata, zsize);
     if(qm.check_hash) xenv.update(bpointer, BLOCKSIZE);
   }
   void decompress_block() {
-    blocks_read++;
-    std::array<char, 4> zsize_ar;
-    // uint64_t bytes_read = read_allow(myFile, zsize_ar.data(), 4);
-    // if(bytes_read == 0) return;
-    read_allow(myFile, zsize_ar.data(), 4);
-    uint64_t zsize = *reinterpret_cast<uint32_t*>(zsize_ar.data());
-    read_allow(myFile, zblock.data(), zsize);
-    block_size = denv.decompress(block.data(), BLOCKSIZE, zblock.data(), zsize);
+    uint64_t zsize;
+    const char * zdata = read_zblock(zsize);
+    block_size = denv.decompress(block.data(), BLOCKSIZE, zdata, zsize);
     data_offset = 0;
     if(qm.check_hash) xenv.update(block.data(), block_size);
   }
+  // reads past a full block without decompressing it, the block buffer is left unchanged
+  void skip_block() {
+    uint64_t zsize;
+    read_zblock(zsize);
+    block_size = BLOCKSIZE;
+    data_offset = BLOCKSIZE;
+  }
+  // advances past data that is not needed; full blocks are only decompressed when the hash is checked
+  void skipBlockData(uint64_t data_size) {
+    while(data_size > block_size - data_offset) {
+      data_size -= block_size - data_offset;
+      if(!qm.check_hash && data_size >= BLOCKSIZE) {
+        skip_block();
+        data_size -= BLOCKSIZE;
+      } else {
+        decompress_block();
+      }
+    }
+    data_offset += data_size;
+  }
   void getBlockData(char* outp, uint64_t data_size) {
     if(data_size <= block_size - data_offset) {
       memcpy(outp, block.data()+data_offset, data_size);
@@ -115,11 +145,18 @@ struct Data_Context {
     getBlockData(&temp_string[0], data_size);
     return temp_string;
   }
+  // the vector is unshuffled straight from each decompressed block into its place (see blosc_unshuffle_range)
   void getShuffleBlockData(char* outp, uint64_t data_size, uint64_t bytesoftype) {
     if(data_size >= MIN_SHUFFLE_ELEMENTS) {
-      if(data_size > shuffleblock.size()) shuffleblock.resize(data_size);
-      getBlockData(reinterpret_cast<char*>(shuffleblock.data()), data_size);
-      blosc_unshuffle(shuffleblock.data(), reinterpret_cast<uint8_t*>(outp), data_size, bytesoftype);
+      uint64_t bytes_accounted = 0;
+      while(bytes_accounted < data_size) {
+        if(data_offset >= block_size) decompress_block();
+        if(block_size == 0) throw std::runtime_error("Unexpected end of file while reading next block");
+        uint64_t add_length = std::min<uint64_t>(data_size - bytes_accounted, block_size - data_offset);
+        blosc_unshuffle_range(block.data() + data_offset, outp, data_size, bytesoftype, bytes_accounted, add_length);
+        data_offset += add_length;
+        bytes_accounted += add_length;
+      }
     } else if(data_size > 0) {
       getBlockData(outp, data_size);
     }
@@ -0,0 +1,472 @@
+/* qs - Quick Serialization of R Objects
+ Copyright (C) 2019-present Travers Ching
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ You can contact the author at:
+ https://github.com/qsbase/qs
+ */
+
+#include "qs_common.h"
+#include "qs_deserialize_common.h"
+
+#if defined(USE_ALT_REP) && !defined(_WIN32)
+#define USE_LAZY_READ
+#endif
+
+#ifdef USE_LAZY_READ
+
+////////////////////////////////////////////////////////////////
+// lazy de-serialization
+// Long numeric, integer and logical vectors are returned as ALTREP vectors that remember where their data is
+// The data is decompressed (and unshuffled) when the vector is first accessed, everything else is read immediately
+// Blocks are located through the block index, so only files saved with a block index can be read lazily
+////////////////////////////////////////////////////////////////
+
+static constexpr uint64_t MIN_LAZY_BYTES = BLOCKSIZE;
+
+// memory mapped file and its block index, shared by the reader and all lazy vectors created from the file
+struct lazy_source {
+  mmap_file map;
+  QsMetadata qm;
+  BlockIndex index;
+  uint64_t data_end; // end of the compressed blocks, 0 if the file cannot be read lazily
+  std::vector<char> detached; // copy of the file, once it is about to be overwritten (see detach)
+  const char * data; // the mapping or the copy, nullptr if the file was truncated before it could be copied
+
+  static QsMetadata read_metadata(const mmap_file & map) {
+    mem_wrapper myFile(map.map, map.length);
+    return QsMetadata::create(myFile);
+  }
+
+  lazy_source(const std::string & file) : map(file, false), qm(read_metadata(map)), data_end(0),
+    data(static_cast<const char *>(map.map)) {
+    if(!qm.block_index || qm.compress_algorithm > static_cast<unsigned char>(compalg::lz4hc)) return;
+    uint64_t trailer_size = BlockIndex::trailer_size(qm.clength);
+    uint64_t hash_size = qm.check_hash ? 4 : 0;
+    if(map.length < QS_HEADER_SIZE + trailer_size + hash_size) return;
+    mem_wrapper myFile(map.map, map.length);
+    myFile.bytes_processed = map.length - trailer_size;
+    if(!index.read(myFile, qm.clength)) return;
+    data_end = map.length - trailer_size - hash_size;
+    if(qm.clength > 0 && index.zoffsets.back() + 4 > data_end) data_end = 0;
+  }
+
+  uint64_t block_size(const uint64_t block) const {
+    return (block + 1 < index.size() ? index.offsets[block + 1] : index.total_size()) - index.offsets[block];
+  }
+
+  // the block containing the uncompressed offset
+  uint64_t find_block(const uint64_t offset) const {
+    if(index.size() == 0 || offset > index.total_size()) throw std::runtime_error("Unexpected end of file while reading next block");
+    return std::upper_bound(index.offsets.begin(), index.offsets.end(), offset) - index.offsets.begin() - 1;
+  }
+
+  // the first block of the uncompressed byte range [offset, offset + nbytes), which must lie within the data
+  uint64_t find_range(const uint64_t offset, const uint64_t nbytes) const {
+    if(offset > index.total_size() || nbytes > index.total_size() - offset) throw std::runtime_error("Unexpected end of file while reading next block");
+    return find_block(offset);
+  }
+
+  // decompresses a block directly from the mapping into dst, which must hold block_size(block) bytes
+  template <class decompress_env>
+  uint64_t decompress_block(decompress_env & denv, const uint64_t block, char * const dst) const {
+    if(data == nullptr) throw std::runtime_error("File was overwritten while lazy vectors read from it were in use");
+    if(block >= index.size()) throw std::runtime_error("Unexpected end of file while reading next block");
+    const char * const start = data;
+    uint64_t zoffset = index.zoffsets[block];
+    if(zoffset + 4 > data_end) throw std::runtime_error("Unexpected end of file while reading next block");
+    uint32_t zsize = unaligned_cast<uint32_t>(start, zoffset);
+    if(zoffset + 4 + zsize + qm.block_checksum_size() > data_end) throw std::runtime_error("Unexpected end of file while reading next block");
+    if(qm.block_checksum) BlockChecksums::verify(start + zoffset + 4, zsize, unaligned_cast<uint64_t>(start, zoffset + 4 + zsize), block);
+    uint64_t expected_size = block_size(block);
+    if(expected_size > BLOCKSIZE) throw std::runtime_error("Block index is not consistent with data, file may be corrupted");
+    uint64_t decompressed_size = denv.decompress(dst, expected_size, start + zoffset + 4, zsize);
+    if(decompressed_size != expected_size) throw std::runtime_error("Block index is not consistent with data, file may be corrupted");
+    return decompressed_size;
+  }
+
+  // decompresses the uncompressed byte range [offset, offset + nbytes) into dst
+  template <class decompress_env>
+  void read_range(decompress_env & denv, char * dst, uint64_t offset, uint64_t nbytes) const {
+    std::vector<char> block;
+    uint64_t b = find_range(offset, nbytes);
+    while(nbytes > 0) {
+      if(b >= index.size()) throw std::runtime_error("Unexpected end of file while reading next block");
+      uint64_t block_offset = offset - index.offsets[b];
+      uint64_t add_length = std::min(nbytes, block_size(b) - block_offset);
+      if(block_offset == 0 && add_length == block_size(b)) {
+        decompress_block(denv, b, dst);
+      } else {
+        if(block.empty()) block.resize(BLOCKSIZE);
+        decompress_block(denv, b, block.data());
+        std::memcpy(dst, block.data() + block_offset, add_length);
+      }
+      dst += add_length;
+      offset += add_length;
+      nbytes -= add_length;
+      b++;
+    }
+  }
+
+  void read_range(char * const dst, const uint64_t offset, const uint64_t nbytes) const {
+    if(qm.compress_algorithm == static_cast<unsigned char>(compalg::zstd)) {
+      zstd_decompress_env denv;
+      read_range(denv, dst, offset, nbytes);
+    } else {
+      lz4_decompress_env denv;
+      read_range(denv, dst, offset, nbytes);
+    }
+  }
+
+  // as read_range, for a byte shuffled vector of nbytes bytes, which is unshuffled into dst one block at a time (see blosc_unshuffle_range)
+  template <class decompress_env>
+  void unshuffle_range(decompress_env & denv, char * const dst, uint64_t offset, const uint64_t nbytes, const uint64_t bytesoftype) const {
+    std::vector<char> block(BLOCKSIZE);
+    uint64_t b = find_range(offset, nbytes);
+    uint64_t bytes_accounted = 0;
+    while(bytes_accounted < nbytes) {
+      if(b >= index.size()) throw std::runtime_error("Unexpected end of file while reading next block");
+      uint64_t block_offset = offset - index.offsets[b];
+      uint64_t add_length = std::min(nbytes - bytes_accounted, block_size(b) - block_offset);
+      decompress_block(denv, b, block.data());
+      blosc_unshuffle_range(block.data() + block_offset, dst, nbytes, bytesoftype, bytes_accounted, add_length);
+      offset += add_length;
+      bytes_accounted += add_length;
+      b++;
+    }
+  }
+
+  void unshuffle_range(char * const dst, const uint64_t offset, const uint64_t nbytes, const uint64_t bytesoftype) const {
+    if(qm.compress_algorithm == static_cast<unsigned char>(compalg::zstd)) {
+      zstd_decompress_env denv;
+      unshuffle_range(denv, dst, offset, nbytes, bytesoftype);
+    } else {
+      lz4_decompress_env denv;
+      unshuffle_range(denv, dst, offset, nbytes, bytesoftype);
+    }
+  }
+};
+
+// lazy sources that may still be read, so that they can be detached from a file before qsave overwrites it
+static std::vector<std::weak_ptr<lazy_source>> lazy_sources;
+
+inline void register_lazy_source(const std::shared_ptr<lazy_source> & source) {
+  lazy_sources.erase(std::remove_if(lazy_sources.begin(), lazy_sources.end(),
+                                    [](const std::weak_ptr<lazy_source> & w) { return w.expired(); }), lazy_sources.end());
+  lazy_sources.push_back(source);
+}
+
+// called before writing to a file: reading the mapping of a truncated file raises SIGBUS, so lazy vectors of the file read from a copy instead
+// if the file is already shorter than the mapping (e.g. a descriptor opened with O_TRUNC), the data is gone and reading it is an error
+inline void detach_lazy_sources(const struct stat & file_stat) {
+  for(auto & w : lazy_sources) {
+    std::shared_ptr<lazy_source> source = w.lock();
+    if(!source || source->data == nullptr || !source->detached.empty()) continue;
+    if(source->map.device != file_stat.st_dev || source->map.inode != file_stat.st_ino) continue;
+    if(static_cast<uint64_t>(file_stat.st_size) >= source->map.length) {
+      source->detached.assign(source->data, source->data + source->map.length);
+      source->data = source->detached.data();
+    } else {
+      source->data = nullptr;
+    }
+  }
+}
+
+inline void detach_lazy_sources(const std::string & file) {
+  struct stat file_stat;
+  if(!lazy_sources.empty() && stat(R_ExpandFileName(file.c_str()), &file_stat) == 0) detach_lazy_sources(file_stat);
+}
+
+inline void detach_lazy_sources(const int fd) {
+  struct stat file_stat;
+  if(!lazy_sources.empty() && fstat(fd, &file_stat) == 0) detach_lazy_sources(file_stat);
+}
+
+// reads the file structure through the block index; data of lazy vectors is skipped instead of decompressed
+// the hash cannot be checked since not all data is read, block checksums are checked when each block is decompressed
+template <class decompress_env>
+struct Data_Context_Lazy {
+  QsMetadata qm;
+  std::shared_ptr<lazy_source> source;
+  bool use_alt_rep_bool;
+
+  decompress_env denv; // default constructor
+  IndexToObjectMap object_ref_hash;
+
+  std::vector<char> block = std::vector<char>(BLOCKSIZE);
+  std::vector<uint8_t> shuffleblock = std::vector<uint8_t>(256);
+  uint64_t next_block = 0;
+  uint64_t block_start = 0; // uncompressed offset of the current block
+  uint64_t data_offset = 0;
+  uint64_t block_size = 0;
+
+  Data_Context_Lazy(std::shared_ptr<lazy_source> source, bool use_alt_rep) :
+    qm(source->qm), source(source), use_alt_rep_bool(use_alt_rep) {}
+
+  uint64_t position() const {
+    return block_start + data_offset;
+  }
+  void readHeader(qstype & object_type, uint64_t & r_array_len) {
+    if(data_offset >= block_size) decompress_block();
+    char* header = block.data();
+    readHeader_common(object_type, r_array_len, data_offset, header);
+  }
+  void readStringHeader(uint32_t & r_string_len, cetype_t & ce_enc) {
+    if(data_offset >= block_size) decompress_block();
+    char* header = block.data();
+    readStringHeader_common(r_string_len, ce_enc, data_offset, header);
+  }
+  void readFlags(int & packed_flags) {
+    if(data_offset >= block_size) decompress_block();
+    char* header = block.data();
+    readFlags_common(packed_flags, data_offset, header);
+  }
+  void decompress_direct(char* bpointer) {
+    block_start = source->index.offsets.at(next_block);
+    block_size = source->decompress_block(denv, next_block, bpointer);
+    next_block++;
+  }
+  void decompress_block() {
+    block_start = source->index.offsets.at(next_block);
+    block_size = source->decompress_block(denv, next_block, block.data());
+    next_block++;
+    data_offset = 0;
+  }
+  // moves past data that is not needed or read later by a lazy vector; blocks that are skipped over entirely are not decompressed
+  void skipBlockData(const uint64_t nbytes) {
+    if(nbytes <= block_size - data_offset) {
+      data_offset += nbytes;
+      return;
+    }
+    uint64_t target = position() + nbytes;
+    next_block = source->find_block(target);
+    if(target == source->index.offsets[next_block]) {
+      // at a block boundary, the block is decompressed when it is needed
+      block_start = target;
+      block_size = 0;
+      data_offset = 0;
+    } else {
+      decompress_block();
+      data_offset = target - block_start;
+    }
+  }
+  void getBlockData(char* outp, uint64_t data_size) {
+    if(data_size <= block_size - data_offset) {
+      memcpy(outp, block.data()+data_offset, data_size);
+      data_offset += data_size;
+    } else {
+      uint64_t bytes_accounted = block_size - data_offset;
+      memcpy(outp, block.data()+data_offset, bytes_accounted);
+      while(bytes_accounted < data_size) {
+        if(data_size - bytes_accounted >= BLOCKSIZE) {
+          decompress_direct(outp+bytes_accounted);
+          bytes_accounted += BLOCKSIZE;
+          data_offset = BLOCKSIZE;
+        } else {
+          decompress_block();
+          std::memcpy(outp + bytes_accounted, block.data(), data_size - bytes_accounted);
+          data_offset = data_size - bytes_accounted;
+          bytes_accounted += data_offset;
+        }
+      }
+    }
+  }
+  char * tempBlock(uint64_t data_size) {
+    if(data_size > shuffleblock.size()) shuffleblock.resize(data_size);
+    return reinterpret_cast<char*>(shuffleblock.data());
+  }
+  char * tempBlock() {
+    return reinterpret_cast<char*>(shuffleblock.data());
+  }
+  std::string getString(uint64_t data_size) {
+    std::string temp_string;
+    temp_string.resize(data_size);
+    getBlockData(&temp_string[0], data_size);
+    return temp_string;
+  }
+  // the vector is unshuffled straight from each decompressed block into its place (see blosc_unshuffle_range)
+  void getShuffleBlockData(char* outp, uint64_t data_size, uint64_t bytesoftype) {
+    if(data_size >= MIN_SHUFFLE_ELEMENTS) {
+      uint64_t bytes_accounted = 0;
+      while(bytes_accounted < data_size) {
+        if(data_offset >= block_size) decompress_block();
+        if(block_size == 0) throw std::runtime_error("Unexpected end of file while reading next block");
+        uint64_t add_length = std::min<uint64_t>(data_size - bytes_accounted, block_size - data_offset);
+        blosc_unshuffle_range(block.data() + data_offset, outp, data_size, bytesoftype, bytes_accounted, add_length);
+        data_offset += add_length;
+        bytes_accounted += add_length;
+      }
+    } else if(data_size > 0) {
+      getBlockData(outp, data_size);
+    }
+  }
+};
+
+////////////////////////////////////////////////////////////////
+// lazy ALTREP vectors
+// data1: external pointer to a lazy_vector, data2: the materialized vector or R_NilValue
+////////////////////////////////////////////////////////////////
+
+struct lazy_vector {
+  std::shared_ptr<lazy_source> source; // released once the data is materialized
+  uint64_t offset; // uncompressed offset of the data
+  uint64_t length;
+  uint64_t bytesoftype;
+  bool shuffle;
+  bool bitshuffled; // in blocks of BITSHUFFLE_BLOCK elements, instead of byte shuffled
+  vector_transform transform; // inverted after unshuffling; packed logicals are unpacked from packed_logical_bytes(length) bytes instead
+};
+
+static R_altrep_class_t lazy_real_class;
+static R_altrep_class_t lazy_integer_class;
+static R_altrep_class_t lazy_logical_class;
+
+inline void lazy_vector_finalizer(SEXP ptr) {
+  delete static_cast<lazy_vector*>(R_ExternalPtrAddr(ptr));
+  R_ClearExternalPtr(ptr);
+}
+
+inline lazy_vector * lazy_vector_ptr(SEXP x) {
+  return static_cast<lazy_vector*>(R_ExternalPtrAddr(R_altrep_data1(x)));
+}
+
+inline void * lazy_dataptr(SEXP x) {
+  switch(TYPEOF(x)) {
+  case REALSXP:
+    return REAL(x);
+  case INTSXP:
+    return INTEGER(x);
+  default:
+    return LOGICAL(x);
+  }
+}
+
+// ALTREP methods are called from R and must not throw, errors are copied to error_message instead
+inline bool lazy_read(const lazy_vector * const lv, char * const dst, std::array<char, 256> & error_message) {
+  try {
+    uint64_t nbytes = lv->length * lv->bytesoftype;
+    if(lv->transform == vector_transform::logical_pack) {
+      std::vector<uint8_t> packed(packed_logical_bytes(lv->length));
+      lv->source->read_range(reinterpret_cast<char*>(packed.data()), lv->offset, packed.size());
+      if(!logical_unpack(packed.data(), reinterpret_cast<int*>(dst), lv->length)) throw std::runtime_error("Malformed packed logical vector");
+      return true;
+    }
+    if(lv->bitshuffled) {
+      // read about a block worth of whole BITSHUFFLE_BLOCKs at a time, as the eager reader does
+      uint64_t chunk_n = std::max<uint64_t>(1, BLOCKSIZE / (BITSHUFFLE_BLOCK * lv->bytesoftype)) * BITSHUFFLE_BLOCK;
+      std::vector<uint8_t> shuffleblock(std::min(chunk_n, lv->length) * lv->bytesoftype);
+      for(uint64_t i=0; i<lv->length; i += chunk_n) {
+        uint64_t n = std::min(chunk_n, lv->length - i);
+        lv->source->read_range(reinterpret_cast<char*>(shuffleblock.data()), lv->offset + i * lv->bytesoftype, n * lv->bytesoftype);
+        bitunshuffle_blocks(shuffleblock.data(), reinterpret_cast<uint8_t*>(dst) + i * lv->bytesoftype, n, lv->bytesoftype);
+      }
+    } else if(lv->shuffle) {
+      lv->source->unshuffle_range(dst, lv->offset, nbytes, lv->bytesoftype);
+    } else {
+      lv->source->read_range(dst, lv->offset, nbytes);
+    }
+    inverse_transform(dst, lv->length, lv->transform);
+    return true;
+  } catch(std::exception & e) {
+    std::strncpy(error_message.data(), e.what(), error_message.size() - 1);
+    error_message.back() = '\0';
+    return false;
+  }
+}
+
+inline SEXP lazy_materialize(SEXP x) {
+  SEXP data2 = R_altrep_data2(x);
+  if(data2 != R_NilValue) return data2;
+  lazy_vector * lv = lazy_vector_ptr(x);
+  if(lv == nullptr || !lv->source) Rf_error("qs lazy vector: data is no longer available");
+  SEXP output = PROTECT(Rf_allocVector(TYPEOF(x), lv->length));
+  std::array<char, 256> error_message;
+  if(!lazy_read(lv, static_cast<char*>(lazy_dataptr(output)), error_message)) {
+    UNPROTECT(1);
+    Rf_error("qs lazy vector: %s", error_message.data());
+  }
+  R_set_altrep_data2(x, output);
+  UNPROTECT(1);
+  lv->source.reset();
+  return output;
+}
+
+inline R_xlen_t lazy_Length(SEXP x) {
+  SEXP data2 = R_altrep_data2(x);
+  if(data2 != R_NilValue) return Rf_xlength(data2);
+  return static_cast<R_xlen_t>(lazy_vector_ptr(x)->length);
+}
+
+inline Rboolean lazy_Inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+  Rprintf("qs lazy vector (len=%.0f, materialized=%s)\n", static_cast<double>(lazy_Length(x)), R_altrep_data2(x) != R_NilValue ? "T" : "F");
+  return TRUE;
+}
+
+inline void * lazy_Dataptr(SEXP x, Rboolean writeable) {
+  return lazy_dataptr(lazy_materialize(x));
+}
+
+inline const void * lazy_Dataptr_or_null(SEXP x) {
+  SEXP data2 = R_altrep_data2(x);
+  if(data2 == R_NilValue) return nullptr;
+  return lazy_dataptr(data2);
+}
+
+inline double lazy_real_Elt(SEXP x, R_xlen_t i) {
+  return REAL(lazy_materialize(x))[i];
+}
+
+inline int lazy_integer_Elt(SEXP x, R_xlen_t i) {
+  return INTEGER(lazy_materialize(x))[i];
+}
+
+inline int lazy_logical_Elt(SEXP x, R_xlen_t i) {
+  return LOGICAL(lazy_materialize(x))[i];
+}
+
+// called when the package is loaded
+inline void init_lazy_altrep_classes(DllInfo * dll) {
+  lazy_real_class = R_make_altreal_class("qs_lazy_real", "qs", dll);
+  lazy_integer_class = R_make_altinteger_class("qs_lazy_integer", "qs", dll);
+  lazy_logical_class = R_make_altlogical_class("qs_lazy_logical", "qs", dll);
+  for(R_altrep_class_t cls : {lazy_real_class, lazy_integer_class, lazy_logical_class}) {
+    R_set_altrep_Length_method(cls, lazy_Length);
+    R_set_altrep_Inspect_method(cls, lazy_Inspect);
+    R_set_altvec_Dataptr_method(cls, lazy_Dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, lazy_Dataptr_or_null);
+  }
+  R_set_altreal_Elt_method(lazy_real_class, lazy_real_Elt);
+  R_set_altinteger_Elt_method(lazy_integer_class, lazy_integer_Elt);
+  R_set_altlogical_Elt_method(lazy_logical_class, lazy_logical_Elt);
+}
+
+// overload of lazyVector in qs_deserialize_common.h, selected by processBlock for the lazy reader
+template <class decompress_env>
+inline SEXP lazyVector(Data_Context_Lazy<decompress_env> * const sobj, const SEXPTYPE type, const uint64_t r_array_len,
+                       const uint64_t bytesoftype, const bool shuffle, const vector_transform transform = vector_transform::none,
+                       const bool bitshuffled = false) {
+  if(r_array_len * bytesoftype < MIN_LAZY_BYTES) return R_NilValue;
+  uint64_t offset = sobj->position();
+  sobj->skipBlockData(transform == vector_transform::logical_pack ? packed_logical_bytes(r_array_len) : r_array_len * bytesoftype);
+  lazy_vector * lv = new lazy_vector{sobj->source, offset, r_array_len, bytesoftype, shuffle, bitshuffled, transform};
+  SEXP ptr = PROTECT(R_MakeExternalPtr(lv, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(ptr, lazy_vector_finalizer, TRUE);
+  R_altrep_class_t cls = type == REALSXP ? lazy_real_class : (type == INTSXP ? lazy_integer_class : lazy_logical_class);
+  SEXP obj = R_new_altrep(cls, ptr, R_NilValue);
+  UNPROTECT(1);
+  return obj;
+}
+
+#endif
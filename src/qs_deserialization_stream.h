@@ -315,7 +315,7 @@ struct Data_Context_Stream {
   QsMetadata qm;
   DestreamClass & dsc;
   bool use_alt_rep_bool;
-  std::unordered_map<uint32_t, SEXP> object_ref_hash;
+  IndexToObjectMap object_ref_hash;
   std::vector<uint8_t> shuffleblock = std::vector<uint8_t>(256);
   uint64_t & data_offset; // dsc.blockoffset
   uint64_t & block_size; // dsc.blocksize
@@ -330,6 +330,15 @@ struct Data_Context_Stream {
   void getBlockData(char* outp, uint64_t data_size) {
     dsc.copyData(outp, data_size);
   }
+  // streams have no block structure, so data that is not needed is read through a buffer of at most one block
+  void skipBlockData(uint64_t data_size) {
+    char * buffer = tempBlock(std::min<uint64_t>(data_size, BLOCKSIZE));
+    while(data_size > 0) {
+      uint64_t add_length = std::min<uint64_t>(data_size, BLOCKSIZE);
+      getBlockData(buffer, add_length);
+      data_size -= add_length;
+    }
+  }
   void readHeader(qstype & object_type, uint64_t & r_array_len) {
     if(data_offset + BLOCKRESERVE >= block_size) getBlock();
     readHeader_common(object_type, r_array_len, data_offset, data_ptr);
@@ -355,12 +364,17 @@ struct Data_Context_Stream {
     getBlockData(&temp_string[0], data_size);
     return temp_string;
   }
+  // the vector is read BLOCKSIZE bytes at a time and unshuffled into its place (see blosc_unshuffle_range)
   void getShuffleBlockData(char* outp, uint64_t data_size, uint64_t bytesoftype) {
     // std::cout << data_size << " get shuffle block\n";
     if(data_size >= MIN_SHUFFLE_ELEMENTS) {
-      if(data_size > shuffleblock.size()) shuffleblock.resize(data_size);
-      getBlockData(reinterpret_cast<char*>(shuffleblock.data()), data_size);
-      blosc_unshuffle(shuffleblock.data(), reinterpret_cast<uint8_t*>(outp), data_size, bytesoftype);
+      uint64_t chunk_size = std::min<uint64_t>(data_size, BLOCKSIZE);
+      if(chunk_size > shuffleblock.size()) shuffleblock.resize(chunk_size);
+      for(uint64_t i=0; i<data_size; i += BLOCKSIZE) {
+        uint64_t add_length = std::min<uint64_t>(data_size - i, BLOCKSIZE);
+        getBlockData(reinterpret_cast<char*>(shuffleblock.data()), add_length);
+        blosc_unshuffle_range(reinterpret_cast<char*>(shuffleblock.data()), outp, data_size, bytesoftype, i, add_length);
+      }
     } else if(data_size > 0) {
       getBlockData(outp, data_size);
     }
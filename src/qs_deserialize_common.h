@@ -15,7 +15,7 @@ std::string qtypestr(qstype x) {
     "NUMERIC", "INTEGER", "LOGICAL", "CHARACTER", "NIL", "LIST", "COMPLEX", "RAW", "PAIRLIST", "LANG", "CLOS", "PROM", "DOT", "SYM",
     "PAIRLIST_WF", "LANG_WF", "CLOS_WF", "PROM_WF", "DOT_WF",
     "S4", "S4FLAG", "LOCKED_ENV", "UNLOCKED_ENV", "REFERENCE",
-    "ATTRIBUTE", "RSERIALIZED" };
+    "ATTRIBUTE", "RSERIALIZED", "CHARACTER_DICT", "SHARED", "COMPACT_SEQ", "TRANSFORMED", "PACKED_LOGICAL", "BITSHUFFLED" };
   return enum_strings[(int)x];
 }
 #endif
@@ -96,6 +96,38 @@ inline void readHeader_common(qstype & object_type, uint64_t & r_array_len, uint
       data_offset += 6;
       object_type = qstype::REFERENCE;
       return;
+    case character_dict_header:
+      r_array_len = unaligned_cast<uint64_t>(header, data_offset+2);
+      data_offset += 10;
+      object_type = qstype::CHARACTER_DICT;
+      return;
+    case shared_object_header:
+      r_array_len = unaligned_cast<uint32_t>(header, data_offset+2);
+      data_offset += 6;
+      object_type = qstype::SHARED;
+      return;
+    case transformed_vector_header:
+      r_array_len = unaligned_cast<uint64_t>(header, data_offset+2);
+      data_offset += 10;
+      object_type = qstype::TRANSFORMED;
+      return;
+    case compact_seq_header:
+      r_array_len = unaligned_cast<uint64_t>(header, data_offset+2);
+      data_offset += 10;
+      object_type = qstype::COMPACT_SEQ;
+      return;
+    case packed_logical_header:
+      r_array_len = unaligned_cast<uint64_t>(header, data_offset+2);
+      data_offset += 10;
+      object_type = qstype::PACKED_LOGICAL;
+      return;
+    case bitshuffled_vector_header:
+      r_array_len = unaligned_cast<uint64_t>(header, data_offset+2);
+      data_offset += 10;
+      object_type = qstype::BITSHUFFLED;
+      return;
+    default:
+      throw std::runtime_error("Unknown object type, file may have been written by a newer version of qs");
     }
   }
   case sym_header:
@@ -329,147 +361,264 @@ inline void readFlags_common(int & packed_flags, uint64_t & data_offset, const c
   data_offset += 4;
 }
 
+// returns a vector whose data is read on first access, or R_NilValue to read the data now
+// only the lazy reader (qs_deserialization_lazy.h) provides an overload that creates such vectors
 template <class T>
-SEXP processBlock(T * const sobj) {
+inline SEXP lazyVector(T * const sobj, const SEXPTYPE type, const uint64_t r_array_len, const uint64_t bytesoftype, const bool shuffle,
+                       const vector_transform transform = vector_transform::none, const bool bitshuffled = false) {
+  return R_NilValue;
+}
+
+// A container that processBlock is filling in
+// The children of a container are the elements of a list, the nodes of a pairlist,
+// TAG/CAR/CDR of language objects or ENCLOS/FRAME/HASHTAB of environments
+// Once the children are read, the same frame is used to read the attributes of the object
+struct Unpack_Frame {
+  SEXP obj;
+  SEXP node; // current pairlist node (of a pairlist or of the attributes)
   qstype obj_type;
-  uint64_t r_array_len;
-  uint64_t number_of_attributes = 0;
-  bool s4_flag = false;
-  sobj->readHeader(obj_type, r_array_len);
-#ifdef QS_DEBUG
-  std::cout << qtypestr(obj_type) << " " << r_array_len << std::endl;
-#endif
-  if(obj_type == qstype::S4FLAG) {
-    s4_flag = true;
-    sobj->readHeader(obj_type, r_array_len);
+  uint64_t length; // number of children, or number of attributes once attributes are read
+  uint64_t index;
+  uint64_t number_of_attributes;
+  int packed_flags; // flags of a language object, or of the current pairlist node
+  bool s4_flag;
+  bool attributes;
+  bool class_attribute; // the current attribute is "class"
+};
+
+// Counts of all CHARSXP caches since charsxp_cache_stats() was last called
+struct CharSXP_Cache_Stats {
+  uint64_t lookups = 0;
+  uint64_t hits = 0;
+  uint64_t entries = 0;
+};
+static CharSXP_Cache_Stats charsxp_cache_totals;
+
+// Per-read cache of CHARSXPs, so that repeated values of character vectors don't go through R's global CHARSXP cache every time
+// Open addressing on a fixed size table keyed on (bytes, encoding); cached CHARSXPs are protected in a list
+// Once the table is half full no new strings are added, and if few lookups hit at that point the cache is bypassed
+struct CharSXP_Cache {
+  static constexpr uint64_t capacity = 4096; // power of 2
+  static constexpr uint64_t max_entries = capacity / 2;
+  static constexpr uint32_t max_length = 256; // longer strings are not cached
+  struct Slot {
+    SEXP charsxp;
+    uint64_t hash;
+    cetype_t encoding;
+  };
+  std::vector<Slot> slots; // allocated when the first string is cached
+  SEXP charsxp_list;
+  PROTECT_INDEX ipx;
+  Protect_Tracker pt = Protect_Tracker();
+  uint64_t entries = 0;
+  uint64_t lookups = 0;
+  uint64_t hits = 0;
+  bool enabled = true;
+
+  CharSXP_Cache() {
+    PROTECT_WITH_INDEX(charsxp_list = R_NilValue, &ipx); pt++;
+  }
+  ~CharSXP_Cache() {
+    charsxp_cache_totals.lookups += lookups;
+    charsxp_cache_totals.hits += hits;
+    charsxp_cache_totals.entries += entries;
 #ifdef QS_DEBUG
-    std::cout << qtypestr(obj_type) << " " << r_array_len << std::endl;
+    if(lookups > 0) std::cout << "CHARSXP cache: " << hits << " hits of " << lookups << " lookups, " << entries << " entries" << std::endl;
 #endif
   }
-  if(obj_type == qstype::ATTRIBUTE) {
-    number_of_attributes = r_array_len;
-    sobj->readHeader(obj_type, r_array_len);
+  SEXP get(const char * const s, const uint32_t len, const cetype_t encoding) {
+    if(!enabled || len > max_length) return Rf_mkCharLenCE(s, len, encoding);
+    if(slots.empty()) {
+      slots.resize(capacity, Slot{nullptr, 0, CE_NATIVE});
+      REPROTECT(charsxp_list = Rf_allocVector(VECSXP, max_entries), ipx);
+    }
+    lookups++;
+    uint64_t hash = XXH3_64bits(s, len);
+    uint64_t i = hash & (capacity - 1);
+    while(slots[i].charsxp != nullptr) {
+      Slot & slot = slots[i];
+      if(slot.hash == hash && slot.encoding == encoding &&
+         static_cast<uint32_t>(LENGTH(slot.charsxp)) == len && std::memcmp(CHAR(slot.charsxp), s, len) == 0) {
+        hits++;
+        return slot.charsxp;
+      }
+      i = (i + 1) & (capacity - 1);
+    }
+    SEXP charsxp = Rf_mkCharLenCE(s, len, encoding);
+    if(entries < max_entries) {
+      SET_VECTOR_ELT(charsxp_list, entries, charsxp);
+      slots[i] = Slot{charsxp, hash, encoding};
+      entries++;
+    } else if(hits < lookups / 2) {
+      enabled = false;
+    }
+    return charsxp;
+  }
+};
+
+// Explicit stack of processBlock
+// Objects under construction are protected in a single list, at two slots per frame (object and attributes)
+struct Unpack_Stack {
+  std::vector<Unpack_Frame> frames;
+  SEXP protect_list;
+  PROTECT_INDEX ipx;
+  Protect_Tracker pt = Protect_Tracker();
+  CharSXP_Cache char_cache;
+
+  Unpack_Stack() {
+    PROTECT_WITH_INDEX(protect_list = Rf_allocVector(VECSXP, 64), &ipx); pt++;
+  }
+  bool empty() const {
+    return frames.empty();
+  }
+  Unpack_Frame & top() {
+    return frames.back();
+  }
+  void push(SEXP obj, const qstype obj_type, const uint64_t length, const uint64_t number_of_attributes,
+            const int packed_flags, const bool s4_flag) {
+    uint64_t slot = 2 * frames.size();
+    if(slot + 2 > static_cast<uint64_t>(Rf_xlength(protect_list))) {
+      PROTECT(obj);
+      SEXP new_list = Rf_allocVector(VECSXP, 2 * Rf_xlength(protect_list));
+      for(R_xlen_t i=0; i<Rf_xlength(protect_list); i++) {
+        SET_VECTOR_ELT(new_list, i, VECTOR_ELT(protect_list, i));
+      }
+      REPROTECT(protect_list = new_list, ipx);
+      UNPROTECT(1);
+    }
+    SET_VECTOR_ELT(protect_list, slot, obj);
+    frames.push_back(Unpack_Frame{obj, obj, obj_type, length, 0, number_of_attributes, packed_flags, s4_flag, false, false});
+  }
+  void pop() {
+    frames.pop_back();
+  }
+  // allocates the attribute pairlist of the top frame
+  void start_attributes() {
+    Unpack_Frame & f = frames.back();
+    SEXP attrib_pairlist = Rf_allocList(f.number_of_attributes);
+    SET_VECTOR_ELT(protect_list, 2 * frames.size() - 1, attrib_pairlist);
+    f.node = attrib_pairlist;
+    f.length = f.number_of_attributes;
+    f.index = 0;
+    f.attributes = true;
+  }
+  SEXP attributes() {
+    return VECTOR_ELT(protect_list, 2 * frames.size() - 1);
+  }
+};
+
+inline SEXP finishObject(SEXP obj, const bool s4_flag) {
+  if(s4_flag) {
+    SET_S4_OBJECT(obj);
+    // SET_OBJECT(obj, 1); // this flag seems kind of pointless
+  }
+  if( !trust_promises_global && (TYPEOF(obj) == PROMSXP)) {
+    Rcpp::warning("PROMSXP detected, replacing with NULL (see https://github.com/qsbase/qs/issues/93)");
+    return R_NilValue;
+  } else {
+    return obj;
+  }
+}
+
+// reads what comes before a child of the top frame: the name of a pairlist node or attribute and pairlist flags
+template <class T>
+void readChildPrefix(T * const sobj, Unpack_Frame & f) {
+  uint32_t r_string_len;
+  cetype_t string_encoding;
+  if(f.attributes) {
+    sobj->readStringHeader(r_string_len, string_encoding);
+    std::string attr_string = sobj->getString(r_string_len);
 #ifdef QS_DEBUG
-    std::cout << qtypestr(obj_type) << " " << r_array_len << std::endl;
+    std::cout << "attr string " << r_string_len << " " << (int)string_encoding << " "  << attr_string << std::endl;
 #endif
+    SET_TAG(f.node, Rf_install(attr_string.c_str()));
+    f.class_attribute = strcmp(attr_string.c_str(), "class") == 0;
+    return;
   }
-  SEXP obj;
-  Protect_Tracker pt = Protect_Tracker();
-  switch(obj_type) {
-  case qstype::REFERENCE:
-    return sobj->object_ref_hash.at(static_cast<uint32_t>(r_array_len));
+  switch(f.obj_type) {
+  case qstype::PAIRLIST_WF:
+    sobj->readFlags(f.packed_flags);
+    // fall through
   case qstype::PAIRLIST:
-  {
-    obj = PROTECT(Rf_allocList(r_array_len)); pt++;
-    SEXP obj_i = obj;
-    for(uint64_t i=0; i<r_array_len; i++) {
-      uint32_t r_string_len;
-      cetype_t string_encoding;
-      sobj->readStringHeader(r_string_len, string_encoding);
+    sobj->readStringHeader(r_string_len, string_encoding);
 #ifdef QS_DEBUG
-      std::cout << "pairlist name string " << r_string_len << " " << (int)string_encoding << std::endl;
+    std::cout << "pairlist name string " << r_string_len << " " << (int)string_encoding << std::endl;
 #endif
-      if(r_string_len != NA_STRING_LENGTH) {
-        SET_TAG(obj_i, Rf_install(sobj->getString(r_string_len).c_str()));
+    if(r_string_len != NA_STRING_LENGTH) {
+      SET_TAG(f.node, Rf_install(sobj->getString(r_string_len).c_str()));
+    }
+    return;
+  default:
+    return;
+  }
+}
+
+// sets a completed child of the top frame, child is not protected and nothing here may allocate
+inline void attachChild(Unpack_Frame & f, SEXP child) {
+  if(f.attributes) {
+    SETCAR(f.node, child);
+    if(f.class_attribute && (IS_CHARACTER(child)) & (Rf_xlength(child) >= 1)) {
+      SET_OBJECT(f.obj, 1);
+    }
+    f.node = CDR(f.node);
+  } else {
+    switch(f.obj_type) {
+    case qstype::LIST:
+      SET_VECTOR_ELT(f.obj, f.index, child);
+      break;
+    case qstype::PAIRLIST:
+      SETCAR(f.node, child);
+      f.node = CDR(f.node);
+      break;
+    case qstype::PAIRLIST_WF:
+      SETCAR(f.node, child);
+      unpackFlags(f.node, f.packed_flags);
+      f.node = CDR(f.node);
+      break;
+    case qstype::UNLOCKED_ENV:
+    case qstype::LOCKED_ENV:
+      if(f.index == 0) {
+        SET_ENCLOS(f.obj, child);
+      } else if(f.index == 1) {
+        SET_FRAME(f.obj, child);
+      } else {
+        SET_HASHTAB(f.obj, child);
+      }
+      break;
+    default: // LANG, CLOS, PROM, DOT and _WF variants
+      if(f.index == 0) {
+        SET_TAG(f.obj, child);
+      } else if(f.index == 1) {
+        SETCAR(f.obj, child);
+      } else {
+        SETCDR(f.obj, child);
       }
-      SETCAR(obj_i, processBlock(sobj));
-      obj_i = CDR(obj_i);
     }
   }
-    break;
-  case qstype::LANG:
-  case qstype::CLOS:
-  case qstype::PROM:
-  case qstype::DOT:
-  {
-    switch(obj_type) {
-  case qstype::LANG:
-    PROTECT(obj = Rf_allocSExp(LANGSXP)); pt++;
-    break;
+  f.index++;
+}
+
+// finishes a container once all its children are read, before its attributes
+inline void finishChildren(Unpack_Frame & f) {
+  SEXP obj = f.obj;
+  switch(f.obj_type) {
   case qstype::CLOS:
-    PROTECT(obj = Rf_allocSExp(CLOSXP)); pt++;
-    break;
   case qstype::PROM:
-    PROTECT(obj = Rf_allocSExp(PROMSXP)); pt++;
-    break;
-  case qstype::DOT:
-    PROTECT(obj = Rf_allocSExp(DOTSXP)); pt++;
-    break;
-  default:
-    throw std::runtime_error("."); // add default to hush compiler warnings
-  }
-    SET_TAG(obj, processBlock(sobj));
-    SETCAR(obj, processBlock(sobj));
-    SETCDR(obj, processBlock(sobj));
-    if(obj_type == qstype::CLOS && CLOENV(obj) == R_NilValue) {
+    if(f.obj_type == qstype::CLOS && CLOENV(obj) == R_NilValue) {
       SET_CLOENV(obj, R_BaseEnv);
-    } else if(obj_type == qstype::PROM && PRENV(obj) == R_NilValue) {
+    } else if(f.obj_type == qstype::PROM && PRENV(obj) == R_NilValue) {
       SET_PRENV(obj, R_BaseEnv);
     }
-  }
-    break;
-  case qstype::PAIRLIST_WF:
-  {
-    obj = PROTECT(Rf_allocList(r_array_len)); pt++;
-    SEXP obj_i = obj;
-    for(uint64_t i=0; i<r_array_len; i++) {
-      int packed_flags;
-      sobj->readFlags(packed_flags);
-      uint32_t r_string_len;
-      cetype_t string_encoding;
-      sobj->readStringHeader(r_string_len, string_encoding);
-#ifdef QS_DEBUG
-      std::cout << "pairlist name string " << r_string_len << " " << (int)string_encoding << std::endl;
-#endif
-      if(r_string_len != NA_STRING_LENGTH) {
-        SET_TAG(obj_i, Rf_install(sobj->getString(r_string_len).c_str()));
-      }
-      SETCAR(obj_i, processBlock(sobj));
-      unpackFlags(obj_i, packed_flags);
-      obj_i = CDR(obj_i);
-    }
-  }
     break;
   case qstype::LANG_WF:
   case qstype::CLOS_WF:
   case qstype::PROM_WF:
   case qstype::DOT_WF:
-  {
-    switch(obj_type) {
-  case qstype::LANG_WF:
-    PROTECT(obj = Rf_allocSExp(LANGSXP)); pt++;
-    break;
-  case qstype::CLOS_WF:
-    PROTECT(obj = Rf_allocSExp(CLOSXP)); pt++;
-    break;
-  case qstype::PROM_WF:
-    PROTECT(obj = Rf_allocSExp(PROMSXP)); pt++;
-    break;
-  case qstype::DOT_WF:
-    PROTECT(obj = Rf_allocSExp(DOTSXP)); pt++;
-    break;
-  default:
-    throw std::runtime_error("."); // add default to hush compiler warnings
-  }
-    SET_TAG(obj, processBlock(sobj));
-    SETCAR(obj, processBlock(sobj));
-    SETCDR(obj, processBlock(sobj));
-    if(obj_type == qstype::CLOS && CLOENV(obj) == R_NilValue) {
-      SET_CLOENV(obj, R_BaseEnv);
-    } else if(obj_type == qstype::PROM && PRENV(obj) == R_NilValue) {
-      SET_PRENV(obj, R_BaseEnv);
-    }
-    unpackFlags(obj, static_cast<int>(r_array_len));
-  }
+    unpackFlags(obj, f.packed_flags);
     break;
   case qstype::UNLOCKED_ENV:
   case qstype::LOCKED_ENV:
   {
-    obj = PROTECT(Rf_allocSExp(ENVSXP)); pt++;
-    sobj->object_ref_hash.emplace(static_cast<uint32_t>(r_array_len), obj);
-    SET_ENCLOS(obj, processBlock(sobj));
-    SET_FRAME(obj, processBlock(sobj));
-    SET_HASHTAB(obj, processBlock(sobj));
     // R_RestoreHashCount(obj); // doesn't exist in new API; the function sets truelength to the number of filled hash slots
     SEXP table = HASHTAB(obj);
     if(table != R_NilValue) {
@@ -480,44 +629,296 @@ SEXP processBlock(T * const sobj) {
       }
       SET_TRUELENGTH(table, count);
     }
-    if(obj_type == qstype::LOCKED_ENV) R_LockEnvironment(obj, FALSE);
+    if(f.obj_type == qstype::LOCKED_ENV) R_LockEnvironment(obj, FALSE);
     if(ENCLOS(obj) == R_NilValue) SET_ENCLOS(obj, R_BaseEnv);
   }
     break;
-  case qstype::S4:
-    // obj = PROTECT(Rf_allocS4Object()); pt++; // S4 object may not have S4 flag
-    obj = PROTECT(Rf_allocSExp(S4SXP)); pt++;
+  default:
     break;
-  case qstype::LIST:
-    obj = PROTECT(Rf_allocVector(VECSXP, r_array_len)); pt++;
-    for(uint64_t i=0; i<r_array_len; i++) {
-      SET_VECTOR_ELT(obj, i, processBlock(sobj));
+  }
+}
+
+// Objects that later references return, by index (the reverse of CountToObjectMap)
+// The objects are also kept in a protected list until the end of the read, since shared objects read while
+// passing over unselected elements (processAttributes) are not part of the result
+struct IndexToObjectMap {
+  std::unordered_map<uint32_t, SEXP> map;
+  SEXP keep_list;
+  PROTECT_INDEX ipx;
+  Protect_Tracker pt = Protect_Tracker();
+  uint64_t kept = 0;
+
+  IndexToObjectMap() {
+    PROTECT_WITH_INDEX(keep_list = R_NilValue, &ipx); pt++;
+  }
+  IndexToObjectMap(const IndexToObjectMap &) = delete;
+  IndexToObjectMap & operator=(const IndexToObjectMap &) = delete;
+  void emplace(const uint32_t index, SEXP obj) {
+    if(kept == static_cast<uint64_t>(Rf_xlength(keep_list))) {
+      PROTECT(obj);
+      SEXP new_list = Rf_allocVector(VECSXP, kept == 0 ? 64 : 2 * kept);
+      for(uint64_t i=0; i<kept; i++) {
+        SET_VECTOR_ELT(new_list, i, VECTOR_ELT(keep_list, i));
+      }
+      REPROTECT(keep_list = new_list, ipx);
+      UNPROTECT(1);
     }
-    break;
+    SET_VECTOR_ELT(keep_list, kept++, obj);
+    map.emplace(index, obj);
+  }
+  std::unordered_map<uint32_t, SEXP>::const_iterator find(const uint32_t index) const {
+    return map.find(index);
+  }
+  std::unordered_map<uint32_t, SEXP>::const_iterator end() const {
+    return map.end();
+  }
+};
+
+// Registers an object that was written with a shared prefix, so that later references to its index return it
+template <class T>
+inline SEXP registerShared(T * const sobj, uint32_t & shared_index, SEXP obj) {
+  if(shared_index != 0) {
+    sobj->object_ref_hash.emplace(shared_index, obj);
+    shared_index = 0;
+  }
+  return obj;
+}
+
+// Reads a dictionary encoded character vector: each unique value is created once and the vector is filled by code
+// The returned object is not protected
+template <class T>
+SEXP readStringDict(T * const sobj, const uint64_t r_array_len, CharSXP_Cache & char_cache) {
+  Protect_Tracker pt = Protect_Tracker();
+  std::array<char, 5> dict_info;
+  sobj->getBlockData(dict_info.data(), 5);
+  uint32_t number_of_unique = unaligned_cast<uint32_t>(dict_info.data(), 0);
+  uint8_t width = static_cast<uint8_t>(dict_info[4]);
+  if(width != 1 && width != 2 && width != 4) throw std::runtime_error("Malformed dictionary encoded character vector");
+#ifdef QS_DEBUG
+  std::cout << "string dictionary " << number_of_unique << " " << (int)width << std::endl;
+#endif
+#ifdef USE_ALT_REP
+  const bool use_sf = sobj->use_alt_rep_bool;
+  std::vector<sfstring> sf_uniques;
+#else
+  const bool use_sf = false;
+#endif
+  SEXP uniques = R_NilValue;
+  if(use_sf) {
+#ifdef USE_ALT_REP
+    sf_uniques.resize(number_of_unique);
+    for(uint32_t j=0; j<number_of_unique; j++) {
+      uint32_t r_string_len;
+      cetype_t string_encoding;
+      sobj->readStringHeader(r_string_len, string_encoding);
+      if(r_string_len == NA_STRING_LENGTH) {
+        sf_uniques[j] = sfstring(NA_STRING);
+      } else if(r_string_len > 0) {
+        sf_uniques[j] = sfstring(r_string_len);
+        sobj->getBlockData(&sf_uniques[j].sdata[0], r_string_len);
+        sf_uniques[j].check_if_native_is_ascii(string_encoding);
+      }
+    }
+#endif
+  } else {
+    uniques = PROTECT(Rf_allocVector(STRSXP, number_of_unique)); pt++;
+    std::string temp_string;
+    for(uint32_t j=0; j<number_of_unique; j++) {
+      uint32_t r_string_len;
+      cetype_t string_encoding;
+      sobj->readStringHeader(r_string_len, string_encoding);
+      if(r_string_len == NA_STRING_LENGTH) {
+        SET_STRING_ELT(uniques, j, NA_STRING);
+      } else if(r_string_len == 0) {
+        SET_STRING_ELT(uniques, j, R_BlankString);
+      } else {
+        if(r_string_len > temp_string.size()) temp_string.resize(r_string_len);
+        sobj->getBlockData(&temp_string[0], r_string_len);
+        SET_STRING_ELT(uniques, j, char_cache.get(temp_string.c_str(), r_string_len, string_encoding));
+      }
+    }
+  }
+  SEXP obj;
+#ifdef USE_ALT_REP
+  sf_vec_data * sf_ref = nullptr;
+  if(use_sf) {
+    obj = PROTECT(sf_vector(r_array_len)); pt++;
+    sf_ref = &sf_vec_data_ref(obj);
+  } else {
+    obj = PROTECT(Rf_allocVector(STRSXP, r_array_len)); pt++;
+  }
+#else
+  obj = PROTECT(Rf_allocVector(STRSXP, r_array_len)); pt++;
+#endif
+  const SEXP * uniques_ptr = use_sf ? nullptr : STRING_PTR_RO(uniques);
+  std::vector<char> chunk(DICT_CODE_CHUNK * width);
+  for(uint64_t i=0; i<r_array_len; i += DICT_CODE_CHUNK) {
+    uint64_t n = std::min(DICT_CODE_CHUNK, r_array_len - i);
+    sobj->getBlockData(chunk.data(), n * width);
+    for(uint64_t k=0; k<n; k++) {
+      uint32_t code;
+      switch(width) {
+      case 1:
+        code = static_cast<uint8_t>(chunk[k]);
+        break;
+      case 2:
+        code = unaligned_cast<uint16_t>(chunk.data(), 2*k);
+        break;
+      default:
+        code = unaligned_cast<uint32_t>(chunk.data(), 4*k);
+        break;
+      }
+      if(code >= number_of_unique) throw std::runtime_error("Malformed dictionary encoded character vector");
+#ifdef USE_ALT_REP
+      if(use_sf) {
+        (*sf_ref)[i+k] = sf_uniques[code];
+        continue;
+      }
+#endif
+      SET_STRING_ELT(obj, i+k, uniques_ptr[code]);
+    }
+  }
+  return obj;
+}
+
+// Reads an integer or numeric vector stored as deltas or XOR of consecutive values (see transform_routines.h)
+// The returned object is not protected
+template <class T>
+SEXP readTransformed(T * const sobj, const uint64_t r_array_len, const bool bitshuffled) {
+  Protect_Tracker pt = Protect_Tracker();
+  std::array<char, 2> transform_info;
+  sobj->getBlockData(transform_info.data(), 2);
+  vector_transform transform = static_cast<vector_transform>(transform_info[1]);
+  // bit shuffled vectors are not necessarily transformed
+  bool untransformed = bitshuffled && transform == vector_transform::none;
+  SEXPTYPE type;
+  uint64_t bytesoftype;
+  if(transform_info[0] == 0 && (untransformed || transform == vector_transform::delta || transform == vector_transform::delta2)) {
+    type = INTSXP;
+    bytesoftype = 4;
+  } else if(transform_info[0] == 1 && (untransformed || transform == vector_transform::xor_prev || transform == vector_transform::real_delta)) {
+    type = REALSXP;
+    bytesoftype = 8;
+  } else {
+    throw std::runtime_error("Malformed transformed vector");
+  }
+  SEXP obj = lazyVector(sobj, type, r_array_len, bytesoftype, !bitshuffled, transform, bitshuffled);
+  if(obj != R_NilValue) return obj;
+  obj = PROTECT(Rf_allocVector(type, r_array_len)); pt++;
+  char * data = type == INTSXP ? reinterpret_cast<char*>(INTEGER(obj)) : reinterpret_cast<char*>(REAL(obj));
+  if(bitshuffled) {
+    std::vector<uint8_t> block(BITSHUFFLE_BLOCK * bytesoftype);
+    std::vector<uint8_t> buffer;
+    for(uint64_t i=0; i<r_array_len; i += BITSHUFFLE_BLOCK) {
+      uint64_t block_n = std::min(BITSHUFFLE_BLOCK, r_array_len - i);
+      sobj->getBlockData(reinterpret_cast<char*>(block.data()), block_n * bytesoftype);
+      bitunshuffle(block.data(), reinterpret_cast<uint8_t*>(data) + i * bytesoftype, block_n, bytesoftype, buffer);
+    }
+  } else {
+    sobj->getShuffleBlockData(data, r_array_len * bytesoftype, bytesoftype);
+  }
+  inverse_transform(data, r_array_len, transform);
+  return obj;
+}
+
+// Reads a logical vector packed to 2 bits per element (see transform_routines.h)
+// The returned object is not protected
+template <class T>
+SEXP readPackedLogical(T * const sobj, const uint64_t r_array_len) {
+  Protect_Tracker pt = Protect_Tracker();
+  SEXP obj = lazyVector(sobj, LGLSXP, r_array_len, 4, false, vector_transform::logical_pack);
+  if(obj != R_NilValue) return obj;
+  obj = PROTECT(Rf_allocVector(LGLSXP, r_array_len)); pt++;
+  std::vector<uint8_t> data(packed_logical_bytes(r_array_len));
+  sobj->getBlockData(reinterpret_cast<char*>(data.data()), data.size());
+  if(!logical_unpack(data.data(), LOGICAL(obj), r_array_len)) throw std::runtime_error("Malformed packed logical vector");
+  return obj;
+}
+
+// Reads a compact integer or numeric sequence
+// There is no API to create one directly, so the sequence is rebuilt with R's `:` (numeric sequences are coerced, which keeps them compact)
+// The returned object is not protected
+template <class T>
+SEXP readCompactSeq(T * const sobj, const uint64_t r_array_len) {
+  Protect_Tracker pt = Protect_Tracker();
+  std::array<char, 17> seq_info;
+  sobj->getBlockData(seq_info.data(), 17);
+  int type = seq_info[0] == 0 ? INTSXP : REALSXP;
+  double start = unaligned_cast<double>(seq_info.data(), 1);
+  double step = unaligned_cast<double>(seq_info.data(), 9);
+  if(r_array_len == 0) return Rf_allocVector(type, 0);
+  if(step == 1 || step == -1) {
+    SEXP from = PROTECT(Rf_ScalarReal(start)); pt++;
+    SEXP to = PROTECT(Rf_ScalarReal(start + step * static_cast<double>(r_array_len - 1))); pt++;
+    SEXP call = PROTECT(Rf_lang3(Rf_install(":"), from, to)); pt++;
+    SEXP obj = PROTECT(Rf_eval(call, R_BaseEnv)); pt++;
+    if(static_cast<uint64_t>(Rf_xlength(obj)) == r_array_len) {
+      return TYPEOF(obj) == type ? obj : Rf_coerceVector(obj, type);
+    }
+  }
+  // other steps are not written by qs, but are read as a regular vector
+  SEXP obj = PROTECT(Rf_allocVector(type, r_array_len)); pt++;
+  if(type == INTSXP) {
+    int * optr = INTEGER(obj);
+    for(uint64_t i=0; i<r_array_len; i++) optr[i] = static_cast<int>(start + step * static_cast<double>(i));
+  } else {
+    double * optr = REAL(obj);
+    for(uint64_t i=0; i<r_array_len; i++) optr[i] = start + step * static_cast<double>(i);
+  }
+  return obj;
+}
+
+// Reads an object that has no children
+// The returned object is not protected
+// finished is set for objects that are returned as is, without attributes
+template <class T>
+SEXP processLeaf(T * const sobj, const qstype obj_type, const uint64_t r_array_len, bool & finished, CharSXP_Cache & char_cache) {
+  SEXP obj;
+  Protect_Tracker pt = Protect_Tracker();
+  switch(obj_type) {
+  case qstype::REFERENCE:
+  {
+    finished = true;
+    auto ref = sobj->object_ref_hash.find(static_cast<uint32_t>(r_array_len));
+    // environments in list elements that were skipped by qread(select/elements) are not read
+    if(ref == sobj->object_ref_hash.end()) throw std::runtime_error("Reference to an object that was not read");
+    // other shared objects are now used in more than one place and must be copied before being modified
+    if(TYPEOF(ref->second) != ENVSXP) MARK_NOT_MUTABLE(ref->second);
+    return ref->second;
+  }
+  case qstype::S4:
+    // obj = PROTECT(Rf_allocS4Object()); pt++; // S4 object may not have S4 flag
+    return Rf_allocSExp(S4SXP);
   case qstype::NUMERIC:
+    obj = lazyVector(sobj, REALSXP, r_array_len, 8, sobj->qm.real_shuffle);
+    if(obj != R_NilValue) return obj;
     obj = PROTECT(Rf_allocVector(REALSXP, r_array_len)); pt++;
     if(sobj->qm.real_shuffle) {
       sobj->getShuffleBlockData(reinterpret_cast<char*>(REAL(obj)), r_array_len*8, 8);
     } else {
       sobj->getBlockData(reinterpret_cast<char*>(REAL(obj)), r_array_len*8);
     }
-    break;
+    return obj;
   case qstype::INTEGER:
+    obj = lazyVector(sobj, INTSXP, r_array_len, 4, sobj->qm.int_shuffle);
+    if(obj != R_NilValue) return obj;
     obj = PROTECT(Rf_allocVector(INTSXP, r_array_len)); pt++;
     if(sobj->qm.int_shuffle) {
       sobj->getShuffleBlockData(reinterpret_cast<char*>(INTEGER(obj)), r_array_len*4, 4);
     } else {
       sobj->getBlockData(reinterpret_cast<char*>(INTEGER(obj)), r_array_len*4);
     }
-    break;
+    return obj;
   case qstype::LOGICAL:
+    obj = lazyVector(sobj, LGLSXP, r_array_len, 4, sobj->qm.lgl_shuffle);
+    if(obj != R_NilValue) return obj;
     obj = PROTECT(Rf_allocVector(LGLSXP, r_array_len)); pt++;
     if(sobj->qm.lgl_shuffle) {
       sobj->getShuffleBlockData(reinterpret_cast<char*>(LOGICAL(obj)), r_array_len*4, 4);
     } else {
       sobj->getBlockData(reinterpret_cast<char*>(LOGICAL(obj)), r_array_len*4);
     }
-    break;
+    return obj;
   case qstype::COMPLEX:
     obj = PROTECT(Rf_allocVector(CPLXSXP, r_array_len)); pt++;
     if(sobj->qm.cplx_shuffle) {
@@ -525,11 +926,11 @@ SEXP processBlock(T * const sobj) {
     } else {
       sobj->getBlockData(reinterpret_cast<char*>(COMPLEX(obj)), r_array_len*16);
     }
-    break;
+    return obj;
   case qstype::RAW:
     obj = PROTECT(Rf_allocVector(RAWSXP, r_array_len)); pt++;
     if(r_array_len > 0) sobj->getBlockData(reinterpret_cast<char*>(RAW(obj)), r_array_len);
-    break;
+    return obj;
   case qstype::CHARACTER:
 #ifdef USE_ALT_REP
     if(sobj->use_alt_rep_bool) {
@@ -581,13 +982,23 @@ SEXP processBlock(T * const sobj) {
         } else if(r_string_len > 0) {
           if(r_string_len > temp_string.size()) temp_string.resize(r_string_len);
           sobj->getBlockData(&temp_string[0], r_string_len);
-          SET_STRING_ELT(obj, i, Rf_mkCharLenCE(temp_string.c_str(), r_string_len, string_encoding));
+          SET_STRING_ELT(obj, i, char_cache.get(temp_string.c_str(), r_string_len, string_encoding));
         }
       }
 #ifdef USE_ALT_REP
     }
 #endif
-    break;
+    return obj;
+  case qstype::CHARACTER_DICT:
+    return readStringDict(sobj, r_array_len, char_cache);
+  case qstype::COMPACT_SEQ:
+    return readCompactSeq(sobj, r_array_len);
+  case qstype::TRANSFORMED:
+    return readTransformed(sobj, r_array_len, false);
+  case qstype::BITSHUFFLED:
+    return readTransformed(sobj, r_array_len, true);
+  case qstype::PACKED_LOGICAL:
+    return readPackedLogical(sobj, r_array_len);
   case qstype::SYM:
   {
     uint32_t r_string_len;
@@ -600,57 +1011,123 @@ SEXP processBlock(T * const sobj) {
     // there is some difference between Rf_installChar and Rf_install, as Rf_installChar will translate to native encoding
     // Use PROTECT since serialize.c does; not clear if necessary
     obj = PROTECT(Rf_mkCharLenCE(sobj->getString(r_string_len).c_str(), r_string_len, string_encoding)); pt++;
-    obj = Rf_installChar(obj); //Rf_installTrChar in R 4.0.0
+    return Rf_installChar(obj); //Rf_installTrChar in R 4.0.0
   }
-    break;
   case qstype::RSERIALIZED:
   {
+    finished = true;
     SEXP obj_data = PROTECT(Rf_allocVector(RAWSXP, r_array_len)); pt++;
     sobj->getBlockData(reinterpret_cast<char*>(RAW(obj_data)), r_array_len);
-    obj = PROTECT(R::unserializeFromRaw(obj_data)); pt++;
-    return obj;
+    return R::unserializeFromRaw(obj_data);
   }
   default: // also NILSXP
-    obj = R_NilValue;
-    return obj;
+    finished = true;
+    return R_NilValue;
   }
-  if(number_of_attributes > 0) {
-    SEXP attrib_pairlist = PROTECT(Rf_allocList(number_of_attributes)); pt++;
-    SEXP aptr = attrib_pairlist;
-    for(uint64_t i=0; i<number_of_attributes; i++) {
-      uint32_t r_string_len;
-      cetype_t string_encoding;
-      sobj->readStringHeader(r_string_len, string_encoding);
-      std::string attr_string = sobj->getString(r_string_len);
+}
+
+// Reads an object with an explicit stack instead of recursion, so that deeply nested objects
+// (nested lists, long language chains) do not overflow the C stack
+// Containers are pushed onto the stack and filled in as their children complete
+// shared_index is the index of the object if its shared prefix was already read (by processAttributes)
+template <class T>
+SEXP processBlock(T * const sobj, uint32_t shared_index = 0) {
+  Unpack_Stack stack;
+  SEXP obj;
+  while(true) {
+    qstype obj_type;
+    uint64_t r_array_len = 0; // not set for language objects without flags
+    uint64_t number_of_attributes = 0;
+    bool s4_flag = false;
+    sobj->readHeader(obj_type, r_array_len);
 #ifdef QS_DEBUG
-      std::cout << "attr string " << r_string_len << " " << (int)string_encoding << " "  << attr_string << std::endl;
+    std::cout << qtypestr(obj_type) << " " << r_array_len << std::endl;
 #endif
-      // Is protect needed here?
-      // I believe it is not, since SET_TAG/SETCAR shouldn't allocate and serialize.c doesn't protect either
-      // What about IS_CHARACTER?
-      SET_TAG(aptr, Rf_install(attr_string.c_str()));
-      if( strcmp(attr_string.c_str(), "class") == 0 ) {
-        SEXP aobj = PROTECT(processBlock(sobj)); pt++;
-        if((IS_CHARACTER(aobj)) & (Rf_xlength(aobj) >= 1)) {
-          SET_OBJECT(obj, 1);
+    if(obj_type == qstype::SHARED) {
+      shared_index = static_cast<uint32_t>(r_array_len);
+      sobj->readHeader(obj_type, r_array_len);
+#ifdef QS_DEBUG
+      std::cout << qtypestr(obj_type) << " " << r_array_len << std::endl;
+#endif
+    }
+    if(obj_type == qstype::S4FLAG) {
+      s4_flag = true;
+      sobj->readHeader(obj_type, r_array_len);
+#ifdef QS_DEBUG
+      std::cout << qtypestr(obj_type) << " " << r_array_len << std::endl;
+#endif
+    }
+    if(obj_type == qstype::ATTRIBUTE) {
+      number_of_attributes = r_array_len;
+      sobj->readHeader(obj_type, r_array_len);
+#ifdef QS_DEBUG
+      std::cout << qtypestr(obj_type) << " " << r_array_len << std::endl;
+#endif
+    }
+    switch(obj_type) {
+    case qstype::LIST:
+      stack.push(registerShared(sobj, shared_index, Rf_allocVector(VECSXP, r_array_len)), obj_type, r_array_len, number_of_attributes, 0, s4_flag);
+      break;
+    case qstype::PAIRLIST:
+    case qstype::PAIRLIST_WF:
+      stack.push(registerShared(sobj, shared_index, Rf_allocList(r_array_len)), obj_type, r_array_len, number_of_attributes, 0, s4_flag);
+      break;
+    case qstype::LANG:
+    case qstype::LANG_WF:
+      stack.push(registerShared(sobj, shared_index, Rf_allocSExp(LANGSXP)), obj_type, 3, number_of_attributes, static_cast<int>(r_array_len), s4_flag);
+      break;
+    case qstype::CLOS:
+    case qstype::CLOS_WF:
+      stack.push(registerShared(sobj, shared_index, Rf_allocSExp(CLOSXP)), obj_type, 3, number_of_attributes, static_cast<int>(r_array_len), s4_flag);
+      break;
+    case qstype::PROM:
+    case qstype::PROM_WF:
+      stack.push(registerShared(sobj, shared_index, Rf_allocSExp(PROMSXP)), obj_type, 3, number_of_attributes, static_cast<int>(r_array_len), s4_flag);
+      break;
+    case qstype::DOT:
+    case qstype::DOT_WF:
+      stack.push(registerShared(sobj, shared_index, Rf_allocSExp(DOTSXP)), obj_type, 3, number_of_attributes, static_cast<int>(r_array_len), s4_flag);
+      break;
+    case qstype::UNLOCKED_ENV:
+    case qstype::LOCKED_ENV:
+      obj = Rf_allocSExp(ENVSXP);
+      sobj->object_ref_hash.emplace(static_cast<uint32_t>(r_array_len), obj);
+      stack.push(obj, obj_type, 3, number_of_attributes, 0, s4_flag);
+      break;
+    default:
+    {
+      bool finished = false;
+      obj = registerShared(sobj, shared_index, processLeaf(sobj, obj_type, r_array_len, finished, stack.char_cache));
+      if(!finished && number_of_attributes > 0) {
+        stack.push(obj, obj_type, 0, number_of_attributes, 0, s4_flag);
+        break;
+      }
+      if(!finished) obj = finishObject(obj, s4_flag);
+      if(stack.empty()) return obj;
+      attachChild(stack.top(), obj);
+    }
+    }
+    // find the next child to read, completing containers along the way
+    while(true) {
+      Unpack_Frame & f = stack.top();
+      if(f.index < f.length) {
+        readChildPrefix(sobj, f);
+        break;
+      }
+      if(!f.attributes) {
+        finishChildren(f);
+        if(f.number_of_attributes > 0) {
+          stack.start_attributes();
+          continue;
         }
-        SETCAR(aptr, aobj);
       } else {
-        SETCAR(aptr, processBlock(sobj));
+        SET_ATTRIB(f.obj, stack.attributes());
       }
-      aptr = CDR(aptr);
+      obj = finishObject(f.obj, f.s4_flag);
+      stack.pop();
+      if(stack.empty()) return obj;
+      attachChild(stack.top(), obj);
     }
-    SET_ATTRIB(obj, attrib_pairlist);
-  }
-  if(s4_flag) {
-    SET_S4_OBJECT(obj);
-    // SET_OBJECT(obj, 1); // this flag seems kind of pointless
-  }
-  if( !trust_promises_global && (TYPEOF(obj) == PROMSXP)) {
-    Rcpp::warning("PROMSXP detected, replacing with NULL (see https://github.com/qsbase/qs/issues/93)");
-    return R_NilValue;
-  } else {
-    return obj;
   }
 }
 
@@ -664,9 +1141,9 @@ SEXP processBlock(T * const sobj) {
 // Modifications from processBlock function:
 // * remove DEBUG statements
 // * Don't create R objects, but we do need to pass through them and process their headers
-// * Use sobj->shuffleblock to write data temporarily to
+// * Skip over vector data with sobj->skipBlockData instead of reading it
 // * Since this is called recursively, there is a flag get_attr (otherwise return R_nilValue)
-// Used for qattributes function
+// Used for qattributes function, and to skip list elements that are not selected in qread
 template <class T>
 SEXP processAttributes(T * const sobj, const bool get_attr = true) {
   qstype obj_type;
@@ -674,6 +1151,13 @@ SEXP processAttributes(T * const sobj, const bool get_attr = true) {
   uint64_t number_of_attributes = 0;
   // bool s4_flag = false; // unused
   sobj->readHeader(obj_type, r_array_len);
+  if(obj_type == qstype::SHARED) {
+    // shared objects may be referenced by objects that are read later, so they are always read (and kept by object_ref_hash)
+    Protect_Tracker pt = Protect_Tracker();
+    SEXP obj = PROTECT(processBlock(sobj, static_cast<uint32_t>(r_array_len))); pt++;
+    if(!get_attr || ATTRIB(obj) == R_NilValue) return R_NilValue;
+    return Rf_PairToVectorList(ATTRIB(obj));
+  }
   if(obj_type == qstype::S4FLAG) {
     // s4_flag = true;
     sobj->readHeader(obj_type, r_array_len);
@@ -695,7 +1179,7 @@ SEXP processAttributes(T * const sobj, const bool get_attr = true) {
       cetype_t string_encoding;
       sobj->readStringHeader(r_string_len, string_encoding);
       if(r_string_len != NA_STRING_LENGTH) {
-        sobj->getString(r_string_len);
+        sobj->skipBlockData(r_string_len);
       }
       processAttributes(sobj, false);
     }
@@ -718,7 +1202,7 @@ SEXP processAttributes(T * const sobj, const bool get_attr = true) {
       cetype_t string_encoding;
       sobj->readStringHeader(r_string_len, string_encoding);
       if(r_string_len != NA_STRING_LENGTH) {
-        sobj->getString(r_string_len);
+        sobj->skipBlockData(r_string_len);
       }
       processAttributes(sobj, false); // CAR
     }
@@ -746,49 +1230,80 @@ SEXP processAttributes(T * const sobj, const bool get_attr = true) {
     }
     break;
   case qstype::NUMERIC:
-    sobj->getBlockData(sobj->tempBlock(r_array_len*8), r_array_len*8);
+    sobj->skipBlockData(r_array_len*8);
     break;
   case qstype::INTEGER:
-    sobj->getBlockData(sobj->tempBlock(r_array_len*4), r_array_len*4);
+    sobj->skipBlockData(r_array_len*4);
     break;
   case qstype::LOGICAL:
-    sobj->getBlockData(sobj->tempBlock(r_array_len*4), r_array_len*4);
+    sobj->skipBlockData(r_array_len*4);
     break;
   case qstype::COMPLEX:
-    sobj->getBlockData(sobj->tempBlock(r_array_len*16), r_array_len*16);
+    sobj->skipBlockData(r_array_len*16);
     break;
   case qstype::RAW:
-    sobj->getBlockData(sobj->tempBlock(r_array_len), r_array_len);
+    sobj->skipBlockData(r_array_len);
+    break;
+  case qstype::COMPACT_SEQ:
+    sobj->skipBlockData(17);
+    break;
+  case qstype::TRANSFORMED:
+  case qstype::BITSHUFFLED:
+  {
+    std::array<char, 2> transform_info;
+    sobj->getBlockData(transform_info.data(), 2);
+    sobj->skipBlockData(r_array_len * (transform_info[0] == 0 ? 4 : 8));
+  }
+    break;
+  case qstype::PACKED_LOGICAL:
+    sobj->skipBlockData(packed_logical_bytes(r_array_len));
     break;
   case qstype::CHARACTER:
   {
-    std::string temp_string;
     for(uint64_t i=0; i < r_array_len; i++) {
       uint32_t r_string_len;
       cetype_t string_encoding;
       sobj->readStringHeader(r_string_len, string_encoding);
       if(r_string_len != NA_STRING_LENGTH) {
-        if(r_string_len != 0) {
-          if(r_string_len > temp_string.size()) temp_string.resize(r_string_len);
-          sobj->getBlockData(&temp_string[0], r_string_len);
-        }
+        sobj->skipBlockData(r_string_len);
       }
     }
   }
     break;
+  case qstype::CHARACTER_DICT:
+  {
+    std::array<char, 5> dict_info;
+    sobj->getBlockData(dict_info.data(), 5);
+    uint32_t number_of_unique = unaligned_cast<uint32_t>(dict_info.data(), 0);
+    uint8_t width = static_cast<uint8_t>(dict_info[4]);
+    for(uint32_t j=0; j < number_of_unique; j++) {
+      uint32_t r_string_len;
+      cetype_t string_encoding;
+      sobj->readStringHeader(r_string_len, string_encoding);
+      if(r_string_len != NA_STRING_LENGTH) {
+        sobj->skipBlockData(r_string_len);
+      }
+    }
+    sobj->skipBlockData(r_array_len * width);
+  }
+    break;
   case qstype::SYM:
   {
     uint32_t r_string_len;
     cetype_t string_encoding;
     sobj->readStringHeader(r_string_len, string_encoding);
     // symbols cannot be NA or zero length
-    sobj->getString(r_string_len);
+    sobj->skipBlockData(r_string_len);
   }
     break;
   case qstype::RSERIALIZED:
   {
     // if the object is R-serialized, then the attributes are stored within the
     // R-serialized object, rather than the qs object
+    if(!get_attr) {
+      sobj->skipBlockData(r_array_len);
+      return R_NilValue;
+    }
     SEXP obj_data = PROTECT(Rf_allocVector(RAWSXP, r_array_len)); pt++;
     sobj->getBlockData(reinterpret_cast<char*>(RAW(obj_data)), r_array_len);
     SEXP obj = R::unserializeFromRaw(obj_data); // no need to PROTECT, ATTRIB doesn't allocate
@@ -818,7 +1333,7 @@ SEXP processAttributes(T * const sobj, const bool get_attr = true) {
         uint32_t r_string_len;
         cetype_t string_encoding;
         sobj->readStringHeader(r_string_len, string_encoding);
-        sobj->getString(r_string_len);
+        sobj->skipBlockData(r_string_len);
         processAttributes(sobj, false);
       }
     }
@@ -826,4 +1341,98 @@ SEXP processAttributes(T * const sobj, const bool get_attr = true) {
   return R_NilValue;
 }
 
+// Reads only the selected top level elements of a list, other elements are passed over with processAttributes
+// selected holds 0-based element indices in the order of the output list, the names attribute is subset accordingly
+// Used for qread with select or elements
+template <class T>
+SEXP processBlockSelect(T * const sobj, const std::vector<uint64_t> & selected) {
+  qstype obj_type;
+  uint64_t r_array_len;
+  uint64_t number_of_attributes = 0;
+  bool s4_flag = false;
+  uint32_t shared_index = 0;
+  sobj->readHeader(obj_type, r_array_len);
+  if(obj_type == qstype::SHARED) {
+    shared_index = static_cast<uint32_t>(r_array_len);
+    sobj->readHeader(obj_type, r_array_len);
+  }
+  if(obj_type == qstype::S4FLAG) {
+    s4_flag = true;
+    sobj->readHeader(obj_type, r_array_len);
+  }
+  if(obj_type == qstype::ATTRIBUTE) {
+    number_of_attributes = r_array_len;
+    sobj->readHeader(obj_type, r_array_len);
+  }
+  if(obj_type != qstype::LIST) throw std::runtime_error("select and elements can only be used with lists and data.frames");
+  // (element index, output index) pairs in the order the elements are stored
+  std::vector<std::pair<uint64_t, uint64_t>> order(selected.size());
+  for(uint64_t j=0; j<selected.size(); j++) {
+    if(selected[j] >= r_array_len) throw std::runtime_error("Selected element is out of range");
+    order[j] = std::make_pair(selected[j], j);
+  }
+  std::sort(order.begin(), order.end());
+  Protect_Tracker pt = Protect_Tracker();
+  SEXP obj = PROTECT(Rf_allocVector(VECSXP, selected.size())); pt++;
+  registerShared(sobj, shared_index, obj);
+  auto next = order.begin();
+  for(uint64_t i=0; i<r_array_len; i++) {
+    if(next != order.end() && next->first == i) {
+      SEXP element = processBlock(sobj);
+      for(; next != order.end() && next->first == i; ++next) {
+        SET_VECTOR_ELT(obj, next->second, element);
+      }
+    } else {
+      processAttributes(sobj, false);
+    }
+  }
+  if(number_of_attributes > 0) {
+    SEXP attrib_pairlist = PROTECT(Rf_allocList(number_of_attributes)); pt++;
+    SEXP aptr = attrib_pairlist;
+    for(uint64_t i=0; i<number_of_attributes; i++) {
+      uint32_t r_string_len;
+      cetype_t string_encoding;
+      sobj->readStringHeader(r_string_len, string_encoding);
+      std::string attr_string = sobj->getString(r_string_len);
+      SET_TAG(aptr, Rf_install(attr_string.c_str()));
+      if( strcmp(attr_string.c_str(), "class") == 0 ) {
+        SEXP aobj = PROTECT(processBlock(sobj)); pt++;
+        if((IS_CHARACTER(aobj)) & (Rf_xlength(aobj) >= 1)) {
+          SET_OBJECT(obj, 1);
+        }
+        SETCAR(aptr, aobj);
+      } else if( strcmp(attr_string.c_str(), "names") == 0 ) {
+        SEXP names = PROTECT(processBlock(sobj)); pt++;
+        if((TYPEOF(names) == STRSXP) && (static_cast<uint64_t>(Rf_xlength(names)) == r_array_len)) {
+          SEXP selected_names = PROTECT(Rf_allocVector(STRSXP, selected.size())); pt++;
+          for(uint64_t j=0; j<selected.size(); j++) {
+            SET_STRING_ELT(selected_names, j, STRING_ELT(names, selected[j]));
+          }
+          SETCAR(aptr, selected_names);
+        } else {
+          SETCAR(aptr, names);
+        }
+      } else {
+        SETCAR(aptr, processBlock(sobj));
+      }
+      aptr = CDR(aptr);
+    }
+    SET_ATTRIB(obj, attrib_pairlist);
+  }
+  if(s4_flag) {
+    SET_S4_OBJECT(obj);
+  }
+  return obj;
+}
+
+// reads the whole object, or only the selected top level elements of a list if selected is not null
+template <class T>
+SEXP readObject(T * const sobj, const std::vector<uint64_t> * const selected) {
+  if(selected == nullptr) {
+    return processBlock(sobj);
+  } else {
+    return processBlockSelect(sobj, *selected);
+  }
+}
+
 #endif
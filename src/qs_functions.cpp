@@ -26,6 +26,7 @@
 #include "qs_mt_deserialization.h"
 #include "qs_serialization_stream.h"
 #include "qs_deserialization_stream.h"
+#include "qs_deserialization_lazy.h"
 #include "extra_functions.h"
 
 #define FILE_SAVE_ERR_MSG "Failed to open for writing. Does the directory exist? Do you have file permissions? Is the file name long? (>255 chars)"
@@ -39,6 +40,7 @@
  * qs_common.h -> qs_deserialize_common.h -> qs_mt_deserialization.h -> qs_functions.cpp
  * qs_common.h -> qs_serialize_common.h -> qs_serialization_stream.h -> qs_functions.cpp
  * qs_common.h -> qs_deserialize_common.h -> qs_deserialization_stream.h -> qs_functions.cpp
+ * qs_common.h -> qs_deserialize_common.h -> qs_deserialization_lazy.h -> qs_functions.cpp
  */
 
 // [[Rcpp::interfaces(r, cpp)]]
@@ -55,7 +57,11 @@ bool is_big_endian() {
 
 // [[Rcpp::export(rng = false, invisible=true)]]
 double qsave(SEXP const x, const std::string & file, const std::string preset="high", const std::string algorithm="zstd",
-               const int compress_level=4L, const int shuffle_control=15L, const bool check_hash=true, const int nthreads=1) {
+               const int compress_level=4L, const int shuffle_control=15L, const bool check_hash=true, const int nthreads=1,
+               const bool block_index=false, const bool dedup=false, const bool preserve_sharing=false, const bool block_checksum=false) {
+#ifdef USE_LAZY_READ
+  detach_lazy_sources(file);
+#endif
   std::ofstream myFile(R_ExpandFileName(file.c_str()), std::ios::out | std::ios::binary);
   if(!myFile) {
     throw std::runtime_error("For file " + file + ": " + FILE_SAVE_ERR_MSG);
@@ -63,6 +69,15 @@ double qsave(SEXP const x, const std::string & file, const std::string preset="h
   myFile.exceptions(std::ofstream::failbit | std::ofstream::badbit);
   std::streampos origin = myFile.tellp();
   QsMetadata qm(preset, algorithm, compress_level, shuffle_control, check_hash);
+  qm.block_index = block_index && qm.compress_algorithm <= static_cast<unsigned char>(compalg::lz4hc);
+  // block checksums replace the hash of the uncompressed data, which is computed on the main thread
+  qm.block_checksum = block_checksum && qm.compress_algorithm <= static_cast<unsigned char>(compalg::lz4hc);
+  if(qm.block_checksum) {
+    qm.check_hash = false;
+    qm.format_version = CURRENT_FORMAT_VER;
+  }
+  qm.dedup = dedup;
+  qm.preserve_sharing = preserve_sharing;
   qm.writeToFile(myFile);
   std::streampos header_end_pos = myFile.tellp();
   writeSize8(myFile, 0); // number of compressed blocks
@@ -87,46 +102,58 @@ double qsave(SEXP const x, const std::string & file, const std::string preset="h
         writeObject(&vbuf, x);
         vbuf.flush();
         // std::cout << vbuf.xenv.digest() << std::endl;
+        if(qm.block_checksum) writeSize8(myFile, vbuf.checksums.digest());
         if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+        if(qm.block_index) vbuf.index.write(myFile);
         clength = vbuf.number_of_blocks;
       } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4)) {
         CompressBuffer<std::ofstream, lz4_compress_env> vbuf(myFile, qm);
         writeObject(&vbuf, x);
         vbuf.flush();
         // std::cout << vbuf.xenv.digest() << std::endl;
+        if(qm.block_checksum) writeSize8(myFile, vbuf.checksums.digest());
         if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+        if(qm.block_index) vbuf.index.write(myFile);
         clength = vbuf.number_of_blocks;
       } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4hc)) {
         CompressBuffer<std::ofstream, lz4hc_compress_env> vbuf(myFile, qm);
         writeObject(&vbuf, x);
         vbuf.flush();
         // std::cout << vbuf.xenv.digest() << std::endl;
+        if(qm.block_checksum) writeSize8(myFile, vbuf.checksums.digest());
         if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+        if(qm.block_index) vbuf.index.write(myFile);
         clength = vbuf.number_of_blocks;
       } else {
         throw std::runtime_error("invalid compression algorithm selected");
       }
     } else {
       if(qm.compress_algorithm == static_cast<unsigned char>(compalg::zstd)) {
-        CompressBuffer_MT<zstd_compress_env> vbuf(&myFile, qm, nthreads);
+        CompressBuffer_MT<std::ofstream, zstd_compress_env> vbuf(&myFile, qm, nthreads);
         writeObject(&vbuf, x);
         vbuf.flush();
         vbuf.ctc.finish();
+        if(qm.block_checksum) writeSize8(myFile, vbuf.ctc.checksums.digest());
         if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+        if(qm.block_index) vbuf.ctc.index.write(myFile);
         clength = vbuf.number_of_blocks;
       } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4)) {
-        CompressBuffer_MT<lz4_compress_env> vbuf(&myFile, qm, nthreads);
+        CompressBuffer_MT<std::ofstream, lz4_compress_env> vbuf(&myFile, qm, nthreads);
         writeObject(&vbuf, x);
         vbuf.flush();
         vbuf.ctc.finish();
+        if(qm.block_checksum) writeSize8(myFile, vbuf.ctc.checksums.digest());
         if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+        if(qm.block_index) vbuf.ctc.index.write(myFile);
         clength = vbuf.number_of_blocks;
       } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4hc)) {
-        CompressBuffer_MT<lz4hc_compress_env> vbuf(&myFile, qm, nthreads);
+        CompressBuffer_MT<std::ofstream, lz4hc_compress_env> vbuf(&myFile, qm, nthreads);
         writeObject(&vbuf, x);
         vbuf.flush();
         vbuf.ctc.finish();
+        if(qm.block_checksum) writeSize8(myFile, vbuf.ctc.checksums.digest());
         if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+        if(qm.block_index) vbuf.ctc.index.write(myFile);
         clength = vbuf.number_of_blocks;
       } else {
         throw std::runtime_error("invalid compression algorithm selected");
@@ -143,13 +170,16 @@ double qsave(SEXP const x, const std::string & file, const std::string preset="h
 // [[Rcpp::export(rng = false)]]
 double c_qsave(SEXP const x, const std::string & file, const std::string preset, const std::string algorithm,
              const int compress_level, const int shuffle_control, const bool check_hash, const int nthreads) {
-  return qsave(x, file, preset, algorithm, compress_level, shuffle_control,check_hash, nthreads);
+  return qsave(x, file, preset, algorithm, compress_level, shuffle_control,check_hash, nthreads, false);
 }
 
 
 // [[Rcpp::export(rng = false, invisible=true)]]
 double qsave_fd(SEXP const x, const int fd, const std::string preset="high", const std::string algorithm="zstd",
-                  const int compress_level=4L, const int shuffle_control=15, const bool check_hash=true) {
+                  const int compress_level=4L, const int shuffle_control=15, const bool check_hash=true, const int nthreads=1) {
+#ifdef USE_LAZY_READ
+  detach_lazy_sources(fd);
+#endif
   fd_wrapper myFile(fd);
   QsMetadata qm(preset, algorithm, compress_level, shuffle_control, check_hash);
   qm.writeToFile(myFile);
@@ -165,23 +195,47 @@ double qsave_fd(SEXP const x, const int fd, const std::string preset="high", con
     CompressBufferStream<uncompressed_streamWrite<fd_wrapper>> vbuf(sw, qm);
     writeObject(&vbuf, x);
     if(qm.check_hash) writeSize4(myFile, vbuf.sobj.xenv.digest());
-  } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::zstd)) {
-    CompressBuffer<fd_wrapper, zstd_compress_env> vbuf(myFile, qm);
-    writeObject(&vbuf, x);
-    vbuf.flush();
-    if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
-  } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4)) {
-    CompressBuffer<fd_wrapper, lz4_compress_env> vbuf(myFile, qm);
-    writeObject(&vbuf, x);
-    vbuf.flush();
-    if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
-  } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4hc)) {
-    CompressBuffer<fd_wrapper, lz4hc_compress_env> vbuf(myFile, qm);
-    writeObject(&vbuf, x);
-    vbuf.flush();
-    if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+  } else if(nthreads <= 1) {
+    if(qm.compress_algorithm == static_cast<unsigned char>(compalg::zstd)) {
+      CompressBuffer<fd_wrapper, zstd_compress_env> vbuf(myFile, qm);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+    } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4)) {
+      CompressBuffer<fd_wrapper, lz4_compress_env> vbuf(myFile, qm);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+    } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4hc)) {
+      CompressBuffer<fd_wrapper, lz4hc_compress_env> vbuf(myFile, qm);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+    } else {
+      throw std::runtime_error("invalid compression algorithm selected");
+    }
   } else {
-    throw std::runtime_error("invalid compression algorithm selected");
+    if(qm.compress_algorithm == static_cast<unsigned char>(compalg::zstd)) {
+      CompressBuffer_MT<fd_wrapper, zstd_compress_env> vbuf(&myFile, qm, nthreads);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      vbuf.ctc.finish();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+    } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4)) {
+      CompressBuffer_MT<fd_wrapper, lz4_compress_env> vbuf(&myFile, qm, nthreads);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      vbuf.ctc.finish();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+    } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4hc)) {
+      CompressBuffer_MT<fd_wrapper, lz4hc_compress_env> vbuf(&myFile, qm, nthreads);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      vbuf.ctc.finish();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+    } else {
+      throw std::runtime_error("invalid compression algorithm selected");
+    }
   }
   myFile.flush();
   return static_cast<double>(myFile.bytes_processed);
@@ -189,7 +243,8 @@ double qsave_fd(SEXP const x, const int fd, const std::string preset="high", con
 
 // [[Rcpp::export(rng = false, invisible=true)]]
 double qsave_handle(SEXP const x, SEXP const handle, const std::string preset="high",
-                    const std::string algorithm="zstd", const int compress_level=4L, const int shuffle_control=15, const bool check_hash=true) {
+                    const std::string algorithm="zstd", const int compress_level=4L, const int shuffle_control=15, const bool check_hash=true,
+                    const int nthreads=1) {
 #ifdef _WIN32
   HANDLE h = R_ExternalPtrAddr(handle);
   handle_wrapper myFile(h);
@@ -207,23 +262,47 @@ double qsave_handle(SEXP const x, SEXP const handle, const std::string preset="h
     CompressBufferStream<uncompressed_streamWrite<handle_wrapper>> vbuf(sw, qm);
     writeObject(&vbuf, x);
     if(qm.check_hash) writeSize4(myFile, vbuf.sobj.xenv.digest());
-  } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::zstd)) {
-    CompressBuffer<handle_wrapper, zstd_compress_env> vbuf(myFile, qm);
-    writeObject(&vbuf, x);
-    vbuf.flush();
-    if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
-  } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4)) {
-    CompressBuffer<handle_wrapper, lz4_compress_env> vbuf(myFile, qm);
-    writeObject(&vbuf, x);
-    vbuf.flush();
-    if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
-  } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4hc)) {
-    CompressBuffer<handle_wrapper, lz4hc_compress_env> vbuf(myFile, qm);
-    writeObject(&vbuf, x);
-    vbuf.flush();
-    if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+  } else if(nthreads <= 1) {
+    if(qm.compress_algorithm == static_cast<unsigned char>(compalg::zstd)) {
+      CompressBuffer<handle_wrapper, zstd_compress_env> vbuf(myFile, qm);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+    } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4)) {
+      CompressBuffer<handle_wrapper, lz4_compress_env> vbuf(myFile, qm);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+    } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4hc)) {
+      CompressBuffer<handle_wrapper, lz4hc_compress_env> vbuf(myFile, qm);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+    } else {
+      throw std::runtime_error("invalid compression algorithm selected");
+    }
   } else {
-    throw std::runtime_error("invalid compression algorithm selected");
+    if(qm.compress_algorithm == static_cast<unsigned char>(compalg::zstd)) {
+      CompressBuffer_MT<handle_wrapper, zstd_compress_env> vbuf(&myFile, qm, nthreads);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      vbuf.ctc.finish();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+    } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4)) {
+      CompressBuffer_MT<handle_wrapper, lz4_compress_env> vbuf(&myFile, qm, nthreads);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      vbuf.ctc.finish();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+    } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4hc)) {
+      CompressBuffer_MT<handle_wrapper, lz4hc_compress_env> vbuf(&myFile, qm, nthreads);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      vbuf.ctc.finish();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+    } else {
+      throw std::runtime_error("invalid compression algorithm selected");
+    }
   }
   return static_cast<double>(myFile.bytes_processed);
 #else
@@ -233,7 +312,7 @@ double qsave_handle(SEXP const x, SEXP const handle, const std::string preset="h
 
 // [[Rcpp::export(rng = false)]]
 RawVector qserialize(SEXP const x, const std::string preset="high", const std::string algorithm="zstd",
-                     const int compress_level=4L, const int shuffle_control=15, const bool check_hash=true) {
+                     const int compress_level=4L, const int shuffle_control=15, const bool check_hash=true, const int nthreads=1) {
   vec_wrapper myFile;
   QsMetadata qm(preset, algorithm, compress_level, shuffle_control, check_hash);
   qm.writeToFile(myFile);
@@ -253,40 +332,234 @@ RawVector qserialize(SEXP const x, const std::string preset="high", const std::s
     writeObject(&vbuf, x);
     if(qm.check_hash) writeSize4(myFile, vbuf.sobj.xenv.digest());
     clength = sw.bytes_written;
-  } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::zstd)) {
-    CompressBuffer<vec_wrapper, zstd_compress_env> vbuf(myFile, qm);
-    writeObject(&vbuf, x);
-    vbuf.flush();
-    if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
-    clength = vbuf.number_of_blocks;
-  } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4)) {
-    CompressBuffer<vec_wrapper, lz4_compress_env> vbuf(myFile, qm);
-    writeObject(&vbuf, x);
-    vbuf.flush();
-    if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
-    clength = vbuf.number_of_blocks;
-  } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4hc)) {
-    CompressBuffer<vec_wrapper, lz4hc_compress_env> vbuf(myFile, qm);
-    writeObject(&vbuf, x);
-    vbuf.flush();
-    if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
-    clength = vbuf.number_of_blocks;
+  } else if(nthreads <= 1) {
+    if(qm.compress_algorithm == static_cast<unsigned char>(compalg::zstd)) {
+      CompressBuffer<vec_wrapper, zstd_compress_env> vbuf(myFile, qm);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+      clength = vbuf.number_of_blocks;
+    } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4)) {
+      CompressBuffer<vec_wrapper, lz4_compress_env> vbuf(myFile, qm);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+      clength = vbuf.number_of_blocks;
+    } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4hc)) {
+      CompressBuffer<vec_wrapper, lz4hc_compress_env> vbuf(myFile, qm);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+      clength = vbuf.number_of_blocks;
+    } else {
+      throw std::runtime_error("invalid compression algorithm selected");
+    }
   } else {
-    throw std::runtime_error("invalid compression algorithm selected");
+    if(qm.compress_algorithm == static_cast<unsigned char>(compalg::zstd)) {
+      CompressBuffer_MT<vec_wrapper, zstd_compress_env> vbuf(&myFile, qm, nthreads);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      vbuf.ctc.finish();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+      clength = vbuf.number_of_blocks;
+    } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4)) {
+      CompressBuffer_MT<vec_wrapper, lz4_compress_env> vbuf(&myFile, qm, nthreads);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      vbuf.ctc.finish();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+      clength = vbuf.number_of_blocks;
+    } else if(qm.compress_algorithm == static_cast<unsigned char>(compalg::lz4hc)) {
+      CompressBuffer_MT<vec_wrapper, lz4hc_compress_env> vbuf(&myFile, qm, nthreads);
+      writeObject(&vbuf, x);
+      vbuf.flush();
+      vbuf.ctc.finish();
+      if(qm.check_hash) writeSize4(myFile, vbuf.xenv.digest());
+      clength = vbuf.number_of_blocks;
+    } else {
+      throw std::runtime_error("invalid compression algorithm selected");
+    }
   }
   myFile.writeDirect(reinterpret_cast<char*>(&clength), 8, filesize_offset);
-  myFile.shrink();
-  return RawVector(myFile.buffer.begin(), myFile.buffer.end());
+  Protect_Tracker pt = Protect_Tracker();
+  SEXP output = PROTECT(Rf_allocVector(RAWSXP, myFile.bytes_processed)); pt++;
+  myFile.copy_and_clear(reinterpret_cast<char*>(RAW(output)));
+  return RawVector(output);
 }
 
 // [[Rcpp::export(rng = false)]]
 RawVector c_qserialize(SEXP const x, const std::string preset, const std::string algorithm,
                      const int compress_level, const int shuffle_control, const bool check_hash) {
-  return qserialize(x, preset, algorithm, compress_level, shuffle_control, check_hash);
+  return qserialize(x, preset, algorithm, compress_level, shuffle_control, check_hash, 1);
+}
+
+SEXP c_qattributes(const std::string & file, const bool use_alt_rep, const bool strict, const int nthreads);
+
+// the attributes of the top level object, to find the elements for select
+// the names follow the elements, so they need a pass over the file before the elements are read
+// with a block index, the blocks that only hold skipped vector data are passed over without being decompressed
+// otherwise qattributes decompresses the whole file an extra time
+SEXP selectAttributes(const std::string & file, const bool strict, const int nthreads) {
+#ifdef USE_LAZY_READ
+  std::shared_ptr<lazy_source> source = std::make_shared<lazy_source>(file);
+  if(source->data_end != 0) {
+    if(source->qm.compress_algorithm == 0) {
+      Data_Context_Lazy<zstd_decompress_env> dc(source, false);
+      return processAttributes(&dc);
+    } else {
+      Data_Context_Lazy<lz4_decompress_env> dc(source, false);
+      return processAttributes(&dc);
+    }
+  }
+#endif
+  return c_qattributes(file, false, strict, nthreads);
+}
+
+// converts select (names) or elements (1-based indices) of qread to 0-based indices of top level list elements
+std::vector<uint64_t> selectedElements(const std::string & file, SEXP select, SEXP elements, const bool strict, const int nthreads) {
+  if(select != R_NilValue && elements != R_NilValue) throw std::runtime_error("Only one of select and elements can be used");
+  std::vector<uint64_t> selected;
+  if(elements != R_NilValue) {
+    if(TYPEOF(elements) != INTSXP && TYPEOF(elements) != REALSXP) throw std::runtime_error("elements must be a numeric vector");
+    R_xlen_t len = Rf_xlength(elements);
+    selected.resize(len);
+    for(R_xlen_t i=0; i<len; i++) {
+      double e = TYPEOF(elements) == INTSXP ? (INTEGER(elements)[i] == NA_INTEGER ? NA_REAL : INTEGER(elements)[i]) : REAL(elements)[i];
+      if(ISNAN(e) || e < 1 || e > R_XLEN_T_MAX) throw std::runtime_error("elements must be positive indices");
+      selected[i] = static_cast<uint64_t>(e) - 1;
+    }
+    return selected;
+  }
+  if(TYPEOF(select) != STRSXP) throw std::runtime_error("select must be a character vector");
+  Protect_Tracker pt = Protect_Tracker();
+  SEXP attributes = PROTECT(selectAttributes(file, strict, nthreads)); pt++;
+  SEXP names = R_NilValue;
+  if(TYPEOF(attributes) == VECSXP) {
+    SEXP attribute_names = Rf_getAttrib(attributes, R_NamesSymbol);
+    for(R_xlen_t i=0; i<Rf_xlength(attributes); i++) {
+      if(strcmp(CHAR(STRING_ELT(attribute_names, i)), "names") == 0) names = VECTOR_ELT(attributes, i);
+    }
+  }
+  if(TYPEOF(names) != STRSXP) throw std::runtime_error("select can only be used with named lists and data.frames");
+  std::unordered_map<std::string, uint64_t> name_index;
+  for(R_xlen_t i=Rf_xlength(names)-1; i>=0; i--) {
+    name_index[Rf_translateCharUTF8(STRING_ELT(names, i))] = i; // first match
+  }
+  R_xlen_t len = Rf_xlength(select);
+  selected.resize(len);
+  for(R_xlen_t i=0; i<len; i++) {
+    if(STRING_ELT(select, i) == NA_STRING) throw std::runtime_error("select cannot contain NA");
+    std::string name = Rf_translateCharUTF8(STRING_ELT(select, i));
+    auto match = name_index.find(name);
+    if(match == name_index.end()) throw std::runtime_error("Element not found: " + name);
+    selected[i] = match->second;
+  }
+  return selected;
+}
+
+// reads an object from data in memory, used by qread_ptr and qread with use_mmap
+// compressed blocks are decompressed in place without being copied
+SEXP qread_mem(mem_wrapper & myFile, const bool use_alt_rep, const bool strict, const int nthreads, const std::string & file = "",
+               const std::vector<uint64_t> * const selected = nullptr) {
+  Protect_Tracker pt = Protect_Tracker();
+  QsMetadata qm = QsMetadata::create(myFile);
+  if(qm.compress_algorithm == 3) { // zstd_stream
+    ZSTD_streamRead<mem_wrapper> sr(myFile, qm);
+    Data_Context_Stream<ZSTD_streamRead<mem_wrapper>> dc(sr, qm, use_alt_rep);
+    SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
+    validate_data(qm, myFile, *reinterpret_cast<uint32_t*>(dc.dsc.hash_reserve.data()), dc.dsc.xenv.digest(), dc.dsc.decompressed_bytes_read, strict, file);
+    return ret;
+  } else if(qm.compress_algorithm == 4) { // uncompressed
+    uncompressed_streamRead<mem_wrapper> sr(myFile, qm);
+    Data_Context_Stream<uncompressed_streamRead<mem_wrapper>> dc(sr, qm, use_alt_rep);
+    SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
+    validate_data(qm, myFile, *reinterpret_cast<uint32_t*>(dc.dsc.hash_reserve.data()), dc.dsc.xenv.digest(), dc.dsc.decompressed_bytes_read, strict, file);
+    return ret;
+  } else if(nthreads <= 1 || qm.clength == 0) {
+    if(qm.compress_algorithm == 0) {
+      Data_Context<mem_wrapper, zstd_decompress_env> dc(myFile, qm, use_alt_rep);
+      SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
+      validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict, file);
+      return ret;
+    } else if(qm.compress_algorithm == 1 || qm.compress_algorithm == 2) {
+      Data_Context<mem_wrapper, lz4_decompress_env> dc(myFile, qm, use_alt_rep);
+      SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
+      validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict, file);
+      return ret;
+    } else {
+      throw std::runtime_error("Invalid compression algorithm in file");
+    }
+  } else {
+    // block offsets in memory are found with a cheap scan, so blocks can be decompressed out of order
+    BlockIndex index;
+    uint64_t data_end = scanBlockOffsets(myFile, qm, index);
+    mem_block_source source(myFile);
+    if(qm.compress_algorithm == 0) {
+      Data_Context_MT<mem_wrapper, zstd_decompress_env, Data_Thread_Context_Indexed<zstd_decompress_env, mem_block_source>> dc(myFile, qm, use_alt_rep, nthreads, source, std::move(index));
+      SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
+      dc.dtc.finish();
+      myFile.bytes_processed = data_end;
+      validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), 0, strict, file);
+      return ret;
+    } else if(qm.compress_algorithm == 1 || qm.compress_algorithm == 2) {
+      Data_Context_MT<mem_wrapper, lz4_decompress_env, Data_Thread_Context_Indexed<lz4_decompress_env, mem_block_source>> dc(myFile, qm, use_alt_rep, nthreads, source, std::move(index));
+      SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
+      dc.dtc.finish();
+      myFile.bytes_processed = data_end;
+      validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), 0, strict, file);
+      return ret;
+    } else {
+      throw std::runtime_error("Invalid compression algorithm in file");
+    }
+  }
 }
 
 // [[Rcpp::export(rng = false)]]
-SEXP qread(const std::string & file, const bool use_alt_rep=false, const bool strict=false, const int nthreads=1) {
+SEXP qread(const std::string & file, const bool use_alt_rep=false, const bool strict=false, const int nthreads=1,
+           const bool use_mmap=false, const bool lazy=false, SEXP select=R_NilValue, SEXP elements=R_NilValue) {
+  std::vector<uint64_t> selected_elements;
+  const std::vector<uint64_t> * selected = nullptr;
+  if(select != R_NilValue || elements != R_NilValue) {
+    selected_elements = selectedElements(file, select, elements, strict, nthreads);
+    selected = &selected_elements;
+  }
+#ifdef USE_LAZY_READ
+  // files without a block index are read normally
+  if(lazy) {
+    std::shared_ptr<lazy_source> source = std::make_shared<lazy_source>(file);
+    if(source->data_end != 0) {
+      register_lazy_source(source);
+      Protect_Tracker pt = Protect_Tracker();
+      SEXP ret;
+      uint64_t bytes_read;
+      if(source->qm.compress_algorithm == 0) {
+        Data_Context_Lazy<zstd_decompress_env> dc(source, use_alt_rep);
+        ret = PROTECT(readObject(&dc, selected)); pt++;
+        bytes_read = dc.position();
+      } else {
+        Data_Context_Lazy<lz4_decompress_env> dc(source, use_alt_rep);
+        ret = PROTECT(readObject(&dc, selected)); pt++;
+        bytes_read = dc.position();
+      }
+      if(bytes_read != source->index.total_size()) {
+        std::string msg = "In file " + file + ": Computed object length does not match recorded object length";
+        if(strict) {
+          throw std::runtime_error(msg);
+        } else {
+          Rcerr << "Warning: " << msg << std::endl;
+        }
+      }
+      return ret;
+    }
+  }
+#endif
+#ifndef _WIN32
+  if(use_mmap) {
+    mmap_file map(file);
+    mem_wrapper myFile(map.map, map.length);
+    return qread_mem(myFile, use_alt_rep, strict, nthreads, file, selected);
+  }
+#endif
   std::ifstream myFile(R_ExpandFileName(file.c_str()), std::ios::in | std::ios::binary);
   if(!myFile) {
     throw std::runtime_error("For file " + file + ": " + FILE_READ_ERR_MSG);
@@ -297,14 +570,14 @@ SEXP qread(const std::string & file, const bool use_alt_rep=false, const bool st
   if(qm.compress_algorithm == 3) { // zstd_stream
     ZSTD_streamRead<std::ifstream> sr(myFile, qm);
     Data_Context_Stream<ZSTD_streamRead<std::ifstream>> dc(sr, qm, use_alt_rep);
-    SEXP ret = PROTECT(processBlock(&dc)); pt++;
+    SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
     validate_data(qm, myFile, *reinterpret_cast<uint32_t*>(dc.dsc.hash_reserve.data()), dc.dsc.xenv.digest(), dc.dsc.decompressed_bytes_read, strict, file);
     myFile.close();
     return ret;
   } else if(qm.compress_algorithm == 4) { // uncompressed
     uncompressed_streamRead<std::ifstream> sr(myFile, qm);
     Data_Context_Stream<uncompressed_streamRead<std::ifstream>> dc(sr, qm, use_alt_rep);
-    SEXP ret = PROTECT(processBlock(&dc)); pt++;
+    SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
     validate_data(qm, myFile, *reinterpret_cast<uint32_t*>(dc.dsc.hash_reserve.data()), dc.dsc.xenv.digest(), dc.dsc.decompressed_bytes_read, strict, file);
     myFile.close();
     return ret;
@@ -312,13 +585,13 @@ SEXP qread(const std::string & file, const bool use_alt_rep=false, const bool st
     if(nthreads <= 1 || qm.clength == 0) {
       if(qm.compress_algorithm == 0) {
         Data_Context<std::ifstream, zstd_decompress_env> dc(myFile, qm, use_alt_rep);
-        SEXP ret = PROTECT(processBlock(&dc)); pt++;
+        SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
         validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict, file);
         myFile.close();
         return ret;
       } else if(qm.compress_algorithm == 1 || qm.compress_algorithm == 2) {
         Data_Context<std::ifstream, lz4_decompress_env> dc(myFile, qm, use_alt_rep);
-        SEXP ret = PROTECT(processBlock(&dc)); pt++;
+        SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
         validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict, file);
         myFile.close();
         return ret;
@@ -326,16 +599,42 @@ SEXP qread(const std::string & file, const bool use_alt_rep=false, const bool st
         throw std::runtime_error("Invalid compression algorithm in file");
       }
     } else {
+#ifndef _WIN32
+      BlockIndex index;
+      uint64_t data_end = qm.block_index ? readBlockIndexTrailer(myFile, qm, index) : 0;
+      if(data_end != 0) {
+        pread_block_source source(file);
+        if(qm.compress_algorithm == 0) {
+          Data_Context_MT<std::ifstream, zstd_decompress_env, Data_Thread_Context_Indexed<zstd_decompress_env, pread_block_source>> dc(myFile, qm, use_alt_rep, nthreads, source, std::move(index));
+          SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
+          dc.dtc.finish();
+          myFile.seekg(data_end);
+          validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), 0, strict, file);
+          myFile.close();
+          return ret;
+        } else if(qm.compress_algorithm == 1 || qm.compress_algorithm == 2) {
+          Data_Context_MT<std::ifstream, lz4_decompress_env, Data_Thread_Context_Indexed<lz4_decompress_env, pread_block_source>> dc(myFile, qm, use_alt_rep, nthreads, source, std::move(index));
+          SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
+          dc.dtc.finish();
+          myFile.seekg(data_end);
+          validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), 0, strict, file);
+          myFile.close();
+          return ret;
+        } else {
+          throw std::runtime_error("Invalid compression algorithm in file");
+        }
+      }
+#endif
       if(qm.compress_algorithm == 0) {
-        Data_Context_MT<zstd_decompress_env> dc(myFile, qm, use_alt_rep, nthreads);
-        SEXP ret = PROTECT(processBlock(&dc)); pt++;
+        Data_Context_MT<std::ifstream, zstd_decompress_env> dc(myFile, qm, use_alt_rep, nthreads);
+        SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
         dc.dtc.finish();
         validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), 0, strict, file);
         myFile.close();
         return ret;
       } else if(qm.compress_algorithm == 1 || qm.compress_algorithm == 2) {
-        Data_Context_MT<lz4_decompress_env> dc(myFile, qm, use_alt_rep, nthreads);
-        SEXP ret = PROTECT(processBlock(&dc)); pt++;
+        Data_Context_MT<std::ifstream, lz4_decompress_env> dc(myFile, qm, use_alt_rep, nthreads);
+        SEXP ret = PROTECT(readObject(&dc, selected)); pt++;
         dc.dtc.finish();
         validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), 0, strict, file);
         myFile.close();
@@ -389,14 +688,14 @@ SEXP c_qattributes(const std::string & file, const bool use_alt_rep=false, const
       }
     } else {
       if(qm.compress_algorithm == 0) {
-        Data_Context_MT<zstd_decompress_env> dc(myFile, qm, use_alt_rep, nthreads);
+        Data_Context_MT<std::ifstream, zstd_decompress_env> dc(myFile, qm, use_alt_rep, nthreads);
         SEXP ret = PROTECT(processAttributes(&dc)); pt++;
         dc.dtc.finish();
         validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), 0, strict, file);
         myFile.close();
         return ret;
       } else if(qm.compress_algorithm == 1 || qm.compress_algorithm == 2) {
-        Data_Context_MT<lz4_decompress_env> dc(myFile, qm, use_alt_rep, nthreads);
+        Data_Context_MT<std::ifstream, lz4_decompress_env> dc(myFile, qm, use_alt_rep, nthreads);
         SEXP ret = PROTECT(processAttributes(&dc)); pt++;
         dc.dtc.finish();
         validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), 0, strict, file);
@@ -411,11 +710,19 @@ SEXP c_qattributes(const std::string & file, const bool use_alt_rep=false, const
 
 // [[Rcpp::export(rng = false)]]
 SEXP c_qread(const std::string & file, const bool use_alt_rep, const bool strict, const int nthreads) {
-  return qread(file, use_alt_rep, strict, nthreads);
+  return qread(file, use_alt_rep, strict, nthreads, false, false);
+}
+
+// registers the ALTREP classes used by qread with lazy = TRUE
+// [[Rcpp::init]]
+void qs_init_altrep(DllInfo* dll) {
+#ifdef USE_LAZY_READ
+  init_lazy_altrep_classes(dll);
+#endif
 }
 
 // [[Rcpp::export(rng = false)]]
-SEXP qread_fd(const int fd, const bool use_alt_rep=false, const bool strict=false) {
+SEXP qread_fd(const int fd, const bool use_alt_rep=false, const bool strict=false, const int nthreads=1) {
   fd_wrapper myFile(fd);
   Protect_Tracker pt = Protect_Tracker();
   QsMetadata qm  = QsMetadata::create(myFile);
@@ -431,23 +738,41 @@ SEXP qread_fd(const int fd, const bool use_alt_rep=false, const bool strict=fals
     SEXP ret = PROTECT(processBlock(&dc)); pt++;
     validate_data(qm, myFile, *reinterpret_cast<uint32_t*>(dc.dsc.hash_reserve.data()), dc.dsc.xenv.digest(), dc.dsc.decompressed_bytes_read, strict);
     return ret;
-  } else if(qm.compress_algorithm == 0) {
-    Data_Context<fd_wrapper, zstd_decompress_env> dc(myFile, qm, use_alt_rep);
-    SEXP ret = PROTECT(processBlock(&dc)); pt++;
-    validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict);
-    return ret;
-  } else if(qm.compress_algorithm == 1 || qm.compress_algorithm == 2) {
-    Data_Context<fd_wrapper, lz4_decompress_env> dc(myFile, qm, use_alt_rep);
-    SEXP ret = PROTECT(processBlock(&dc)); pt++;
-    validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict);
-    return ret;
+  } else if(nthreads <= 1 || qm.clength == 0) {
+    if(qm.compress_algorithm == 0) {
+      Data_Context<fd_wrapper, zstd_decompress_env> dc(myFile, qm, use_alt_rep);
+      SEXP ret = PROTECT(processBlock(&dc)); pt++;
+      validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict);
+      return ret;
+    } else if(qm.compress_algorithm == 1 || qm.compress_algorithm == 2) {
+      Data_Context<fd_wrapper, lz4_decompress_env> dc(myFile, qm, use_alt_rep);
+      SEXP ret = PROTECT(processBlock(&dc)); pt++;
+      validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict);
+      return ret;
+    } else {
+      throw std::runtime_error("Invalid compression algorithm in file");
+    }
   } else {
-    throw std::runtime_error("Invalid compression algorithm in file");
+    if(qm.compress_algorithm == 0) {
+      Data_Context_MT<fd_wrapper, zstd_decompress_env> dc(myFile, qm, use_alt_rep, nthreads);
+      SEXP ret = PROTECT(processBlock(&dc)); pt++;
+      dc.dtc.finish();
+      validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), 0, strict);
+      return ret;
+    } else if(qm.compress_algorithm == 1 || qm.compress_algorithm == 2) {
+      Data_Context_MT<fd_wrapper, lz4_decompress_env> dc(myFile, qm, use_alt_rep, nthreads);
+      SEXP ret = PROTECT(processBlock(&dc)); pt++;
+      dc.dtc.finish();
+      validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), 0, strict);
+      return ret;
+    } else {
+      throw std::runtime_error("Invalid compression algorithm in file");
+    }
   }
 }
 
 // [[Rcpp::export(rng = false)]]
-SEXP qread_handle(SEXP const handle, const bool use_alt_rep=false, const bool strict=false) {
+SEXP qread_handle(SEXP const handle, const bool use_alt_rep=false, const bool strict=false, const int nthreads=1) {
 #ifdef _WIN32
   HANDLE h = R_ExternalPtrAddr(handle);
   handle_wrapper myFile(h);
@@ -465,18 +790,36 @@ SEXP qread_handle(SEXP const handle, const bool use_alt_rep=false, const bool st
     SEXP ret = PROTECT(processBlock(&dc)); pt++;
     validate_data(qm, myFile, *reinterpret_cast<uint32_t*>(dc.dsc.hash_reserve.data()), dc.dsc.xenv.digest(), dc.dsc.decompressed_bytes_read, strict);
     return ret;
-  } else if(qm.compress_algorithm == 0) {
-    Data_Context<handle_wrapper, zstd_decompress_env> dc(myFile, qm, use_alt_rep);
-    SEXP ret = PROTECT(processBlock(&dc)); pt++;
-    validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict);
-    return ret;
-  } else if(qm.compress_algorithm == 1 || qm.compress_algorithm == 2) {
-    Data_Context<handle_wrapper, lz4_decompress_env> dc(myFile, qm, use_alt_rep);
-    SEXP ret = PROTECT(processBlock(&dc)); pt++;
-    validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict);
-    return ret;
+  } else if(nthreads <= 1 || qm.clength == 0) {
+    if(qm.compress_algorithm == 0) {
+      Data_Context<handle_wrapper, zstd_decompress_env> dc(myFile, qm, use_alt_rep);
+      SEXP ret = PROTECT(processBlock(&dc)); pt++;
+      validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict);
+      return ret;
+    } else if(qm.compress_algorithm == 1 || qm.compress_algorithm == 2) {
+      Data_Context<handle_wrapper, lz4_decompress_env> dc(myFile, qm, use_alt_rep);
+      SEXP ret = PROTECT(processBlock(&dc)); pt++;
+      validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict);
+      return ret;
+    } else {
+      throw std::runtime_error("Invalid compression algorithm in file");
+    }
   } else {
-    throw std::runtime_error("Invalid compression algorithm in file");
+    if(qm.compress_algorithm == 0) {
+      Data_Context_MT<handle_wrapper, zstd_decompress_env> dc(myFile, qm, use_alt_rep, nthreads);
+      SEXP ret = PROTECT(processBlock(&dc)); pt++;
+      dc.dtc.finish();
+      validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), 0, strict);
+      return ret;
+    } else if(qm.compress_algorithm == 1 || qm.compress_algorithm == 2) {
+      Data_Context_MT<handle_wrapper, lz4_decompress_env> dc(myFile, qm, use_alt_rep, nthreads);
+      SEXP ret = PROTECT(processBlock(&dc)); pt++;
+      dc.dtc.finish();
+      validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), 0, strict);
+      return ret;
+    } else {
+      throw std::runtime_error("Invalid compression algorithm in file");
+    }
   }
 #else
   throw std::runtime_error("Windows handle only available on windows");
@@ -484,50 +827,24 @@ SEXP qread_handle(SEXP const handle, const bool use_alt_rep=false, const bool st
 }
 
 // [[Rcpp::export(rng = false)]]
-SEXP qread_ptr(SEXP const pointer, const double length, const bool use_alt_rep=false, const bool strict=false) {
+SEXP qread_ptr(SEXP const pointer, const double length, const bool use_alt_rep=false, const bool strict=false, const int nthreads=1) {
   void * vp = R_ExternalPtrAddr(pointer);
   mem_wrapper myFile(vp, static_cast<uint64_t>(length));
-  Protect_Tracker pt = Protect_Tracker();
-  QsMetadata qm = QsMetadata::create(myFile);
-  if(qm.compress_algorithm == 3) { // zstd_stream
-    ZSTD_streamRead<mem_wrapper> sr(myFile, qm);
-    Data_Context_Stream<ZSTD_streamRead<mem_wrapper>> dc(sr, qm, use_alt_rep);
-    SEXP ret = PROTECT(processBlock(&dc)); pt++;
-    validate_data(qm, myFile, *reinterpret_cast<uint32_t*>(dc.dsc.hash_reserve.data()), dc.dsc.xenv.digest(), dc.dsc.decompressed_bytes_read, strict);
-    return ret;
-  } else if(qm.compress_algorithm == 4) { // uncompressed
-    uncompressed_streamRead<mem_wrapper> sr(myFile, qm);
-    Data_Context_Stream<uncompressed_streamRead<mem_wrapper>> dc(sr, qm, use_alt_rep);
-    SEXP ret = PROTECT(processBlock(&dc)); pt++;
-    validate_data(qm, myFile, *reinterpret_cast<uint32_t*>(dc.dsc.hash_reserve.data()), dc.dsc.xenv.digest(), dc.dsc.decompressed_bytes_read, strict);
-    return ret;
-  } else if(qm.compress_algorithm == 0) {
-    Data_Context<mem_wrapper, zstd_decompress_env> dc(myFile, qm, use_alt_rep);
-    SEXP ret = PROTECT(processBlock(&dc)); pt++;
-    validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict);
-    return ret;
-  } else if(qm.compress_algorithm == 1 || qm.compress_algorithm == 2) {
-    Data_Context<mem_wrapper, lz4_decompress_env> dc(myFile, qm, use_alt_rep);
-    SEXP ret = PROTECT(processBlock(&dc)); pt++;
-    validate_data(qm, myFile, qm.check_hash ? readSize4(myFile) : 0, dc.xenv.digest(), dc.blocks_read, strict);
-    return ret;
-  } else {
-    throw std::runtime_error("Invalid compression algorithm in file");
-  }
+  return qread_mem(myFile, use_alt_rep, strict, nthreads);
 }
 
 // [[Rcpp::export(rng = false)]]
-SEXP qdeserialize(SEXP const x, const bool use_alt_rep=false, const bool strict=false) {
+SEXP qdeserialize(SEXP const x, const bool use_alt_rep=false, const bool strict=false, const int nthreads=1) {
   void * p = reinterpret_cast<void*>(RAW(x));
   double dlen = static_cast<double>(Rf_xlength(x));
   Protect_Tracker pt = Protect_Tracker();
   SEXP pointer = PROTECT(R_MakeExternalPtr(p, R_NilValue, R_NilValue)); pt++;
-  return qread_ptr(pointer, dlen, use_alt_rep, strict);
+  return qread_ptr(pointer, dlen, use_alt_rep, strict, nthreads);
 }
 
 // [[Rcpp::export(rng = false)]]
 SEXP c_qdeserialize(SEXP const x, const bool use_alt_rep, const bool strict) {
-  return qdeserialize(x, use_alt_rep, strict);
+  return qdeserialize(x, use_alt_rep, strict, 1);
 }
 
 // void c_qsave_fd(SEXP x, std::string scon, int shuffle_control, bool check_hash, std::string popen_mode) {
@@ -629,19 +946,27 @@ RObject qdump(const std::string & file) {
       cbfun = LZ4_compressBound_fun;
       errfun = LZ4_isError_fun;
     }
-    if(qm.check_hash) readable_bytes -= 4;
+    readable_bytes -= qm.hash_size();
+    if(qm.block_index) readable_bytes -= BlockIndex::trailer_size(totalsize);
     std::vector<char> zblock(cbfun(BLOCKSIZE));
     std::vector<char> block(BLOCKSIZE);
     List output = List(totalsize);
     List input = List(totalsize);
     IntegerVector block_sizes(totalsize);
     IntegerVector zblock_sizes(totalsize);
+    LogicalVector block_checksums_valid(qm.block_checksum ? totalsize : 0);
+    BlockChecksums checksums;
     xxhash_env xenv = xxhash_env();
     for(uint64_t i=0; i<totalsize; i++) {
       uint64_t zsize = readSize4(myFile);
       if(static_cast<uint64_t>(myFile.gcount()) != 4) break;
       myFile.read(zblock.data(), zsize);
       if(static_cast<uint64_t>(myFile.gcount()) != zsize) break;
+      if(qm.block_checksum) {
+        uint64_t recorded_checksum = readSize8(myFile);
+        block_checksums_valid[i] = BlockChecksums::compute(zblock.data(), zsize) == recorded_checksum;
+        checksums.add(recorded_checksum);
+      }
       uint64_t block_size = dfun(block.data(), BLOCKSIZE, zblock.data(), zsize);
       if(!errfun(block_size)) {
         xenv.update(block.data(), block_size);
@@ -657,10 +982,22 @@ RObject qdump(const std::string & file) {
     outvec["compressed_block_sizes"] = zblock_sizes;
     outvec["decompressed_block_sizes"] = block_sizes;
     outvec["computed_hash"] = std::to_string(xenv.digest());
+    if(qm.block_checksum) {
+      outvec["block_checksums_valid"] = block_checksums_valid;
+      outvec["computed_checksum_digest"] = std::to_string(checksums.digest());
+      outvec["recorded_checksum_digest"] = std::to_string(readSize8(myFile));
+    }
     if(qm.check_hash) {
       uint32_t recorded_hash = readSize4(myFile);
       outvec["recorded_hash"] = std::to_string(recorded_hash);
     }
+    if(qm.block_index) {
+      BlockIndex index;
+      bool index_ok = index.read(myFile, totalsize);
+      outvec["block_index_valid"] = index_ok;
+      outvec["compressed_block_offsets"] = NumericVector(index.zoffsets.begin(), index.zoffsets.end());
+      outvec["decompressed_block_offsets"] = NumericVector(index.offsets.begin(), index.offsets.end());
+    }
     outvec["compressed_data"] = input;
     outvec["uncompressed_data"] = output;
   } else {
@@ -851,6 +1188,17 @@ bool set_trust_promises(bool value) {
   return previous_value;
 }
 
+// lookups, hits and entries of the CHARSXP caches of all reads since the last call, which resets them
+// [[Rcpp::export(rng = false)]]
+NumericVector charsxp_cache_stats() {
+  NumericVector output = NumericVector::create(static_cast<double>(charsxp_cache_totals.lookups),
+                                               static_cast<double>(charsxp_cache_totals.hits),
+                                               static_cast<double>(charsxp_cache_totals.entries));
+  Rf_setAttrib(output, R_NamesSymbol, CharacterVector::create("lookups", "hits", "entries"));
+  charsxp_cache_totals = CharSXP_Cache_Stats();
+  return output;
+}
+
 
 // std::vector<unsigned char> brotli_compress_raw(RawVector x, int compress_level) {
 //   uint64_t zsize = BrotliEncoderMaxCompressedSize(x.size());
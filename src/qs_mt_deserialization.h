@@ -21,6 +21,10 @@
 #include "qs_common.h"
 #include "qs_deserialize_common.h"
 
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+
 ////////////////////////////////////////////////////////////////
 // de-serialization functions
 ////////////////////////////////////////////////////////////////
@@ -55,134 +59,468 @@
 //   }
 // };
 
-template <class decompress_env>
+// a decompressed block that a worker thread unshuffles into the vector outp (see blosc_unshuffle_range)
+struct unshuffle_task {
+  char * outp;
+  uint64_t vector_len;
+  uint64_t bytesoftype;
+  uint64_t vector_offset; // offset of the block in the shuffled vector
+};
+
+// Blocks are read sequentially by the worker threads in turn and handed to the main thread in order
+// Threads park on condition variables while waiting for their turn to read or for a task from the main thread
+template <class stream_reader, class decompress_env>
 struct Data_Thread_Context {
-  std::ifstream & myFile;
-  decompress_env denv; // default constructor
+  stream_reader & myFile;
+  std::vector<decompress_env> denvs; // one per thread, each holds a reusable decompression context
   const unsigned int nthreads;
 
   uint64_t blocks_total;
-  std::atomic<uint64_t> blocks_read;
-  std::atomic<uint64_t>  blocks_processed;
+  uint64_t blocks_read; // guarded by mutex
+  uint64_t blocks_processed; // main thread only
+  const bool block_checksum;
+  BlockChecksums checksums; // filled in block order by the worker thread whose turn it is to read
 
-  std::vector<bool> primary_block = std::vector<bool>(nthreads, true);
+  std::vector<uint8_t> primary_block = std::vector<uint8_t>(nthreads, 1); // not vector<bool>, each thread writes its own element
   std::vector< std::vector<char> > zblocks; // one per thread
   std::vector< std::vector<char> > data_blocks; // one per thread
   std::vector< std::vector<char> > data_blocks2; // one per thread
   std::pair<char*, uint64_t> data_pass; // default constructor
 
-  std::vector< std::atomic<char*> > block_pointers;
-  std::vector< std::atomic<uint64_t> > block_sizes;
-  std::vector< std::atomic<uint8_t> > data_task;
+  std::vector<char*> block_pointers;
+  std::vector<uint64_t> block_sizes;
+  std::vector<unshuffle_task> unshuffle_tasks;
+  std::vector<uint8_t> data_task; // guarded by mutex
+  std::vector<uint8_t> block_ready; // guarded by mutex
+  bool done; // guarded by mutex
+  std::string error_message; // guarded by mutex
+  std::mutex mutex;
+  std::condition_variable worker_cv;
+  std::condition_variable main_cv;
   std::vector<std::thread> threads;
 
-  Data_Thread_Context(std::ifstream & mf, unsigned int nt, QsMetadata qm) :
-    myFile(mf), nthreads(nt), blocks_total(qm.clength), blocks_read(0), blocks_processed(0),
-    zblocks(std::vector< std::vector<char> >(nt, std::vector<char>(this->denv.compressBound(BLOCKSIZE)))),
+  Data_Thread_Context(stream_reader & mf, unsigned int nt, QsMetadata qm) :
+    myFile(mf), denvs(nt), nthreads(nt), blocks_total(qm.clength), blocks_read(0), blocks_processed(0), block_checksum(qm.block_checksum),
+    zblocks(std::vector< std::vector<char> >(nt, std::vector<char>(this->denvs[0].compressBound(BLOCKSIZE)))),
     data_blocks(std::vector< std::vector<char> >(nt, std::vector<char>(BLOCKSIZE))),
-    data_blocks2(std::vector<std::vector<char> >(nt, std::vector<char>(BLOCKSIZE))) {
-    block_pointers = std::vector< std::atomic<char*> >(nt);
-    for(unsigned int i=0; i<nt; i++) {
-      block_pointers[i] = nullptr;
-    }
-    block_sizes = std::vector< std::atomic<uint64_t> >(nt);
-    for(unsigned int i=0; i<nt; i++) {
-      block_sizes[i] = 0;
-    }
-    data_task = std::vector< std::atomic<uint8_t> >(nt);
-    for(unsigned int i=0; i<nt; i++) {
-      data_task[i] = 0;
-    }
+    data_blocks2(std::vector<std::vector<char> >(nt, std::vector<char>(BLOCKSIZE))),
+    block_pointers(std::vector<char*>(nt, nullptr)),
+    block_sizes(std::vector<uint64_t>(nt, 0)),
+    unshuffle_tasks(nt),
+    data_task(std::vector<uint8_t>(nt, 0)),
+    block_ready(std::vector<uint8_t>(nt, 0)),
+    done(false) {
     for (unsigned int i = 0; i < nt; i++) {
       threads.push_back(std::thread(&Data_Thread_Context::worker_thread, this, i));
     }
   }
 
+  ~Data_Thread_Context() {
+    join();
+  }
+
+  void set_error(const char * msg) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(error_message.empty()) error_message = msg;
+    done = true;
+  }
+
   void worker_thread(unsigned int thread_id) {
     std::array<char,4> zsize_ar;
     for(uint64_t i=thread_id; i < blocks_total; i += nthreads) {
-      // tout << thread_id << " " << i <<  "begin\n" << std::flush;
-      while(blocks_read != i) {
-        std::this_thread::yield();
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        worker_cv.wait(lock, [this, i]{ return blocks_read == i || done; });
+        if(done) return;
       }
-      myFile.read(zsize_ar.data(), 4);
-      uint32_t zsize = unaligned_cast<uint32_t>(zsize_ar.data(),0);
-      myFile.read(zblocks[thread_id].data(), zsize);
-      blocks_read++;
-
-      // task marching orders from main thread
-      // 0 = wait
-      // 1 = nothing (main thread will use block as is)
-      // 2 = memcpy
-      // it seems to be slower to check for task order and direct decompress
-      // rather than just assuming we should memcpy
-      // if(data_task[thread_id] == 2) {
-      //   char* dp = data_pass.first;
-      //   data_task[thread_id] = 0;
-      //   decompFun(dp, BLOCKSIZE, zblocks[thread_id].data(), zsize);
-      // } else {
-      if(primary_block[thread_id]) {
-        block_sizes[thread_id] = denv.decompress(data_blocks[thread_id].data(), BLOCKSIZE, zblocks[thread_id].data(), zsize);
-        block_pointers[thread_id] = data_blocks[thread_id].data();
-      } else {
-        block_sizes[thread_id] = denv.decompress(data_blocks2[thread_id].data(), BLOCKSIZE, zblocks[thread_id].data(), zsize);
-        block_pointers[thread_id] = data_blocks2[thread_id].data();
+      try {
+        if(read_allow(myFile, zsize_ar.data(), 4) != 4) throw std::runtime_error("Unexpected end of file while reading next block");
+        uint32_t zsize = unaligned_cast<uint32_t>(zsize_ar.data(),0);
+        if(zsize > zblocks[thread_id].size()) throw std::runtime_error("Malformed compress block: compressed size > compress bound");
+        if(read_allow(myFile, zblocks[thread_id].data(), zsize) != zsize) throw std::runtime_error("Unexpected end of file while reading next block");
+        uint64_t recorded_checksum = 0;
+        uint64_t recorded_digest = 0;
+        if(block_checksum) {
+          recorded_checksum = readSize8(myFile);
+          checksums.add(recorded_checksum);
+          if(i + 1 == blocks_total) recorded_digest = readSize8(myFile);
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          blocks_read++;
+        }
+        worker_cv.notify_all();
+        if(block_checksum) {
+          BlockChecksums::verify(zblocks[thread_id].data(), zsize, recorded_checksum, i);
+          if(i + 1 == blocks_total) BlockChecksums::verify_digest(checksums.digest(), recorded_digest);
+        }
+
+        // task marching orders from main thread
+        // 0 = wait
+        // 1 = nothing (main thread will use block as is)
+        // 2 = memcpy
+        // 3 = unshuffle, the main thread does not wait for it to complete
+        if(primary_block[thread_id]) {
+          block_sizes[thread_id] = denvs[thread_id].decompress(data_blocks[thread_id].data(), BLOCKSIZE, zblocks[thread_id].data(), zsize);
+          block_pointers[thread_id] = data_blocks[thread_id].data();
+        } else {
+          block_sizes[thread_id] = denvs[thread_id].decompress(data_blocks2[thread_id].data(), BLOCKSIZE, zblocks[thread_id].data(), zsize);
+          block_pointers[thread_id] = data_blocks2[thread_id].data();
+        }
+      } catch(std::exception & e) {
+        set_error(e.what());
+        worker_cv.notify_all();
+        main_cv.notify_all();
+        return;
       }
-      while(data_task[thread_id] == 0) {
-        std::this_thread::yield();
+      uint8_t task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        block_ready[thread_id] = 1;
+        main_cv.notify_all();
+        worker_cv.wait(lock, [this, thread_id]{ return data_task[thread_id] != 0 || done; });
+        if(done) return;
+        task = data_task[thread_id];
+        block_ready[thread_id] = 0;
       }
-      if(data_task[thread_id] == 1) {
+      if(task == 1) {
         data_pass.first = block_pointers[thread_id];
         data_pass.second = block_sizes[thread_id];
-        data_task[thread_id] = 0;
-      } else { // data task == 2
-        char* dp = data_pass.first;
-        std::memcpy(dp, block_pointers[thread_id], block_sizes[thread_id]);
+      } else if(task == 2) {
+        std::memcpy(data_pass.first, block_pointers[thread_id], block_sizes[thread_id]);
+      } else { // data task == 3
+        const unshuffle_task & ut = unshuffle_tasks[thread_id];
+        blosc_unshuffle_range(block_pointers[thread_id], ut.outp, ut.vector_len, ut.bytesoftype, ut.vector_offset, block_sizes[thread_id]);
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
         data_task[thread_id] = 0;
       }
-      // }
-
+      main_cv.notify_all();
       primary_block[thread_id] = !primary_block[thread_id];
     }
-    // tout << thread_id << " finished thread for loop\n" << std::flush;
+  }
+
+  void join() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    worker_cv.notify_all();
+    for(unsigned int i=0; i < threads.size(); i++) {
+      if(threads[i].joinable()) threads[i].join();
+    }
   }
 
   void finish() {
+    join();
+  }
+
+  // hands a task to the worker thread holding the next block and waits until it is completed
+  void run_task(const uint8_t task) {
+    if(blocks_processed >= blocks_total) throw std::runtime_error("Unexpected end of file");
+    uint64_t current_block = blocks_processed % nthreads;
     blocks_processed++;
-    for(unsigned int i=0; i < nthreads; i++) {
-      // tout << "join called " << i << "\n" << std::flush;
-      threads[i].join();
+    std::unique_lock<std::mutex> lock(mutex);
+    data_task[current_block] = task;
+    worker_cv.notify_all();
+    main_cv.wait(lock, [this, current_block]{ return data_task[current_block] == 0 || done; });
+    if(data_task[current_block] != 0) {
+      throw std::runtime_error(error_message.empty() ? "Error in worker thread" : error_message);
     }
   }
 
   std::pair<char*, uint64_t> get_block_ptr() {
-    uint64_t current_block = blocks_processed % nthreads;
-    blocks_processed++;
-    while(data_task[current_block] != 0) std::this_thread::yield();
-    data_task[current_block] = 1;
-    while(data_task[current_block] != 0) std::this_thread::yield();
-    char* temp_ptr = data_pass.first;
-    uint64_t temp_size = data_pass.second;
-    return std::pair<char*, uint64_t>(temp_ptr, temp_size);
+    run_task(1);
+    return data_pass;
   }
 
   void decompress_data_direct(char* bpointer) {
+    data_pass.first = bpointer;
+    run_task(2);
+  }
+
+  // waits until the next block is decompressed, without handing it to the main thread
+  std::pair<char*, uint64_t> peek_block() {
+    if(blocks_processed >= blocks_total) throw std::runtime_error("Unexpected end of file");
+    uint64_t current_block = blocks_processed % nthreads;
+    std::unique_lock<std::mutex> lock(mutex);
+    main_cv.wait(lock, [this, current_block]{ return (block_ready[current_block] && data_task[current_block] == 0) || done; });
+    if(!block_ready[current_block] || data_task[current_block] != 0) {
+      throw std::runtime_error(error_message.empty() ? "Error in worker thread" : error_message);
+    }
+    return std::pair<char*, uint64_t>(block_pointers[current_block], block_sizes[current_block]);
+  }
+
+  // the worker thread holding the next block unshuffles all of it into the vector outp, while the main thread moves on to the following blocks
+  // the block starts at vector_offset in the shuffled vector (see blosc_unshuffle_range)
+  void unshuffle_block(char* outp, const uint64_t vector_len, const uint64_t bytesoftype, const uint64_t vector_offset) {
+    if(blocks_processed >= blocks_total) throw std::runtime_error("Unexpected end of file");
     uint64_t current_block = blocks_processed % nthreads;
     blocks_processed++;
-    while(data_task[current_block] != 0) std::this_thread::yield();
-    data_pass.first = bpointer;
-    data_task[current_block] = 2;
-    while(data_task[current_block] != 0) std::this_thread::yield();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      unshuffle_tasks[current_block] = unshuffle_task{outp, vector_len, bytesoftype, vector_offset};
+      data_task[current_block] = 3;
+    }
+    worker_cv.notify_all();
+  }
+
+  // waits until the blocks handed out with unshuffle_block are unshuffled
+  void wait_for_tasks() {
+    std::unique_lock<std::mutex> lock(mutex);
+    main_cv.wait(lock, [this]{ return std::all_of(data_task.begin(), data_task.end(), [](uint8_t t){ return t == 0; }) || done; });
+    if(!std::all_of(data_task.begin(), data_task.end(), [](uint8_t t){ return t == 0; })) {
+      throw std::runtime_error(error_message.empty() ? "Error in worker thread" : error_message);
+    }
+  }
+};
+
+////////////////////////////////////////////////////////////////
+// block index de-serialization
+////////////////////////////////////////////////////////////////
+
+#ifndef _WIN32
+// positional reads of compressed blocks, safe to call from multiple threads at once
+struct pread_block_source {
+  int fd;
+  pread_block_source(const std::string & file) : fd(open(R_ExpandFileName(file.c_str()), O_RDONLY)) {
+    if(fd == -1) throw std::runtime_error("error creating file descriptor");
+  }
+  ~pread_block_source() {
+    close(fd);
+  }
+  pread_block_source(const pread_block_source &) = delete;
+  pread_block_source & operator=(const pread_block_source &) = delete;
+  void read_at(char * dst, uint64_t count, uint64_t offset) {
+    while(count > 0) {
+      ssize_t bytes_read = pread(fd, dst, count, offset);
+      if(bytes_read < 0 && errno == EINTR) continue;
+      if(bytes_read <= 0) throw std::runtime_error("error reading compressed block from file");
+      dst += bytes_read;
+      count -= bytes_read;
+      offset += bytes_read;
+    }
+  }
+  // offset is the offset of the 4 byte zsize prefix; returns a pointer to the compressed block
+  const char * read_block(const uint64_t offset, std::vector<char> & zbuffer, uint32_t & zsize) {
+    std::array<char,4> zsize_ar;
+    read_at(zsize_ar.data(), 4, offset);
+    zsize = unaligned_cast<uint32_t>(zsize_ar.data(),0);
+    if(zsize > zbuffer.size()) throw std::runtime_error("Malformed compress block: compressed size > compress bound");
+    read_at(zbuffer.data(), zsize, offset + 4);
+    return zbuffer.data();
+  }
+  uint64_t read_checksum(const uint64_t offset) {
+    std::array<char,8> checksum_ar;
+    read_at(checksum_ar.data(), 8, offset);
+    return unaligned_cast<uint64_t>(checksum_ar.data(), 0);
+  }
+};
+#endif
+
+// compressed blocks held in memory, decompressed directly from the buffer without copying
+struct mem_block_source {
+  const char * start;
+  const uint64_t length;
+  mem_block_source(const mem_wrapper & myFile) : start(myFile.start), length(myFile.available_bytes) {}
+  const char * read_block(const uint64_t offset, std::vector<char> & zbuffer, uint32_t & zsize) {
+    if(offset + 4 > length) throw std::runtime_error("Unexpected end of file while reading next block");
+    zsize = unaligned_cast<uint32_t>(start, offset);
+    if(zsize > zbuffer.size()) throw std::runtime_error("Malformed compress block: compressed size > compress bound");
+    if(offset + 4 + zsize > length) throw std::runtime_error("Unexpected end of file while reading next block");
+    return start + offset + 4;
+  }
+  uint64_t read_checksum(const uint64_t offset) {
+    if(offset + 8 > length) throw std::runtime_error("Unexpected end of file while reading next block");
+    return unaligned_cast<uint64_t>(start, offset);
+  }
+};
+
+// locates the compressed blocks in memory by following the zsize prefixes, so a block index trailer is not needed
+// only the compressed offsets are filled in; returns the position where the data (blocks and block checksum digest) end
+inline uint64_t scanBlockOffsets(const mem_wrapper & myFile, const QsMetadata & qm, BlockIndex & index) {
+  uint64_t offset = myFile.bytes_processed;
+  for(uint64_t i=0; i < qm.clength; i++) {
+    if(offset + 4 > myFile.available_bytes) throw std::runtime_error("Unexpected end of file while reading next block");
+    uint32_t zsize = unaligned_cast<uint32_t>(myFile.start, offset);
+    index.zoffsets.push_back(offset);
+    offset += 4 + static_cast<uint64_t>(zsize) + qm.block_checksum_size();
+  }
+  if(qm.block_checksum) offset += 8; // checksum digest
+  if(offset > myFile.available_bytes) throw std::runtime_error("Unexpected end of file while reading next block");
+  return offset;
+}
+
+// reads the block index trailer at the end of the file and restores the read position
+// returns the position where the data (blocks and block checksum digest) end, or 0 if the index could not be read
+inline uint64_t readBlockIndexTrailer(std::ifstream & myFile, const QsMetadata & qm, BlockIndex & index) {
+  std::streampos current = myFile.tellg();
+  myFile.seekg(0, std::ios::end);
+  uint64_t file_size = myFile.tellg();
+  uint64_t trailer_size = BlockIndex::trailer_size(qm.clength);
+  uint64_t data_end = 0;
+  if(file_size >= QS_HEADER_SIZE + trailer_size + (qm.check_hash ? 4 : 0)) {
+    myFile.seekg(file_size - trailer_size);
+    if(index.read(myFile, qm.clength)) {
+      data_end = file_size - trailer_size - (qm.check_hash ? 4 : 0);
+      if(qm.clength > 0 && index.zoffsets.back() + 4 > data_end) data_end = 0;
+    }
+  }
+  myFile.clear();
+  myFile.seekg(current);
+  return data_end;
+}
+
+// Worker threads claim any block, read it through the block index and decompress it into a ring of decompressed blocks
+// The main thread consumes blocks from the ring in order; block i is stored in ring slot i % ring_size
+template <class decompress_env, class block_source>
+struct Data_Thread_Context_Indexed {
+  block_source & source;
+  BlockIndex index;
+  const unsigned int nthreads;
+  const uint64_t blocks_total;
+  const uint64_t ring_size;
+
+  std::vector<decompress_env> denvs; // one per thread
+  std::vector< std::vector<char> > zblocks; // one per thread
+  std::vector< std::vector<char> > ring;
+  std::vector<uint64_t> ring_block_sizes;
+  std::vector<bool> ring_ready;
+  const bool block_checksum;
+  BlockChecksums checksums; // each element is written by the worker thread reading the block
+  uint64_t recorded_digest; // written by the worker thread reading the last block
+
+  // guarded by mutex
+  uint64_t blocks_claimed; // next block to be read by a worker
+  uint64_t blocks_released; // blocks that the main thread is finished with
+  bool done;
+  std::string error_message;
+
+  uint64_t blocks_processed; // main thread only
+  std::mutex mutex;
+  std::condition_variable worker_cv;
+  std::condition_variable main_cv;
+  std::vector<std::thread> threads;
+
+  Data_Thread_Context_Indexed(block_source & src, unsigned int nt, QsMetadata qm, BlockIndex idx) :
+    source(src), index(std::move(idx)), nthreads(nt), blocks_total(qm.clength), ring_size(2*nt + 1),
+    denvs(nt),
+    zblocks(std::vector< std::vector<char> >(nt, std::vector<char>(this->denvs[0].compressBound(BLOCKSIZE)))),
+    ring(std::vector< std::vector<char> >(ring_size, std::vector<char>(BLOCKSIZE))),
+    ring_block_sizes(std::vector<uint64_t>(ring_size, 0)),
+    ring_ready(std::vector<bool>(ring_size, false)),
+    block_checksum(qm.block_checksum), recorded_digest(0),
+    blocks_claimed(0), blocks_released(0), done(false), blocks_processed(0) {
+    if(block_checksum) checksums.checksums.resize(blocks_total);
+    for (unsigned int i = 0; i < nt; i++) {
+      threads.push_back(std::thread(&Data_Thread_Context_Indexed::worker_thread, this, i));
+    }
+  }
+
+  ~Data_Thread_Context_Indexed() {
+    join();
+  }
+
+  void worker_thread(unsigned int thread_id) {
+    while(true) {
+      uint64_t block;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        worker_cv.wait(lock, [this]{ return done || blocks_claimed >= blocks_total || blocks_claimed < blocks_released + ring_size; });
+        if(done || blocks_claimed >= blocks_total) return;
+        block = blocks_claimed++;
+      }
+      uint64_t slot = block % ring_size;
+      try {
+        uint32_t zsize;
+        const char * zdata = source.read_block(index.zoffsets[block], zblocks[thread_id], zsize);
+        if(block_checksum) {
+          uint64_t checksum_offset = index.zoffsets[block] + 4 + zsize;
+          checksums.checksums[block] = source.read_checksum(checksum_offset);
+          BlockChecksums::verify(zdata, zsize, checksums.checksums[block], block);
+          if(block + 1 == blocks_total) recorded_digest = source.read_checksum(checksum_offset + 8);
+        }
+        uint64_t block_size = denvs[thread_id].decompress(ring[slot].data(), BLOCKSIZE, zdata, zsize);
+        std::lock_guard<std::mutex> lock(mutex);
+        ring_block_sizes[slot] = block_size;
+        ring_ready[slot] = true;
+      } catch(std::exception & e) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(error_message.empty()) error_message = e.what();
+        done = true;
+        worker_cv.notify_all();
+      }
+      main_cv.notify_one();
+    }
+  }
+
+  void join() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    worker_cv.notify_all();
+    for(unsigned int i=0; i < threads.size(); i++) {
+      if(threads[i].joinable()) threads[i].join();
+    }
+  }
+
+  // the checksum digest can only be checked once every block has been read
+  void finish() {
+    join();
+    if(block_checksum && blocks_processed == blocks_total) BlockChecksums::verify_digest(checksums.digest(), recorded_digest);
   }
+
+  std::pair<char*, uint64_t> get_block_ptr() {
+    if(blocks_processed >= blocks_total) throw std::runtime_error("Unexpected end of file");
+    uint64_t slot = blocks_processed % ring_size;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      // the previous block handed to the main thread is no longer in use
+      blocks_released = blocks_processed;
+      worker_cv.notify_all();
+      main_cv.wait(lock, [this, slot]{ return ring_ready[slot] || !error_message.empty(); });
+      if(!ring_ready[slot]) throw std::runtime_error(error_message);
+      ring_ready[slot] = false;
+    }
+    blocks_processed++;
+    return std::pair<char*, uint64_t>(ring[slot].data(), ring_block_sizes[slot]);
+  }
+
+  void decompress_data_direct(char* bpointer) {
+    std::pair<char*, uint64_t> block = get_block_ptr();
+    std::memcpy(bpointer, block.first, block.second);
+  }
+
+  // waits until the next block is decompressed, without consuming it
+  std::pair<char*, uint64_t> peek_block() {
+    if(blocks_processed >= blocks_total) throw std::runtime_error("Unexpected end of file");
+    uint64_t slot = blocks_processed % ring_size;
+    std::unique_lock<std::mutex> lock(mutex);
+    blocks_released = blocks_processed;
+    worker_cv.notify_all();
+    main_cv.wait(lock, [this, slot]{ return ring_ready[slot] || !error_message.empty(); });
+    if(!ring_ready[slot]) throw std::runtime_error(error_message);
+    return std::pair<char*, uint64_t>(ring[slot].data(), ring_block_sizes[slot]);
+  }
+
+  // blocks are already decompressed ahead into the ring by any worker, so the main thread unshuffles the block itself
+  void unshuffle_block(char* outp, const uint64_t vector_len, const uint64_t bytesoftype, const uint64_t vector_offset) {
+    std::pair<char*, uint64_t> block = get_block_ptr();
+    blosc_unshuffle_range(block.first, outp, vector_len, bytesoftype, vector_offset, block.second);
+  }
+
+  void wait_for_tasks() {}
 };
 
-template <class decompress_env>
+template <class stream_reader, class decompress_env, class thread_context = Data_Thread_Context<stream_reader, decompress_env>>
 struct Data_Context_MT {
   QsMetadata qm;
-  std::ifstream & myFile;
-  Data_Thread_Context<decompress_env> dtc;
+  stream_reader & myFile;
+  thread_context dtc;
   xxhash_env xenv;
-  std::unordered_map<uint32_t, SEXP> object_ref_hash;
+  IndexToObjectMap object_ref_hash;
   bool use_alt_rep_bool;
 
   std::vector<uint8_t> shuffleblock = std::vector<uint8_t>(256);
@@ -190,8 +528,12 @@ struct Data_Context_MT {
   uint64_t block_size = 0;
   uint64_t data_offset = 0;
 
-  Data_Context_MT(std::ifstream & mf, QsMetadata qm, bool use_alt_rep, unsigned int nthreads) :
+  Data_Context_MT(stream_reader & mf, QsMetadata qm, bool use_alt_rep, unsigned int nthreads) :
     qm(qm), myFile(mf), dtc(mf, nthreads-1, qm), use_alt_rep_bool(use_alt_rep) {}
+  // block index reader
+  template <class block_source>
+  Data_Context_MT(stream_reader & mf, QsMetadata qm, bool use_alt_rep, unsigned int nthreads, block_source & source, BlockIndex index) :
+    qm(qm), myFile(mf), dtc(source, nthreads-1, qm, std::move(index)), use_alt_rep_bool(use_alt_rep) {}
   void readHeader(qstype & object_type, uint64_t & r_array_len) {
     if(data_offset >= block_size) decompress_block();
     char* header = block_data;
@@ -219,6 +561,14 @@ struct Data_Context_MT {
     if(qm.check_hash) xenv.update(block_data, block_size);
     // tout << "main thread decompress block " << (void *)block_data << " " << block_size << "\n" << std::flush;
   }
+  // advances past data that is not needed without copying it
+  void skipBlockData(uint64_t data_size) {
+    while(data_size > block_size - data_offset) {
+      data_size -= block_size - data_offset;
+      decompress_block();
+    }
+    data_offset += data_size;
+  }
   void getBlockData(char* outp, uint64_t data_size) {
     // tout << "main thread get block data " << data_size << " " << block_size << " " << data_offset << "\n" << std::flush;
     if(data_size <= block_size - data_offset) {
@@ -254,11 +604,29 @@ struct Data_Context_MT {
     getBlockData(&temp_string[0], data_size);
     return temp_string;
   }
+  // the vector is unshuffled straight from each decompressed block into its place (see blosc_unshuffle_range)
+  // blocks that hold only data of the vector are unshuffled by the worker thread that decompressed them
   void getShuffleBlockData(char* outp, uint64_t data_size, uint64_t bytesoftype) {
     if(data_size >= MIN_SHUFFLE_ELEMENTS) {
-      if(data_size > shuffleblock.size()) shuffleblock.resize(data_size);
-      getBlockData(reinterpret_cast<char*>(shuffleblock.data()), data_size);
-      blosc_unshuffle(shuffleblock.data(), reinterpret_cast<uint8_t*>(outp), data_size, bytesoftype);
+      uint64_t bytes_accounted = 0;
+      while(bytes_accounted < data_size) {
+        if(data_offset >= block_size) {
+          std::pair<char*, uint64_t> next_block = dtc.peek_block();
+          if(next_block.second > 0 && data_size - bytes_accounted >= next_block.second) {
+            dtc.unshuffle_block(outp, data_size, bytesoftype, bytes_accounted);
+            if(qm.check_hash) xenv.update(next_block.first, next_block.second);
+            bytes_accounted += next_block.second;
+            continue;
+          }
+          decompress_block();
+        }
+        if(block_size == 0) throw std::runtime_error("Unexpected end of file while reading next block");
+        uint64_t add_length = std::min<uint64_t>(data_size - bytes_accounted, block_size - data_offset);
+        blosc_unshuffle_range(block_data + data_offset, outp, data_size, bytesoftype, bytes_accounted, add_length);
+        data_offset += add_length;
+        bytes_accounted += add_length;
+      }
+      dtc.wait_for_tasks();
     } else if(data_size > 0) {
       getBlockData(outp, data_size);
     }
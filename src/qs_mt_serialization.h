@@ -24,6 +24,7 @@
 #include <iostream>
 #include <sstream>
 #include <mutex>
+#include <condition_variable>
 
 
 // #define QS_MT_SERIALIZATION_DEBUG
@@ -65,161 +66,209 @@ std::mutex ThreadStream::_mutex_threadstream{};
 // multi-thread serialization functions
 ////////////////////////////////////////////////////////////////
 
-template <class compress_env> 
+// a part of a shuffled vector that the worker thread gathers into its block before compressing it (see blosc_shuffle_range)
+struct shuffle_segment {
+  const char * data; // start of the vector
+  uint64_t vector_len;
+  uint64_t bytesoftype;
+  uint64_t vector_offset; // offset of the part in the shuffled vector
+  uint64_t offset; // offset in the block
+  uint64_t len;
+};
+
+// Block handoff between the main thread and the worker threads
+// Threads park on condition variables while waiting for data, for a free block or for their turn to write
+template <class stream_writer, class compress_env> 
 struct Compress_Thread_Context {
-  std::ofstream* myFile;
-  compress_env cenv;
+  stream_writer & myFile;
+  std::vector<compress_env> cenvs; // one per thread, each holds a reusable compression context
+  xxhash_env * xenv; // nullptr unless check_hash
   
-  std::atomic<uint64_t> blocks_total;
-  std::atomic<uint64_t> blocks_written;
+  uint64_t blocks_total; // main thread only
+  uint64_t blocks_hashed; // main thread only
+  uint64_t blocks_written; // guarded by mutex
   
   unsigned int nthreads;
   int compress_level;  
-  std::atomic<bool> done;
+  bool block_index;
+  bool block_checksum;
+  bool done; // guarded by mutex
+  std::string error_message; // guarded by mutex
+
+  // filled by the worker threads in block order, only read after finish()
+  BlockIndex index;
+  BlockChecksums checksums;
   
   std::vector<std::vector<char> > zblocks; // one per thread
   std::vector<std::vector<char> > data_blocks; // one per thread
   std::vector< std::pair<const char*, uint64_t> > block_pointers;
+  std::vector< std::vector<shuffle_segment> > shuffle_segments; // one per thread
   
-  std::vector< std::atomic<bool> > data_ready;
+  std::vector<bool> data_ready; // guarded by mutex
+  std::mutex mutex;
+  std::condition_variable worker_cv;
+  std::condition_variable main_cv;
   std::vector<std::thread> threads;
   
   void worker_thread(unsigned int thread_id) {
-    while(!done) {
-      // check if data ready and then compress
-
-      // tout << "waiting on data " << blocks_written << " thread " << thread_id << "\n" << std::flush;
-
-      while (!data_ready[thread_id]) {
-        std::this_thread::yield();
-        if(done) break;
-      }; if(done) break;
-      
-      uint64_t zsize = cenv.compress(zblocks[thread_id].data(), zblocks[thread_id].size(), block_pointers[thread_id].first, block_pointers[thread_id].second, compress_level);
-      data_ready[thread_id] = false;
-
-      // tout << "data ready to write " << blocks_written << " thread " << thread_id << "\n" << std::flush;
-
-      // write to file
-      while (blocks_written % nthreads != thread_id) {
-        std::this_thread::yield();
+    while(true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        worker_cv.wait(lock, [this, thread_id]{ return data_ready[thread_id] || done || !error_message.empty(); });
+        // remaining data is still compressed after done is set
+        if(!data_ready[thread_id] || !error_message.empty()) break;
       }
-      writeSize4(*myFile, zsize);
-      myFile->write(zblocks[thread_id].data(), zsize);
-      blocks_written += 1;
-
-      // tout << "blocks written " << blocks_written << " thread " << thread_id << "\n" << std::flush;
-
-    }
-
-    // tout << "exit main loop " << blocks_written << " thread " << thread_id << "\n" << std::flush;
-
-    
-    // final check to see if any remaining data
-    if(data_ready[thread_id]) {
-      uint64_t zsize = cenv.compress(zblocks[thread_id].data(), zblocks[thread_id].size(), block_pointers[thread_id].first, block_pointers[thread_id].second, compress_level);
-
-      // tout << "final data ready to write " << blocks_written << " thread " << thread_id << "\n" << std::flush;
-
-      // write to file
-      while (blocks_written % nthreads != thread_id) {
-        std::this_thread::yield();
+      try {
+        for(const shuffle_segment & seg : shuffle_segments[thread_id]) {
+          blosc_shuffle_range(PointerSource{seg.data}, data_blocks[thread_id].data() + seg.offset, seg.vector_len, seg.bytesoftype, seg.vector_offset, seg.len);
+        }
+        uint64_t zsize = cenvs[thread_id].compress(zblocks[thread_id].data(), zblocks[thread_id].size(), block_pointers[thread_id].first, block_pointers[thread_id].second, compress_level);
+        uint64_t block_size = block_pointers[thread_id].second;
+        uint64_t checksum = block_checksum ? BlockChecksums::compute(zblocks[thread_id].data(), zsize) : 0;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          data_ready[thread_id] = false;
+          main_cv.notify_all();
+          worker_cv.wait(lock, [this, thread_id]{ return blocks_written % nthreads == thread_id || !error_message.empty(); });
+          if(!error_message.empty()) break;
+        }
+        // only the thread whose turn it is writes to file
+        writeSize4(myFile, zsize);
+        write_check(myFile, zblocks[thread_id].data(), zsize);
+        if(block_checksum) {
+          writeSize8(myFile, checksum);
+          checksums.add(checksum);
+        }
+        if(block_index) index.add_block(zsize, block_size);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          blocks_written += 1;
+        }
+      } catch(std::exception & e) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(error_message.empty()) error_message = e.what();
       }
-      writeSize4(*myFile, zsize);
-      myFile->write(zblocks[thread_id].data(), zsize);
-      blocks_written += 1;
-
-      // tout << "final blocks written " << blocks_written << " thread " << thread_id << "\n" << std::flush;
+      worker_cv.notify_all();
+      main_cv.notify_all();
+    }
+  }
 
+  void join() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    worker_cv.notify_all();
+    for(unsigned int i=0; i < threads.size(); i++) {
+      if(threads[i].joinable()) threads[i].join();
     }
   }
   
   void finish() {
-    done = true;
-    for(unsigned int i =0; i < nthreads; i++) {
-
-      // tout << "joining " << i << "\n" << std::flush;
-
-      threads[i].join();
-
-      // tout << "joined " << i << "\n" << std::flush;
+    join();
+    if(!error_message.empty()) throw std::runtime_error(error_message);
+    hash_blocks(blocks_total);
+  }
 
-    }
+  ~Compress_Thread_Context() {
+    join();
   }
   
-  Compress_Thread_Context(std::ofstream* mf, unsigned int nt, QsMetadata qm) : 
-    myFile(mf), blocks_total(0), blocks_written(0),
-    nthreads(nt-1), compress_level(qm.compress_level), done(false),
-    zblocks(std::vector< std::vector<char> >(nthreads, std::vector<char>(this->cenv.compressBound(BLOCKSIZE)))),
+  Compress_Thread_Context(stream_writer & mf, unsigned int nt, QsMetadata qm, xxhash_env * xenv) : 
+    myFile(mf), cenvs(nt-1), xenv(xenv), blocks_total(0), blocks_hashed(0), blocks_written(0),
+    nthreads(nt-1), compress_level(qm.compress_level), block_index(qm.block_index), block_checksum(qm.block_checksum), done(false),
+    zblocks(std::vector< std::vector<char> >(nthreads, std::vector<char>(this->cenvs[0].compressBound(BLOCKSIZE)))),
     data_blocks(std::vector< std::vector<char> >(nthreads, std::vector<char>(BLOCKSIZE))),
-    block_pointers(std::vector< std::pair<const char*, uint64_t> >(nthreads)) {
-    
-    data_ready = std::vector< std::atomic<bool> >(nthreads);
-    for(unsigned int i=0; i<nthreads; i++) {
-      data_ready[i] = false;
-    }
-    
+    block_pointers(std::vector< std::pair<const char*, uint64_t> >(nthreads)),
+    shuffle_segments(nthreads),
+    data_ready(std::vector<bool>(nthreads, false)) {
+    index.checksum_size = qm.block_checksum_size();
     for (unsigned int i = 0; i < nthreads; i++) {
       threads.push_back(std::thread(&Compress_Thread_Context::worker_thread, this, i));
     }
   }
-  
-  char* get_new_block_ptr() {
 
-    // tout << "new block\n" << std::flush;
+  // waits until the block slot is no longer in use by a worker thread; call with mutex held
+  void wait_for_slot(std::unique_lock<std::mutex> & lock, const uint64_t block_check) {
+    main_cv.wait(lock, [this, block_check]{ return !data_ready[block_check] || !error_message.empty(); });
+    if(!error_message.empty()) throw std::runtime_error(error_message);
+  }
 
-    uint64_t block_check = blocks_total % nthreads;
-    while (data_ready[block_check]) {
-      std::this_thread::yield();
+  // the hash is computed over the (shuffled) blocks in order, as each block slot is finished and before it is reused
+  void hash_blocks(const uint64_t blocks_finished) {
+    if(xenv == nullptr) return;
+    for(; blocks_hashed < blocks_finished; blocks_hashed++) {
+      const std::pair<const char*, uint64_t> & bp = block_pointers[blocks_hashed % nthreads];
+      xenv->update(bp.first, bp.second);
+    }
+  }
+
+  // waits for the slot of the next block and hashes the block that previously used it
+  void reuse_slot(const uint64_t block_check) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wait_for_slot(lock, block_check);
     }
+    if(blocks_total >= nthreads) hash_blocks(blocks_total - nthreads + 1);
+    shuffle_segments[block_check].clear();
+  }
+
+  char* get_new_block_ptr() {
+    uint64_t block_check = blocks_total % nthreads;
+    reuse_slot(block_check);
     block_pointers[block_check].first = data_blocks[block_check].data();
     return data_blocks[block_check].data();
   }
+
+  // the part of the shuffled vector is gathered into the current block by its worker thread
+  void push_shuffle(const shuffle_segment & seg) {
+    shuffle_segments[blocks_total % nthreads].push_back(seg);
+  }
   
   void push_block(const uint32_t datasize) {
     uint64_t block_check = blocks_total % nthreads;
-
-    // tout << "push block " << block_check << "\n" << std::flush;
-
-    block_pointers[block_check].second = datasize;
-    data_ready[block_check] = true;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      block_pointers[block_check].second = datasize;
+      data_ready[block_check] = true;
+    }
+    worker_cv.notify_all();
     blocks_total++;
   }
   
   void push_ptr(const char * const ptr, const uint32_t datasize) {
     uint64_t block_check = blocks_total % nthreads;
-    
-    // tout << "push ptr " << block_check << "\n" << std::flush;
-
-    while (data_ready[block_check]) {
-      std::this_thread::yield();
+    reuse_slot(block_check);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      block_pointers[block_check].first = ptr;
+      block_pointers[block_check].second = datasize;
+      data_ready[block_check] = true;
     }
-    block_pointers[block_check].first = ptr;
-    block_pointers[block_check].second = datasize;
-    data_ready[block_check] = true;
+    worker_cv.notify_all();
     blocks_total++;
   }
 };
 
-template <class compress_env> 
+template <class stream_writer, class compress_env> 
 struct CompressBuffer_MT {
   QsMetadata qm;
-  std::ofstream * myFile;
+  stream_writer * myFile;
   xxhash_env xenv;
-  Compress_Thread_Context<compress_env> ctc;
+  Compress_Thread_Context<stream_writer, compress_env> ctc;
   CountToObjectMap object_ref_hash;
   
-  std::vector<uint8_t> shuffleblock = std::vector<uint8_t>(256);
-  // shuffle_endblock is tracking when shuffleblock is finished processing
-  uint64_t shuffle_endblock = 0;
-  
   uint64_t current_blocksize = 0;
   uint64_t number_of_blocks = 0;
   char* block_data_ptr;
   
-  CompressBuffer_MT(std::ofstream * f, QsMetadata _qm, unsigned int nthreads) : qm(_qm), myFile(f), ctc(f, nthreads, _qm) {
+  CompressBuffer_MT(stream_writer * f, QsMetadata _qm, unsigned int nthreads) : qm(_qm), myFile(f), ctc(*f, nthreads, _qm, _qm.check_hash ? &xenv : nullptr) {
     block_data_ptr = ctc.get_new_block_ptr();
   }
+  // worker threads are joined before members are destroyed
+  ~CompressBuffer_MT() {
+    ctc.join();
+  }
   void flush() {
     if(current_blocksize > 0) {
       ctc.push_block(current_blocksize);
@@ -229,7 +278,6 @@ struct CompressBuffer_MT {
     }
   }
   void push_contiguous(const char * const data, const uint64_t len) {
-    if(qm.check_hash) xenv.update(data, len);
     uint64_t current_pointer_consumed = 0;
     while(current_pointer_consumed < len) {
       if( current_blocksize == BLOCKSIZE ) {
@@ -250,7 +298,6 @@ struct CompressBuffer_MT {
     }
   }
   void push_noncontiguous(const char * const data, const uint64_t len) {
-    if(qm.check_hash) xenv.update(data, len);
     uint64_t current_pointer_consumed = 0;
     while(current_pointer_consumed < len) {
       if( BLOCKSIZE - current_blocksize < BLOCKRESERVE ) {
@@ -285,23 +332,37 @@ struct CompressBuffer_MT {
   //   std::memcpy(pdata.data() + sizeof(POD), reinterpret_cast<const char*>(&pod2), sizeof(POD));
   //   push_noncontiguous(pdata.data(), sizeof(POD)*2);
   // }
+  // each block gathers its part of the shuffled vector straight from the vector in the worker thread compressing it (see blosc_shuffle_range)
+  // the vector data must stay valid until the block is compressed, as with push_ptr
   void shuffle_push(const char * const data, const uint64_t len, const uint64_t bytesoftype) {
+    shuffle_push_blocks(PointerSource{data}, len, bytesoftype, data);
+  }
+  // data that does not outlive the call (e.g. a transformed vector that is encoded in chunks) is gathered into the block by the main thread
+  template <class Source>
+  void shuffle_push_temporary(Source && source, const uint64_t len, const uint64_t bytesoftype) {
+    shuffle_push_blocks(source, len, bytesoftype, nullptr);
+  }
+  // with worker_data (the vector), the worker threads gather the blocks from it, otherwise the main thread gathers them from source
+  template <class Source>
+  void shuffle_push_blocks(Source && source, const uint64_t len, const uint64_t bytesoftype, const char * const worker_data) {
     if(len > MIN_SHUFFLE_ELEMENTS) {
-      // blocks_written = number of blocks file written
-      // (len + current_blocksize)/BLOCKSIZE = additional full blocks due to shuffleblock
-      // number_of_blocks = number of blocks pushed to ctc
-      while( shuffle_endblock > ctc.blocks_written ) {
-        
-        // tout << "shuffle " << shuffle_endblock << " " << ctc.blocks_written << "\n" << std::flush;
-        
-        std::this_thread::yield();
+      uint64_t current_pointer_consumed = 0;
+      while(current_pointer_consumed < len) {
+        if(current_blocksize == BLOCKSIZE) {
+          flush();
+        }
+        uint64_t remaining_pointer_available = len - current_pointer_consumed;
+        uint64_t add_length = remaining_pointer_available < (BLOCKSIZE - current_blocksize) ? remaining_pointer_available : BLOCKSIZE-current_blocksize;
+        if(worker_data != nullptr) {
+          ctc.push_shuffle(shuffle_segment{worker_data, len, bytesoftype, current_pointer_consumed, current_blocksize, add_length});
+        } else {
+          blosc_shuffle_range(source, block_data_ptr + current_blocksize, len, bytesoftype, current_pointer_consumed, add_length);
+        }
+        current_blocksize += add_length;
+        current_pointer_consumed += add_length;
       }
-      shuffle_endblock = (len + current_blocksize)/BLOCKSIZE + number_of_blocks;
-      if(len > shuffleblock.size()) shuffleblock.resize(len);
-      blosc_shuffle(reinterpret_cast<const uint8_t * const>(data), shuffleblock.data(), len, bytesoftype);
-      push_contiguous(reinterpret_cast<char*>(shuffleblock.data()), len);
     } else if(len > 0) {
-      push_contiguous(data, len);
+      push_contiguous(source(0, len), len);
     }
   }
 };
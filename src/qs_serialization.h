@@ -32,17 +32,30 @@ struct CompressBuffer {
   compress_env cenv; // default constructor
   xxhash_env xenv; // default constructor
   CountToObjectMap object_ref_hash; // default constructor
+  BlockIndex index; // only filled if qm.block_index
+  BlockChecksums checksums; // only filled if qm.block_checksum
   uint64_t number_of_blocks = 0;
-  std::vector<uint8_t> shuffleblock = std::vector<uint8_t>(256);
   std::vector<char> block = std::vector<char>(BLOCKSIZE);
   uint64_t current_blocksize=0;
   std::vector<char> zblock = std::vector<char>(cenv.compressBound(BLOCKSIZE));
-  CompressBuffer(stream_writer & f, QsMetadata qm) : qm(qm), myFile(f) {}
+  CompressBuffer(stream_writer & f, QsMetadata qm) : qm(qm), myFile(f) {
+    index.checksum_size = qm.block_checksum_size();
+  }
+  // writes the compressed block in zblock
+  void write_block(const uint64_t zsize, const uint64_t block_size) {
+    writeSize4(myFile, zsize);
+    write_check(myFile, zblock.data(), zsize);
+    if(qm.block_checksum) {
+      uint64_t checksum = BlockChecksums::compute(zblock.data(), zsize);
+      writeSize8(myFile, checksum);
+      checksums.add(checksum);
+    }
+    if(qm.block_index) index.add_block(zsize, block_size);
+  }
   void flush() {
     if(current_blocksize > 0) {
       uint64_t zsize = cenv.compress(zblock.data(), zblock.size(), block.data(), current_blocksize, qm.compress_level);
-      writeSize4(myFile, zsize);
-      write_check(myFile, zblock.data(), zsize);
+      write_block(zsize, current_blocksize);
       current_blocksize = 0;
       number_of_blocks++;
     }
@@ -56,8 +69,7 @@ struct CompressBuffer {
       }
       if(current_blocksize == 0 && len - current_pointer_consumed >= BLOCKSIZE) {
         uint64_t zsize = cenv.compress(zblock.data(), zblock.size(), data + current_pointer_consumed, BLOCKSIZE, qm.compress_level);
-        writeSize4(myFile, zsize);
-        write_check(myFile, zblock.data(), zsize);
+        write_block(zsize, BLOCKSIZE);
         current_pointer_consumed += BLOCKSIZE;
         number_of_blocks++;
       } else {
@@ -78,8 +90,7 @@ struct CompressBuffer {
       }
       if(current_blocksize == 0 && len - current_pointer_consumed >= BLOCKSIZE) {
         uint64_t zsize = cenv.compress(zblock.data(), zblock.size(), data + current_pointer_consumed, BLOCKSIZE, qm.compress_level);
-        writeSize4(myFile, zsize);
-        write_check(myFile, zblock.data(), zsize);
+        write_block(zsize, BLOCKSIZE);
         current_pointer_consumed += BLOCKSIZE;
         number_of_blocks++;
       } else {
@@ -106,13 +117,31 @@ struct CompressBuffer {
   //  std::memcpy(pdata.data() + sizeof(POD), reinterpret_cast<const char*>(&pod2), sizeof(POD));
   //  push_noncontiguous(pdata.data(), sizeof(POD)*2);
   //}
+  // each block gathers its part of the shuffled vector straight from the vector (see blosc_shuffle_range), the blocks are the same
+  // as if the whole vector was shuffled into a temporary copy and pushed with push_contiguous
   void shuffle_push(const char * const data, const uint64_t len, const uint64_t bytesoftype) {
+    shuffle_push_temporary(PointerSource{data}, len, bytesoftype);
+  }
+  // only the multi-threaded buffer shuffles after shuffle_push returns, see CompressBuffer_MT
+  // the vector is read from source piece by piece (see PointerSource), e.g. a transformed vector that is encoded in chunks
+  template <class Source>
+  void shuffle_push_temporary(Source && source, const uint64_t len, const uint64_t bytesoftype) {
     if(len > MIN_SHUFFLE_ELEMENTS) {
-      if(len > shuffleblock.size()) shuffleblock.resize(len);
-      blosc_shuffle(reinterpret_cast<const uint8_t * const>(data), shuffleblock.data(), len, bytesoftype);
-      push_contiguous(reinterpret_cast<char*>(shuffleblock.data()), len);
+      uint64_t current_pointer_consumed = 0;
+      while(current_pointer_consumed < len) {
+        if(current_blocksize == BLOCKSIZE) {
+          flush();
+        }
+        uint64_t remaining_pointer_available = len - current_pointer_consumed;
+        uint64_t add_length = remaining_pointer_available < (BLOCKSIZE - current_blocksize) ? remaining_pointer_available : BLOCKSIZE-current_blocksize;
+        char * const dest = block.data() + current_blocksize;
+        blosc_shuffle_range(source, dest, len, bytesoftype, current_pointer_consumed, add_length);
+        if(qm.check_hash) xenv.update(dest, add_length);
+        current_blocksize += add_length;
+        current_pointer_consumed += add_length;
+      }
     } else if(len > 0) {
-      push_contiguous(data, len);
+      push_contiguous(source(0, len), len);
     }
   }
 };
@@ -128,13 +128,24 @@ struct CompressBufferStream {
   //   sobj.push(reinterpret_cast<const char * const>(&pod1), sizeof(pod1)); 
   //   sobj.push(reinterpret_cast<const char * const>(&pod2), sizeof(pod2));
   // }
+  // streams have no block structure, the shuffled vector is gathered BLOCKSIZE bytes at a time (see blosc_shuffle_range)
   void shuffle_push(const char * const data, const uint64_t len, const uint64_t bytesoftype) {
+    shuffle_push_temporary(PointerSource{data}, len, bytesoftype);
+  }
+  // only the multi-threaded buffer shuffles after shuffle_push returns, see CompressBuffer_MT
+  // the vector is read from source piece by piece (see PointerSource), e.g. a transformed vector that is encoded in chunks
+  template <class Source>
+  void shuffle_push_temporary(Source && source, const uint64_t len, const uint64_t bytesoftype) {
     if(len > MIN_SHUFFLE_ELEMENTS) {
-      if(len > shuffleblock.size()) shuffleblock.resize(len);
-      blosc_shuffle(reinterpret_cast<const uint8_t * const>(data), shuffleblock.data(), len, bytesoftype);
-      sobj.push(reinterpret_cast<char*>(shuffleblock.data()), len);
+      uint64_t chunk_size = std::min<uint64_t>(len, BLOCKSIZE);
+      if(chunk_size > shuffleblock.size()) shuffleblock.resize(chunk_size);
+      for(uint64_t i=0; i<len; i += BLOCKSIZE) {
+        uint64_t add_length = std::min<uint64_t>(len - i, BLOCKSIZE);
+        blosc_shuffle_range(source, reinterpret_cast<char*>(shuffleblock.data()), len, bytesoftype, i, add_length);
+        sobj.push(reinterpret_cast<char*>(shuffleblock.data()), add_length);
+      }
     } else if(len > 0) {
-      sobj.push(data, len);
+      sobj.push(source(0, len), len);
     }
   }
 };
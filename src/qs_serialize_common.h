@@ -19,6 +19,7 @@ static std::unordered_set<
 struct CountToObjectMap {
   uint32_t index = 0;
   std::unordered_map<SEXP, uint32_t> map;
+  std::unordered_multimap<uint64_t, SEXP> content_map; // content hash of shared objects other than environments
   inline void add_to_hash(SEXP x) {
     index++; // hash starts at 1
     map.emplace(x, index);
@@ -185,6 +186,11 @@ void writeHeader_common(const qstype object_type, const uint64_t length, T * con
       sobj->push_pod_contiguous(static_cast<uint64_t>(length) );
     }
     return;
+  case qstype::CHARACTER_DICT:
+    sobj->push_pod_noncontiguous(extension_header);
+    sobj->push_pod_contiguous(character_dict_header);
+    sobj->push_pod_contiguous(static_cast<uint64_t>(length) );
+    return;
   case qstype::COMPLEX:
     if(length < 4294967296) {
       sobj->push_pod_noncontiguous(complex_header_32);
@@ -219,6 +225,31 @@ void writeHeader_common(const qstype object_type, const uint64_t length, T * con
   // case qstype::EMPTY_ENV:
   //   sobj->push_pod_noncontiguous(empty_env_header_with_ext), 2);
   //   return;
+  case qstype::TRANSFORMED:
+    sobj->push_pod_noncontiguous(extension_header);
+    sobj->push_pod_contiguous(transformed_vector_header);
+    sobj->push_pod_contiguous(static_cast<uint64_t>(length) );
+    return;
+  case qstype::COMPACT_SEQ:
+    sobj->push_pod_noncontiguous(extension_header);
+    sobj->push_pod_contiguous(compact_seq_header);
+    sobj->push_pod_contiguous(static_cast<uint64_t>(length) );
+    return;
+  case qstype::PACKED_LOGICAL:
+    sobj->push_pod_noncontiguous(extension_header);
+    sobj->push_pod_contiguous(packed_logical_header);
+    sobj->push_pod_contiguous(static_cast<uint64_t>(length) );
+    return;
+  case qstype::BITSHUFFLED:
+    sobj->push_pod_noncontiguous(extension_header);
+    sobj->push_pod_contiguous(bitshuffled_vector_header);
+    sobj->push_pod_contiguous(static_cast<uint64_t>(length) );
+    return;
+  case qstype::SHARED:
+    sobj->push_pod_noncontiguous(extension_header);
+    sobj->push_pod_contiguous(shared_object_header);
+    sobj->push_pod_contiguous(static_cast<uint32_t>(length) ); // index that later references point to
+    return;
   case qstype::REFERENCE:
     // sobj->push_pod_noncontiguous(extension_header, reference_object_header);
     sobj->push_pod_noncontiguous(extension_header);
@@ -291,92 +322,615 @@ void writeStringHeader_common(const uint64_t length, const cetype_t ce_enc, T *
   }
 }
 
-void getAttributes(SEXP const x, std::vector<SEXP> & attrs, std::vector<SEXP> & anames) {
-  SEXP alist = ATTRIB(x);
-  while(alist != R_NilValue) {
-    anames.push_back(PRINTNAME(TAG(alist)));
-    attrs.push_back(CAR(alist));
-    alist = CDR(alist);
+template <class T>
+inline void writeString(T * const sobj, SEXP xi) {
+  if(xi == NA_STRING) {
+    sobj->push_pod_noncontiguous(string_header_NA); // header is only 1 byte, but use noncontiguous for consistency
+  } else {
+    uint32_t di = LENGTH(xi);
+    writeStringHeader_common(di, Rf_getCharCE(xi), sobj);
+    sobj->push_contiguous(CHAR(xi), di);
   }
 }
 
-template <class T>
-void writeAttributes(T * const sobj, const std::vector<SEXP> & attrs, const std::vector<SEXP> & anames) {
-  for(uint64_t i=0; i<anames.size(); i++) {
-    uint32_t alen = strlen(CHAR(anames[i]));
-    writeStringHeader_common(alen, CE_NATIVE, sobj);
-    sobj->push_contiguous(CHAR(anames[i]), alen);
-    writeObject(sobj, attrs[i]);
+// Dictionary encoding of character vectors with few distinct values (e.g. categorical columns)
+static constexpr uint64_t MIN_DICT_ELEMENTS = 256;
+static constexpr uint64_t DICT_SAMPLE_SIZE = 4096;
+static constexpr uint64_t DICT_CODE_CHUNK = 16384; // codes are written in chunks of this many elements
+
+// Estimates whether a character vector has few distinct values from an evenly spaced sample
+// Equal strings share a CHARSXP in R's global cache, so the sample compares pointers rather than contents
+inline bool lowCardinality(const SEXP * const xptr, const uint64_t dl) {
+  uint64_t sample_size = std::min(dl, DICT_SAMPLE_SIZE);
+  uint64_t stride = dl / sample_size;
+  std::unordered_set<SEXP> distinct;
+  for(uint64_t i=0; i<sample_size; i++) {
+    distinct.insert(xptr[i * stride]);
+    if(distinct.size() > sample_size / 2) return false;
   }
+  return true;
 }
 
+// Writes x as a table of unique values followed by a code for every element, if it has few distinct values
+// Returns false (and writes nothing) otherwise
 template <class T>
-void writeEnvFrame(T * const sobj, SEXP rho) {
-  SEXP xt = FRAME(rho);
-  if(TYPEOF(xt) == NILSXP) {
-    writeHeader_common(qstype::NIL, 0, sobj);
-  } else { // LISTSXP
-    // getAttributes(xt, attrs, anames);
-    // if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
-    std::vector<SEXP> cars;
-    std::vector<SEXP> tags;
-    std::vector<int> flags;
-    bool has_flags = false;
-    while(xt != R_NilValue) {
-      int f = packFlags(xt);
-      if(f != 0) has_flags = true;
-      flags.push_back(f);
-      SEXP tag = TAG(xt);
-      tags.push_back(tag);
-      if(R_BindingIsActive(tag, rho)) {
-        cars.push_back(CAR(xt));
-      } else {
-        // this expands immediate bindings; direct expansion is not allowed/part of API (Luke Tierney)
-        cars.push_back(Rf_findVarInFrame(rho, tag));
+bool writeStringDict(T * const sobj, SEXP x) {
+  uint64_t dl = Rf_xlength(x);
+  if(dl < MIN_DICT_ELEMENTS) return false;
+  const SEXP * xptr = STRING_PTR_RO(x);
+  if(!lowCardinality(xptr, dl)) return false;
+  // the sample can miss values, so give up if there are too many unique values after all
+  uint64_t max_unique = std::min<uint64_t>(dl / 4, 4294967295ULL);
+  std::unordered_map<SEXP, uint32_t> codes;
+  std::vector<SEXP> uniques;
+  for(uint64_t i=0; i<dl; i++) {
+    if(codes.emplace(xptr[i], static_cast<uint32_t>(uniques.size())).second) {
+      uniques.push_back(xptr[i]);
+      if(uniques.size() > max_unique) return false;
+    }
+  }
+  uint8_t width = uniques.size() <= 256 ? 1 : (uniques.size() <= 65536 ? 2 : 4);
+  writeHeader_common(qstype::CHARACTER_DICT, dl, sobj);
+  sobj->push_pod_contiguous(static_cast<uint32_t>(uniques.size()));
+  sobj->push_pod_contiguous(width);
+  for(uint64_t j=0; j<uniques.size(); j++) {
+    writeString(sobj, uniques[j]);
+  }
+  std::vector<char> chunk(DICT_CODE_CHUNK * width);
+  SEXP last = nullptr; // runs of the same value are common, so skip the lookup for those
+  uint32_t code = 0;
+  for(uint64_t i=0; i<dl; i += DICT_CODE_CHUNK) {
+    uint64_t n = std::min(DICT_CODE_CHUNK, dl - i);
+    for(uint64_t k=0; k<n; k++) {
+      if(xptr[i+k] != last) {
+        last = xptr[i+k];
+        code = codes.find(last)->second;
+      }
+      switch(width) {
+      case 1:
+        chunk[k] = static_cast<char>(static_cast<uint8_t>(code));
+        break;
+      case 2:
+      {
+        uint16_t code16 = static_cast<uint16_t>(code);
+        std::memcpy(chunk.data() + 2*k, &code16, 2);
+        break;
+      }
+      default:
+        std::memcpy(chunk.data() + 4*k, &code, 4);
+        break;
       }
-      xt = CDR(xt);
     }
-    if(has_flags) {
-      writeHeader_common(qstype::PAIRLIST_WF, cars.size(), sobj);
+    sobj->push_contiguous(chunk.data(), n * width);
+  }
+  return true;
+}
+
+// Integer and numeric vectors of at least this many elements are candidates for a delta or XOR transform
+static constexpr uint64_t MIN_TRANSFORM_ELEMENTS = 256;
+// The transform is chosen from a sample at the start of the vector, and must be estimated to save at least an eighth of the size
+static constexpr uint64_t TRANSFORM_SAMPLE_SIZE = 4096;
+
+// Integer and numeric vectors of at least this many elements are bit shuffled, if that is enabled for their type
+static constexpr uint64_t MIN_BITSHUFFLE_ELEMENTS = 64;
+
+// Writes an integer (type 0) or numeric (type 1) vector bit shuffled, after the given transform
+// The data is read from source one BITSHUFFLE_BLOCK at a time (see PointerSource)
+template <class T, class Source>
+void writeBitshuffled(T * const sobj, Source && source, const uint64_t dl, const uint8_t type, const vector_transform transform) {
+  const uint64_t bytesoftype = type == 0 ? 4 : 8;
+  writeHeader_common(qstype::BITSHUFFLED, dl, sobj);
+  sobj->push_pod_contiguous(type);
+  sobj->push_pod_contiguous(static_cast<uint8_t>(transform));
+  std::vector<uint8_t> block(BITSHUFFLE_BLOCK * bytesoftype);
+  std::vector<uint8_t> buffer;
+  for(uint64_t i=0; i<dl; i += BITSHUFFLE_BLOCK) {
+    uint64_t block_n = std::min(BITSHUFFLE_BLOCK, dl - i);
+    const char * const data = source(i * bytesoftype, block_n * bytesoftype);
+    bitshuffle(reinterpret_cast<const uint8_t*>(data), block.data(), block_n, bytesoftype, buffer);
+    sobj->push_contiguous(reinterpret_cast<char*>(block.data()), block_n * bytesoftype);
+  }
+}
+
+// Source for a transformed vector, encoded in chunks of at most BLOCKSIZE bytes into a buffer that is reused
+// encode(i, n, dest) writes the transformed elements i to i + n - 1 and is called in order, so the encoder can keep its state between calls
+// When the vector is byte shuffled, it is encoded again for each byte plane, so the encoder starts over when i is 0
+template <class POD, class Encoder>
+struct TransformSource {
+  Encoder & encode;
+  std::vector<POD> chunk;
+  TransformSource(Encoder & encode, const uint64_t dl) : encode(encode), chunk(std::min<uint64_t>(dl, BLOCKSIZE / sizeof(POD))) {}
+  const char * operator()(const uint64_t offset, const uint64_t length) {
+    encode(offset / sizeof(POD), length / sizeof(POD), chunk.data());
+    return reinterpret_cast<const char*>(chunk.data());
+  }
+};
+
+template <class POD, class T, class Encoder>
+void writeTransformed(T * const sobj, Encoder & encode, const uint64_t dl, const uint8_t type, const vector_transform transform) {
+  TransformSource<POD, Encoder> source(encode, dl);
+  if(type == 0 ? sobj->qm.int_bitshuffle : sobj->qm.real_bitshuffle) {
+    writeBitshuffled(sobj, source, dl, type, transform);
+    return;
+  }
+  writeHeader_common(qstype::TRANSFORMED, dl, sobj);
+  sobj->push_pod_contiguous(type);
+  sobj->push_pod_contiguous(static_cast<uint8_t>(transform));
+  sobj->shuffle_push_temporary(source, dl * sizeof(POD), sizeof(POD));
+}
+
+// Writes an integer vector as deltas or deltas of deltas (e.g. sorted IDs, timestamps), if that is estimated to compress much better
+// Returns false (and writes nothing) otherwise
+template <class T>
+bool writeTransformedInt(T * const sobj, const int * const xptr, const uint64_t dl) {
+  if(dl < MIN_TRANSFORM_ELEMENTS) return false;
+  uint64_t ns = std::min(dl, TRANSFORM_SAMPLE_SIZE);
+  uint64_t best_cost = shuffled_cost(reinterpret_cast<const uint8_t*>(xptr), ns, 4);
+  best_cost -= best_cost / 8;
+  vector_transform best = vector_transform::none;
+  std::vector<uint32_t> sample(ns);
+  uint32_t prev = 0;
+  uint32_t prev_delta = 0;
+  delta_encode_int(xptr, sample.data(), ns, prev);
+  uint64_t cost = shuffled_cost(reinterpret_cast<const uint8_t*>(sample.data()), ns, 4);
+  if(cost < best_cost) {
+    best = vector_transform::delta;
+    best_cost = cost;
+  }
+  prev = 0;
+  delta2_encode_int(xptr, sample.data(), ns, prev, prev_delta);
+  cost = shuffled_cost(reinterpret_cast<const uint8_t*>(sample.data()), ns, 4);
+  if(cost < best_cost) best = vector_transform::delta2;
+  if(best == vector_transform::none) return false;
+  auto encode = [xptr, best, &prev, &prev_delta](const uint64_t i, const uint64_t n, uint32_t * const dest) {
+    if(i == 0) {
+      prev = 0;
+      prev_delta = 0;
+    }
+    if(best == vector_transform::delta) {
+      delta_encode_int(xptr + i, dest, n, prev);
     } else {
-      writeHeader_common(qstype::PAIRLIST, cars.size(), sobj);
-    }
-    for(uint64_t i=0; i<cars.size(); i++) {
-      if(has_flags) sobj->push_pod_noncontiguous(flags[i]);
-      if(tags[i] == R_NilValue) {
-        sobj->push_pod_noncontiguous(string_header_NA);
-      } else {
-        const char * tag_chars = (CHAR(PRINTNAME(tags[i])));
-        uint32_t alen = strlen(tag_chars);
-        writeStringHeader_common(alen, CE_NATIVE, sobj);
-        sobj->push_contiguous(tag_chars, alen);
-      }
-      writeObject(sobj, cars[i]);
+      delta2_encode_int(xptr + i, dest, n, prev, prev_delta);
     }
-    // writeAttributes(sobj, attrs, anames);
+  };
+  writeTransformed<uint32_t>(sobj, encode, dl, 0, best);
+  return true;
+}
+
+// Writes a numeric vector as deltas (integer values only, e.g. Date) or XOR of consecutive values, if that is estimated to compress much better
+// Returns false (and writes nothing) otherwise
+template <class T>
+bool writeTransformedReal(T * const sobj, const double * const xptr, const uint64_t dl) {
+  if(dl < MIN_TRANSFORM_ELEMENTS) return false;
+  uint64_t ns = std::min(dl, TRANSFORM_SAMPLE_SIZE);
+  uint64_t raw_cost = shuffled_cost(reinterpret_cast<const uint8_t*>(xptr), ns, 8);
+  raw_cost -= raw_cost / 8;
+  std::vector<double> delta_sample(ns);
+  double delta_prev = 0;
+  uint64_t delta_cost = real_delta_encode(xptr, delta_sample.data(), ns, delta_prev) ?
+    shuffled_cost(reinterpret_cast<const uint8_t*>(delta_sample.data()), ns, 8) : UINT64_MAX;
+  std::vector<uint64_t> xor_sample(ns);
+  uint64_t xor_prev = 0;
+  xor_encode_real(xptr, xor_sample.data(), ns, xor_prev);
+  uint64_t xor_cost = shuffled_cost(reinterpret_cast<const uint8_t*>(xor_sample.data()), ns, 8);
+  // the rest of the vector is checked before anything is written, since it is encoded while it is written
+  if(delta_cost < raw_cost && delta_cost <= xor_cost && real_delta_allowed(xptr + ns, dl - ns)) {
+    auto encode = [xptr, &delta_prev](const uint64_t i, const uint64_t n, double * const dest) {
+      if(i == 0) delta_prev = 0;
+      real_delta_encode(xptr + i, dest, n, delta_prev);
+    };
+    writeTransformed<double>(sobj, encode, dl, 1, vector_transform::real_delta);
+    return true;
+  }
+  if(xor_cost < raw_cost) {
+    auto encode = [xptr, &xor_prev](const uint64_t i, const uint64_t n, uint64_t * const dest) {
+      if(i == 0) xor_prev = 0;
+      xor_encode_real(xptr + i, dest, n, xor_prev);
+    };
+    writeTransformed<uint64_t>(sobj, encode, dl, 1, vector_transform::xor_prev);
+    return true;
   }
+  return false;
 }
 
+// With shuffle_control bit 0x100 (lgl_pack), logical vectors of at least this many elements are packed to 2 bits per element
+static constexpr uint64_t MIN_PACK_ELEMENTS = 64;
+static constexpr uint64_t PACK_CHUNK = 16384; // packed bytes are written in chunks of this size
+
+// Writes a logical vector packed to 2 bits per element
+// Returns false (and writes nothing) if it is short or contains values other than TRUE, FALSE and NA
 template <class T>
-void writeObject(T * const sobj, SEXP x) {
-  // evaluate promises immediately
-  if(!trust_promises_global) {
-    if(TYPEOF(x) == PROMSXP) {
-      int error_occurred = 0;
-      SEXP xeval = R_tryEval(x, R_BaseEnv, &error_occurred);
-      if(error_occurred) {
-        writeObject(sobj, R_NilValue);
-      } else {
-        PROTECT(xeval);
-        writeObject(sobj, xeval);
-        UNPROTECT(1);
+bool writePackedLogical(T * const sobj, const int * const xptr, const uint64_t dl) {
+  if(dl < MIN_PACK_ELEMENTS) return false;
+  if(!logical_packable(xptr, dl)) return false;
+  writeHeader_common(qstype::PACKED_LOGICAL, dl, sobj);
+  // chunks are packed into a reused buffer; they are smaller than BLOCKSIZE, so the buffers always copy them
+  std::vector<uint8_t> data(PACK_CHUNK);
+  for(uint64_t i=0; i<dl; i += 4*PACK_CHUNK) {
+    uint64_t n = std::min(4*PACK_CHUNK, dl - i);
+    logical_pack(xptr + i, data.data(), n);
+    sobj->push_contiguous(reinterpret_cast<char*>(data.data()), packed_logical_bytes(n));
+  }
+  return true;
+}
+
+// Atomic vectors of at least this many bytes are deduplicated by content with dedup = TRUE
+static constexpr uint64_t MIN_DEDUP_BYTES = 1024;
+// Vectors and lists of at least this many bytes keep their sharing (by pointer) with preserve_sharing = TRUE
+static constexpr uint64_t MIN_SHARE_BYTES = 1024;
+// R_compute_identical flags: numbers and NAs are compared bitwise, attributes in order
+static constexpr int IDENTICAL_EXACT = 7;
+
+// Payload of a vector that can be shared by content; strings are compared by their CHARSXP pointers
+// (equal strings share a CHARSXP in R's global cache)
+inline const void * sharedPayload(SEXP x, uint64_t & bytes) {
+  uint64_t dl = Rf_xlength(x);
+  switch(TYPEOF(x)) {
+  case REALSXP:
+    bytes = dl * sizeof(double);
+    return REAL(x);
+  case INTSXP:
+    bytes = dl * sizeof(int);
+    return INTEGER(x);
+  case LGLSXP:
+    bytes = dl * sizeof(int);
+    return LOGICAL(x);
+  case RAWSXP:
+    bytes = dl;
+    return RAW(x);
+  case CPLXSXP:
+    bytes = dl * sizeof(Rcomplex);
+    return COMPLEX(x);
+  case STRSXP:
+    bytes = dl * sizeof(SEXP);
+    return STRING_PTR_RO(x);
+  default:
+    bytes = 0;
+    return nullptr;
+  }
+}
+
+// Whether x is shared by pointer (preserve_sharing = TRUE)
+// The size is computed from the length, so ALTREP vectors are not materialized
+template <class T>
+bool shareCandidate(T * const sobj, SEXP x, const unsigned int nprotect) {
+  if(!sobj->qm.preserve_sharing || nprotect > 0) return false;
+  uint64_t element_size;
+  switch(TYPEOF(x)) {
+  case REALSXP:
+    element_size = sizeof(double);
+    break;
+  case INTSXP:
+  case LGLSXP:
+    element_size = sizeof(int);
+    break;
+  case RAWSXP:
+    element_size = 1;
+    break;
+  case CPLXSXP:
+    element_size = sizeof(Rcomplex);
+    break;
+  case STRSXP:
+  case VECSXP:
+    element_size = sizeof(SEXP);
+    break;
+  default:
+    return false;
+  }
+  return static_cast<uint64_t>(Rf_xlength(x)) * element_size >= MIN_SHARE_BYTES;
+}
+
+// Whether x is deduplicated by content (dedup = TRUE)
+// ALTREP vectors are skipped so that they are not materialized, and evaluated promises because they can be released
+// (and their address reused) before the end of serialization
+template <class T>
+bool dedupCandidate(T * const sobj, SEXP x, const unsigned int nprotect) {
+  if(!sobj->qm.dedup || nprotect > 0) return false;
+  switch(TYPEOF(x)) {
+  case REALSXP:
+  case INTSXP:
+  case LGLSXP:
+  case RAWSXP:
+  case CPLXSXP:
+  case STRSXP:
+    break;
+  default:
+    return false;
+  }
+#ifdef USE_ALT_REP
+  if(ALTREP(x)) return false;
+#endif
+  uint64_t bytes;
+  sharedPayload(x, bytes);
+  return bytes >= MIN_DEDUP_BYTES;
+}
+
+// Shared objects are written once and referenced by later identical objects (same object, or if by_content, same type, payload and attributes)
+// Used for atomic vectors and factor levels with dedup = TRUE (by content), and for vectors, lists and factor levels with preserve_sharing = TRUE
+// Payloads are compared byte for byte (so e.g. -0 and 0 are different) and attributes with R's identical, in order
+// Returns true if x was written as a reference, otherwise x is registered and the shared prefix is written before it
+template <class T>
+bool writeShared(T * const sobj, SEXP x, const bool by_content) {
+  auto & ref_hash = sobj->object_ref_hash;
+  auto it = ref_hash.map.find(x);
+  if(it != ref_hash.map.end()) {
+    writeHeader_common(qstype::REFERENCE, it->second, sobj);
+    return true;
+  }
+  if(!by_content) {
+    ref_hash.add_to_hash(x);
+    writeHeader_common(qstype::SHARED, ref_hash.index, sobj);
+    return false;
+  }
+  uint64_t bytes;
+  const void * xptr = sharedPayload(x, bytes);
+  uint64_t hash = XXH3_64bits(xptr, bytes);
+  auto range = ref_hash.content_map.equal_range(hash);
+  for(auto c = range.first; c != range.second; ++c) {
+    SEXP y = c->second;
+    if(TYPEOF(y) != TYPEOF(x) || Rf_xlength(y) != Rf_xlength(x) || IS_S4_OBJECT(y) != IS_S4_OBJECT(x)) continue;
+    uint64_t ybytes;
+    if(std::memcmp(sharedPayload(y, ybytes), xptr, bytes) != 0) continue;
+    if(ATTRIB(y) != ATTRIB(x) && !R_compute_identical(ATTRIB(y), ATTRIB(x), IDENTICAL_EXACT)) continue;
+    writeHeader_common(qstype::REFERENCE, ref_hash.map.at(y), sobj);
+    return true;
+  }
+  ref_hash.add_to_hash(x);
+  ref_hash.content_map.emplace(hash, x);
+  writeHeader_common(qstype::SHARED, ref_hash.index, sobj);
+  return false;
+}
+
+// Kind of container on the explicit stack of writeObject
+enum class pack_kind : uint8_t {leaf, list, pairlist, lang, env};
+
+// Node of a pairlist or environment frame, copied when its header is written (see writePairlistHeader)
+struct Pack_Node {
+  SEXP car;
+  SEXP tag;
+  int flags;
+};
+
+struct Pack_Frame {
+  SEXP obj;
+  SEXP node; // next attribute node
+  uint64_t index;
+  uint64_t length; // number of elements of a list, or of nodes of a pairlist or environment frame
+  uint64_t nodes_begin; // first node of a pairlist or environment frame in Pack_Stack::nodes
+  unsigned int protected_values; // evaluated promises to unprotect when the frame is popped
+  pack_kind kind;
+  bool has_flags; // pairlist nodes are written with flags
+  bool has_attributes;
+  bool attributes;
+};
+
+// Explicit stack of writeObject
+// The frame vector is kept for the whole serialization, so its memory is reused by every node once the deepest level has been reached
+// Attributes are walked in place; the nodes of pairlists and environment frames are copied into one vector shared by all frames, since
+// evaluating promises among their values can change the pairlist after its length has been written
+struct Pack_Stack {
+  std::vector<Pack_Frame> frames;
+  std::vector<Pack_Node> nodes;
+  Protect_Tracker pt = Protect_Tracker();
+
+  Pack_Stack() {
+    frames.reserve(64);
+    nodes.reserve(64);
+  }
+  bool empty() const {
+    return frames.empty();
+  }
+  Pack_Frame & top() {
+    return frames.back();
+  }
+  void push(SEXP obj, const pack_kind kind, const uint64_t length, const bool has_flags, const bool has_attributes,
+            const unsigned int protected_values) {
+    frames.push_back(Pack_Frame{obj, obj, 0, length, nodes.size(), protected_values, kind, has_flags, has_attributes, false});
+  }
+  void pop() {
+    release(frames.back().protected_values);
+    nodes.resize(frames.back().nodes_begin);
+    frames.pop_back();
+  }
+  void protect(SEXP x) {
+    PROTECT(x); pt++;
+  }
+  void release(const unsigned int n) {
+    UNPROTECT(n);
+    pt.n -= n;
+  }
+};
+
+inline uint64_t countAttributes(SEXP const x) {
+  uint64_t n = 0;
+  for(SEXP alist = ATTRIB(x); alist != R_NilValue; alist = CDR(alist)) n++;
+  return n;
+}
+
+template <class T>
+void writeRSerialized(T * const sobj, SEXP x, const int version) {
+  Protect_Tracker pt = Protect_Tracker();
+  SEXP xserialized = PROTECT(R::serializeToRaw(x,Rf_ScalarInteger(version))); pt++;
+  uint64_t xs_size = Rf_xlength(xserialized);
+  writeHeader_common(qstype::RSERIALIZED, xs_size, sobj);
+  sobj->push_contiguous(reinterpret_cast<char*>(RAW(xserialized)), xs_size);
+}
+
+// copies the nodes of a pairlist (or of the frame of environment rho) starting at node xt to the end of nodes and writes its header
+// returns whether nodes are written with flags
+template <class T>
+bool writePairlistHeader(T * const sobj, std::vector<Pack_Node> & nodes, SEXP xt, SEXP rho) {
+  const uint64_t begin = nodes.size();
+  bool has_flags = false;
+  for(; xt != R_NilValue; xt = CDR(xt)) {
+    int flags = packFlags(xt);
+    if(flags != 0) has_flags = true;
+    SEXP tag = TAG(xt);
+    if(rho == R_NilValue || R_BindingIsActive(tag, rho)) {
+      // if(get_bndcell_tag(xt)) R_expand_binding_value(xt);
+      nodes.push_back(Pack_Node{CAR(xt), tag, flags});
+    } else {
+      // this expands immediate bindings; direct expansion is not allowed/part of API (Luke Tierney)
+      nodes.push_back(Pack_Node{Rf_findVarInFrame(rho, tag), tag, flags});
+    }
+  }
+  uint64_t length = nodes.size() - begin;
+  if(has_flags) {
+    writeHeader_common(qstype::PAIRLIST_WF, length, sobj);
+  } else {
+    writeHeader_common(qstype::PAIRLIST, length, sobj);
+  }
+  return has_flags;
+}
+
+// writes what comes before the value of a pairlist node: flags and tag
+template <class T>
+void writePairlistNodePrefix(T * const sobj, const Pack_Node & node, const bool has_flags) {
+  if(has_flags) sobj->push_pod_noncontiguous(node.flags);
+  SEXP tag = node.tag;
+  if(tag == R_NilValue) {
+    sobj->push_pod_noncontiguous(string_header_NA);
+  } else {
+    const char * tag_chars = (CHAR(PRINTNAME(tag)));
+    uint32_t alen = strlen(tag_chars);
+    writeStringHeader_common(alen, CE_NATIVE, sobj);
+    sobj->push_contiguous(tag_chars, alen);
+  }
+}
+
+// Finds the next child of the top frame and writes what comes before it (pairlist tags, environment frame headers, attribute names)
+// Returns false once the frame and its attributes are complete
+// factor_levels is set if the child is the levels attribute of a factor and dedup or preserve_sharing is enabled
+template <class T>
+bool nextChild(T * const sobj, Pack_Stack & stack, SEXP & child, bool & factor_levels) {
+  Pack_Frame & f = stack.top();
+  if(!f.attributes) {
+    switch(f.kind) {
+    case pack_kind::list:
+      if(f.index < f.length) {
+        child = VECTOR_ELT(f.obj, f.index++);
+        return true;
+      }
+      break;
+    case pack_kind::pairlist:
+      if(f.index < f.length) {
+        const Pack_Node & node = stack.nodes[f.nodes_begin + f.index++];
+        writePairlistNodePrefix(sobj, node, f.has_flags);
+        child = node.car;
+        return true;
+      }
+      break;
+    case pack_kind::lang: // TAG/CAR/CDR are just accessors to elements; not real pairlist
+      if(f.index < 3) {
+        // if(xtype != CLOSXP && get_bndcell_tag(x)) R_expand_binding_value(x);
+        child = f.index == 0 ? TAG(f.obj) : (f.index == 1 ? CAR(f.obj) : CDR(f.obj));
+        f.index++;
+        return true;
+      }
+      break;
+    case pack_kind::env: // parent env, frame (written as a pairlist, its nodes are index 2 onwards) and hash table
+      if(f.index == 0) {
+        f.index = 1;
+        child = ENCLOS(f.obj);
+        return true;
+      }
+      if(f.index == 1) {
+        f.index = 2;
+        SEXP frame = FRAME(f.obj);
+        f.nodes_begin = stack.nodes.size();
+        if(TYPEOF(frame) == NILSXP) {
+          writeHeader_common(qstype::NIL, 0, sobj);
+        } else { // LISTSXP
+          f.has_flags = writePairlistHeader(sobj, stack.nodes, frame, f.obj);
+        }
+        f.length = stack.nodes.size() - f.nodes_begin;
+      }
+      if(f.index - 2 < f.length) {
+        const Pack_Node & node = stack.nodes[f.nodes_begin + f.index - 2];
+        writePairlistNodePrefix(sobj, node, f.has_flags);
+        child = node.car;
+        f.index++;
+        return true;
       }
-      return;
+      if(f.index - 2 == f.length) {
+        f.index++;
+        child = HASHTAB(f.obj);
+        return true;
+      }
+      break;
+    default:
+      break;
     }
+    if(!f.has_attributes) return false;
+    f.attributes = true;
+    f.node = ATTRIB(f.obj);
   }
+  if(f.node == R_NilValue) return false;
+  const char * aname = CHAR(PRINTNAME(TAG(f.node)));
+  uint32_t alen = strlen(aname);
+  writeStringHeader_common(alen, CE_NATIVE, sobj);
+  sobj->push_contiguous(aname, alen);
+  child = CAR(f.node);
+  factor_levels = (sobj->qm.dedup || sobj->qm.preserve_sharing) && TAG(f.node) == R_LevelsSymbol && TYPEOF(child) == STRSXP &&
+    ATTRIB(child) == R_NilValue && TYPEOF(f.obj) == INTSXP && Rf_inherits(f.obj, "factor");
+#ifdef USE_ALT_REP
+  if(factor_levels && ALTREP(child)) factor_levels = false;
+#endif
+  f.node = CDR(f.node);
+  return true;
+}
 
-  std::vector<SEXP> attrs; // attribute objects and names; r-serialized, env-references and NULLs don't have attributes, so process inline
-  std::vector<SEXP> anames; // just declare attribute variables for convenience here
+#ifdef USE_ALT_REP
+// Finds the compact integer or numeric sequence (e.g. 1:1e9) of x, looking through wrapper classes (e.g. from sort), and gets its
+// start and step without materializing it; the wrapper is not kept, but its attributes are written
+// Returns false if x is not such a sequence, or if it has already been expanded (then its data is written as is)
+inline bool compactSeqInfo(SEXP x, bool & is_real, double & start, double & step) {
+  SEXP seq = x;
+  const char * classname;
+  while(true) {
+    SEXP info = ATTRIB(ALTREP_CLASS(seq));
+    if(std::strcmp(CHAR(PRINTNAME(CADR(info))), "base") != 0) return false;
+    classname = CHAR(PRINTNAME(CAR(info)));
+    if(std::strncmp(classname, "wrap_", 5) != 0) break;
+    seq = R_altrep_data1(seq);
+    if(!ALTREP(seq)) return false;
+  }
+  if(std::strcmp(classname, "compact_intseq") == 0) {
+    is_real = false;
+  } else if(std::strcmp(classname, "compact_realseq") == 0) {
+    is_real = true;
+  } else {
+    return false;
+  }
+  if(DATAPTR_OR_NULL(seq) != nullptr) return false;
+  uint64_t dl = Rf_xlength(seq);
+  if(dl == 0) {
+    start = 0;
+    step = 1;
+    return true;
+  }
+  start = is_real ? REAL_ELT(seq, 0) : static_cast<double>(INTEGER_ELT(seq, 0));
+  step = dl < 2 ? 1 : (is_real ? REAL_ELT(seq, 1) : static_cast<double>(INTEGER_ELT(seq, 1))) - start;
+  return true;
+}
+#endif
+
+// The multithreaded writer gathers shuffled blocks in its worker threads straight from the vector, after shuffle_push has returned
+// Evaluated promises (nprotect > 0) are unprotected before then, so their values are gathered on the main thread instead
+template <class T>
+inline void shufflePushVector(T * const sobj, const char * const data, const uint64_t len, const uint64_t bytesoftype, const unsigned int nprotect) {
+  if(nprotect > 0) {
+    sobj->shuffle_push_temporary(PointerSource{data}, len, bytesoftype);
+  } else {
+    sobj->shuffle_push(data, len, bytesoftype);
+  }
+}
+
+// Writes the headers and data of x
+// Containers and objects with attributes are pushed onto the stack and their children are written by writeObject; returns whether a frame was pushed
+// r-serialized, env-references and NULLs don't have attributes
+template <class T>
+bool writeNode(T * const sobj, Pack_Stack & stack, SEXP x, const unsigned int nprotect) {
   auto xtype = TYPEOF(x);
 
 #ifdef USE_ALT_REP
@@ -385,8 +939,8 @@ void writeObject(T * const sobj, SEXP x) {
     const char * classname = CHAR(PRINTNAME(CAR(info)));
     const char * pkgname = CHAR(PRINTNAME(CADR(info)));
     if((std::strcmp(classname, "__sf_vec__") == 0) && (DATAPTR_OR_NULL(x) == nullptr)) { // special case, unmaterialized SF vector
-      getAttributes(x, attrs, anames);
-      if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
+      uint64_t nattr = countAttributes(x);
+      if(nattr > 0) writeAttributeHeader_common(nattr, sobj);
       uint64_t dl = Rf_xlength(x);
       writeHeader_common(qstype::CHARACTER, dl, sobj);
       auto & ref = sf_vec_data_ref(x);
@@ -405,129 +959,122 @@ void writeObject(T * const sobj, SEXP x) {
           break;
         }
       }
-      writeAttributes(sobj, attrs, anames);
-      return;
-    } else if( altrep_registry.find(std::make_pair(classname, pkgname)) != altrep_registry.end() ) {
-      Protect_Tracker pt = Protect_Tracker();
-      SEXP xserialized = PROTECT(R::serializeToRaw(x,Rf_ScalarInteger(3))); pt++;
-      uint64_t xs_size = Rf_xlength(xserialized);
-      writeHeader_common(qstype::RSERIALIZED, xs_size, sobj);
-      sobj->push_contiguous(reinterpret_cast<char*>(RAW(xserialized)), xs_size);
-      return;
+      if(nattr == 0) return false;
+      stack.push(x, pack_kind::leaf, 0, false, true, nprotect);
+      return true;
+    }
+    bool is_real;
+    double start, step;
+    if(compactSeqInfo(x, is_real, start, step)) {
+      if(IS_S4_OBJECT(x)) writeS4Flag_common(sobj);
+      uint64_t nattr = countAttributes(x);
+      if(nattr > 0) writeAttributeHeader_common(nattr, sobj);
+      writeHeader_common(qstype::COMPACT_SEQ, Rf_xlength(x), sobj);
+      sobj->push_pod_contiguous(static_cast<uint8_t>(is_real));
+      sobj->push_pod_contiguous(start);
+      sobj->push_pod_contiguous(step);
+      if(nattr == 0) return false;
+      stack.push(x, pack_kind::leaf, 0, false, true, nprotect);
+      return true;
+    }
+    if( altrep_registry.find(std::make_pair(classname, pkgname)) != altrep_registry.end() ) {
+      writeRSerialized(sobj, x, 3);
+      return false;
     }
     // else do nothing, fall through to non-ALTREP cases
   }
 #endif
 
   if(IS_S4_OBJECT(x)) writeS4Flag_common(sobj);
+  uint64_t nattr = 0;
   switch(xtype) {
   case NILSXP:
     writeHeader_common(qstype::NIL, 0, sobj);
-    return;
+    return false;
+  case SYMSXP:
+    if(x == R_MissingArg || x == R_UnboundValue || TYPEOF(PRINTNAME(x)) != CHARSXP) { // some special cases to handle1
+      writeRSerialized(sobj, x, 2);
+      return false;
+    }
+    break;
+  case ENVSXP:
+    if(x == R_GlobalEnv || x == R_BaseEnv || x == R_EmptyEnv ||
+                      R_IsNamespaceEnv(x) || R_IsPackageEnv(x)) {
+      writeRSerialized(sobj, x, 2);
+      return false;
+    }
+    if(sobj->object_ref_hash.map.find(x) != sobj->object_ref_hash.map.end()) {
+      writeHeader_common(qstype::REFERENCE, sobj->object_ref_hash.map.at(x), sobj);
+      return false;
+    }
+    // std::cout << (void *)x << std::endl;
+    sobj->object_ref_hash.add_to_hash(x);
+    break;
+  case S4SXP:
+  case STRSXP:
+  case VECSXP:
+  case LISTSXP:
+	case LANGSXP: // e.g. formulas
+	case CLOSXP: // e.g. functions
+	case PROMSXP:
+	case DOTSXP:
+  case REALSXP:
+  case INTSXP:
+  case LGLSXP:
+  case RAWSXP:
+  case CPLXSXP:
+    break;
+  default:
+    writeRSerialized(sobj, x, 2);
+    return false;
+  }
+
+  nattr = countAttributes(x);
+  if(nattr > 0) writeAttributeHeader_common(nattr, sobj);
+  switch(xtype) {
   case S4SXP: // S4SXP is really just a scaffold for attributes
-    getAttributes(x, attrs, anames);
-    if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
     writeHeader_common(qstype::S4, 0, sobj);
-    writeAttributes(sobj, attrs, anames);
-    return;
+    break;
   case STRSXP:
   {
-    getAttributes(x, attrs, anames);
-    if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
+    if(writeStringDict(sobj, x)) break;
     uint64_t dl = Rf_xlength(x);
     writeHeader_common(qstype::CHARACTER, dl, sobj);
     const SEXP * xptr = STRING_PTR_RO(x);
     for(uint64_t i=0; i<dl; i++) {
-      SEXP xi = xptr[i]; // STRING_ELT(x, i);
-      if(xi == NA_STRING) {
-        sobj->push_pod_noncontiguous(string_header_NA); // header is only 1 byte, but use noncontiguous for consistency
-      } else {
-        uint32_t di = LENGTH(xi);
-        writeStringHeader_common(di, Rf_getCharCE(xi), sobj);
-        sobj->push_contiguous(CHAR(xi), di);
-      }
+      writeString(sobj, xptr[i]); // STRING_ELT(x, i);
     }
-    writeAttributes(sobj, attrs, anames);
-    return;
+    break;
   }
   case SYMSXP:
   {
-    if(x == R_MissingArg || x == R_UnboundValue || TYPEOF(PRINTNAME(x)) != CHARSXP) { // some special cases to handle1
-      Protect_Tracker pt = Protect_Tracker();
-      SEXP xserialized = PROTECT(serializeToRaw(x,Rf_ScalarInteger(2))); pt++;
-      uint64_t xs_size = Rf_xlength(xserialized);
-      writeHeader_common(qstype::RSERIALIZED, xs_size, sobj);
-      sobj->push_contiguous(reinterpret_cast<char*>(RAW(xserialized)), xs_size);
-      return;
-    } else {
-      SEXP a = PRINTNAME(x);
-      getAttributes(x, attrs, anames);
-      if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
-      writeHeader_common(qstype::SYM, 0, sobj);
-      uint32_t alen = strlen(CHAR(a));
-      writeStringHeader_common(alen, Rf_getCharCE(a), sobj);
-      sobj->push_contiguous(CHAR(a), alen);
-      writeAttributes(sobj, attrs, anames);
-      return;
-    }
+    SEXP a = PRINTNAME(x);
+    writeHeader_common(qstype::SYM, 0, sobj);
+    uint32_t alen = strlen(CHAR(a));
+    writeStringHeader_common(alen, Rf_getCharCE(a), sobj);
+    sobj->push_contiguous(CHAR(a), alen);
+    break;
   }
   case VECSXP:
   {
-    getAttributes(x, attrs, anames);
-    if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
     uint64_t dl = Rf_xlength(x);
     writeHeader_common(qstype::LIST, dl, sobj);
-    for(uint64_t i=0; i<dl; i++) {
-      writeObject(sobj, VECTOR_ELT(x, i));
-    }
-    writeAttributes(sobj, attrs, anames);
-    return;
+    stack.push(x, pack_kind::list, dl, false, nattr > 0, nprotect);
+    return true;
   }
   case LISTSXP:
   {
-    getAttributes(x, attrs, anames);
-    if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
-    std::vector<SEXP> cars;
-    std::vector<SEXP> tags;
-    std::vector<int> flags;
-    SEXP xt = x;
-    bool has_flags = false;
-    while(xt != R_NilValue) {
-      int f = packFlags(xt);
-      if(f != 0) has_flags = true;
-      flags.push_back(f);
-      // if(get_bndcell_tag(xt)) R_expand_binding_value(xt);
-      cars.push_back(CAR(xt));
-      tags.push_back(TAG(xt));
-      xt = CDR(xt);
-    }
-    if(has_flags) {
-      writeHeader_common(qstype::PAIRLIST_WF, cars.size(), sobj);
-    } else {
-      writeHeader_common(qstype::PAIRLIST, cars.size(), sobj);
-    }
-    for(uint64_t i=0; i<cars.size(); i++) {
-      if(has_flags) sobj->push_pod_noncontiguous(flags[i]);
-      if(tags[i] == R_NilValue) {
-        sobj->push_pod_noncontiguous(string_header_NA);
-      } else {
-        const char * tag_chars = (CHAR(PRINTNAME(tags[i])));
-        uint32_t alen = strlen(tag_chars);
-        writeStringHeader_common(alen, CE_NATIVE, sobj);
-        sobj->push_contiguous(tag_chars, alen);
-      }
-      writeObject(sobj, cars[i]);
-    }
-    writeAttributes(sobj, attrs, anames);
-    return;
+    stack.push(x, pack_kind::pairlist, 0, false, nattr > 0, nprotect);
+    Pack_Frame & f = stack.top();
+    f.has_flags = writePairlistHeader(sobj, stack.nodes, x, R_NilValue);
+    f.length = stack.nodes.size() - f.nodes_begin;
+    return true;
   }
-	case LANGSXP: // e.g. formulas
-	case CLOSXP: // e.g. functions
+	case LANGSXP:
+	case CLOSXP:
 	case PROMSXP:
 	case DOTSXP:
-    {
-    getAttributes(x, attrs, anames);
-    if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
+  {
     if(LEVELS(x) != 0 || OBJECT(x) != 0) {
       int flags = packFlags(x);
       switch(xtype) {
@@ -560,119 +1107,122 @@ void writeObject(T * const sobj, SEXP x) {
         break;
       }
     }
-    writeObject(sobj, TAG(x));
-    // if(xtype != CLOSXP && get_bndcell_tag(x)) R_expand_binding_value(x);
-    writeObject(sobj, CAR(x));
-    writeObject(sobj, CDR(x)); // TAG/CAR/CDR are just accessors to elements; not real pairlist
-    writeAttributes(sobj, attrs, anames);
-    return;
+    stack.push(x, pack_kind::lang, 3, false, nattr > 0, nprotect);
+    return true;
   }
   case ENVSXP:
   {
-    if(x == R_GlobalEnv || x == R_BaseEnv || x == R_EmptyEnv ||
-                      R_IsNamespaceEnv(x) || R_IsPackageEnv(x)) {
-      Protect_Tracker pt = Protect_Tracker();
-      SEXP xserialized = PROTECT(serializeToRaw(x,Rf_ScalarInteger(2))); pt++;
-      uint64_t xs_size = Rf_xlength(xserialized);
-      writeHeader_common(qstype::RSERIALIZED, xs_size, sobj);
-      sobj->push_contiguous(reinterpret_cast<char*>(RAW(xserialized)), xs_size);
+    if(R_EnvironmentIsLocked(x)) {
+      writeHeader_common(qstype::LOCKED_ENV, sobj->object_ref_hash.index, sobj);
     } else {
-      if(sobj->object_ref_hash.map.find(x) != sobj->object_ref_hash.map.end()) {
-        writeHeader_common(qstype::REFERENCE, sobj->object_ref_hash.map.at(x), sobj);
-      } else {
-        // std::cout << (void *)x << std::endl;
-        sobj->object_ref_hash.add_to_hash(x);
-        getAttributes(x, attrs, anames);
-        if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
-        if(R_EnvironmentIsLocked(x)) {
-          writeHeader_common(qstype::LOCKED_ENV, sobj->object_ref_hash.index, sobj);
-        } else {
-          writeHeader_common(qstype::UNLOCKED_ENV, sobj->object_ref_hash.index, sobj);
-        }
-        writeObject(sobj, ENCLOS(x)); // parent env
-        // writeObject(sobj, FRAME(x));
-        writeEnvFrame(sobj, x);
-        writeObject(sobj, HASHTAB(x));
-        writeAttributes(sobj, attrs, anames);
-      }
+      writeHeader_common(qstype::UNLOCKED_ENV, sobj->object_ref_hash.index, sobj);
     }
-    return;
+    stack.push(x, pack_kind::env, 0, false, nattr > 0, nprotect);
+    return true;
   }
   case REALSXP:
   {
-    getAttributes(x, attrs, anames);
-    if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
     uint64_t dl = Rf_xlength(x);
+    if(sobj->qm.real_transform && writeTransformedReal(sobj, REAL(x), dl)) break;
+    if(sobj->qm.real_bitshuffle && dl >= MIN_BITSHUFFLE_ELEMENTS) {
+      writeBitshuffled(sobj, PointerSource{reinterpret_cast<char*>(REAL(x))}, dl, 1, vector_transform::none);
+      break;
+    }
     writeHeader_common(qstype::NUMERIC, dl, sobj);
     if(sobj->qm.real_shuffle) {
-      sobj->shuffle_push(reinterpret_cast<char*>(REAL(x)), dl*8, 8);
+      shufflePushVector(sobj, reinterpret_cast<char*>(REAL(x)), dl*8, 8, nprotect);
     } else {
       sobj->push_contiguous(reinterpret_cast<char*>(REAL(x)), dl*8);
     }
-    writeAttributes(sobj, attrs, anames);
-    return;
+    break;
   }
   case INTSXP:
   {
-    getAttributes(x, attrs, anames);
-    if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
     uint64_t dl = Rf_xlength(x);
+    if(sobj->qm.int_transform && writeTransformedInt(sobj, INTEGER(x), dl)) break;
+    if(sobj->qm.int_bitshuffle && dl >= MIN_BITSHUFFLE_ELEMENTS) {
+      writeBitshuffled(sobj, PointerSource{reinterpret_cast<char*>(INTEGER(x))}, dl, 0, vector_transform::none);
+      break;
+    }
     writeHeader_common(qstype::INTEGER, dl, sobj);
     if(sobj->qm.int_shuffle) {
-      sobj->shuffle_push(reinterpret_cast<char*>(INTEGER(x)), dl*4, 4);
+      shufflePushVector(sobj, reinterpret_cast<char*>(INTEGER(x)), dl*4, 4, nprotect);
     } else {
       sobj->push_contiguous(reinterpret_cast<char*>(INTEGER(x)), dl*4);
     }
-    writeAttributes(sobj, attrs, anames);
-    return;
+    break;
   }
   case LGLSXP:
   {
-    getAttributes(x, attrs, anames);
-    if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
     uint64_t dl = Rf_xlength(x);
+    if(sobj->qm.lgl_pack && writePackedLogical(sobj, LOGICAL(x), dl)) break;
     writeHeader_common(qstype::LOGICAL, dl, sobj);
     if(sobj->qm.lgl_shuffle) {
-      sobj->shuffle_push(reinterpret_cast<char*>(LOGICAL(x)), dl*4, 4);
+      shufflePushVector(sobj, reinterpret_cast<char*>(LOGICAL(x)), dl*4, 4, nprotect);
     } else {
       sobj->push_contiguous(reinterpret_cast<char*>(LOGICAL(x)), dl*4);
     }
-    writeAttributes(sobj, attrs, anames);
-    return;
+    break;
   }
   case RAWSXP:
   {
-    getAttributes(x, attrs, anames);
-    if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
     uint64_t dl = Rf_xlength(x);
     writeHeader_common(qstype::RAW, dl, sobj);
     sobj->push_contiguous(reinterpret_cast<char*>(RAW(x)), dl);
-    writeAttributes(sobj, attrs, anames);
-    return;
+    break;
   }
   case CPLXSXP:
   {
-    getAttributes(x, attrs, anames);
-    if(attrs.size() > 0) writeAttributeHeader_common(attrs.size(), sobj);
     uint64_t dl = Rf_xlength(x);
     writeHeader_common(qstype::COMPLEX, dl, sobj);
     if(sobj->qm.cplx_shuffle) {
-      sobj->shuffle_push(reinterpret_cast<char*>(COMPLEX(x)), dl*16, 8);
+      shufflePushVector(sobj, reinterpret_cast<char*>(COMPLEX(x)), dl*16, 8, nprotect);
     } else {
       sobj->push_contiguous(reinterpret_cast<char*>(COMPLEX(x)), dl*16);
     }
-    writeAttributes(sobj, attrs, anames);
-    return;
+    break;
   }
   default:
-  {
-    Protect_Tracker pt = Protect_Tracker();
-    SEXP xserialized = PROTECT(serializeToRaw(x,Rf_ScalarInteger(2))); pt++;
-    uint64_t xs_size = Rf_xlength(xserialized);
-    writeHeader_common(qstype::RSERIALIZED, xs_size, sobj);
-    sobj->push_contiguous(reinterpret_cast<char*>(RAW(xserialized)), xs_size);
-    return;
+    break;
   }
+  if(nattr == 0) return false;
+  stack.push(x, pack_kind::leaf, 0, false, true, nprotect);
+  return true;
+}
+
+// Objects are written depth first with an explicit stack (no recursion), in the same order as the attribute/header/data/children/attributes layout of the format
+template <class T>
+void writeObject(T * const sobj, SEXP x) {
+  Pack_Stack stack;
+  bool factor_levels = false;
+  while(true) {
+    // evaluate promises immediately
+    unsigned int nprotect = 0;
+    if(!trust_promises_global) {
+      while(TYPEOF(x) == PROMSXP) {
+        int error_occurred = 0;
+        SEXP xeval = R_tryEval(x, R_BaseEnv, &error_occurred);
+        if(error_occurred) {
+          x = R_NilValue;
+        } else {
+          stack.protect(xeval); nprotect++;
+          x = xeval;
+        }
+      }
+    }
+    // factor levels are shared regardless of their size: by content with dedup, otherwise by pointer
+    bool by_content = (factor_levels && sobj->qm.dedup) || dedupCandidate(sobj, x, nprotect);
+    if((by_content || factor_levels || shareCandidate(sobj, x, nprotect)) && writeShared(sobj, x, by_content)) {
+      stack.release(nprotect);
+    } else if(!writeNode(sobj, stack, x, nprotect)) {
+      stack.release(nprotect);
+    }
+    while(true) {
+      factor_levels = false;
+      if(stack.empty()) return;
+      if(nextChild(sobj, stack, x, factor_levels)) break;
+      stack.pop();
+    }
   }
 }
 
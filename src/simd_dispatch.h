@@ -0,0 +1,79 @@
+/* Runtime selection of the byte shuffle kernels (BLOSC/shuffle_routines.h and BLOSC/unshuffle_routines.h)
+ * The SSE2 kernels are used if the package is compiled with SSE2 (always the case on x86-64), and the AVX2 and AVX-512BW kernels
+ * are compiled with function target attributes and used if the CPU supports them, so that binaries built without `--with-simd`
+ * still use the fastest kernels of the host
+ * Not on Windows, where GCC does not align the stack for AVX spills (GCC bug 54412)
+ */
+
+#ifndef QS_SIMD_DISPATCH_H
+#define QS_SIMD_DISPATCH_H
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(_WIN32) && \
+    ((defined(__clang__) && __clang_major__ >= 4) || (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 6))
+#define QS_SIMD_DISPATCH
+#endif
+
+#if defined(QS_SIMD_DISPATCH)
+#define QS_TARGET_AVX2 __attribute__((target("avx2")))
+#define QS_TARGET_AVX512BW __attribute__((target("avx512f,avx512bw")))
+#else
+#define QS_TARGET_AVX2
+#define QS_TARGET_AVX512BW
+#endif
+
+#if defined(QS_SIMD_DISPATCH) || defined(__AVX2__)
+#define QS_AVX2_KERNELS
+#endif
+#if defined(QS_SIMD_DISPATCH) || defined(__AVX512BW__)
+#define QS_AVX512BW_KERNELS
+#endif
+
+#if defined(QS_AVX2_KERNELS) || defined(QS_AVX512BW_KERNELS)
+#include "immintrin.h"
+#elif defined(__SSE2__)
+#include "emmintrin.h"
+#endif
+
+enum class simd_level {generic, sse2, avx2, avx512bw};
+
+// the kernels enabled by the compiler flags
+static constexpr simd_level compiled_simd_level() {
+#if defined(__AVX512BW__)
+  return simd_level::avx512bw;
+#elif defined(__AVX2__)
+  return simd_level::avx2;
+#elif defined(__SSE2__)
+  return simd_level::sse2;
+#else
+  return simd_level::generic;
+#endif
+}
+
+// set once when the package is loaded, before any worker threads are started
+static simd_level shuffle_simd_level = compiled_simd_level();
+
+inline void init_simd_dispatch() {
+#if defined(QS_SIMD_DISPATCH)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512f")) {
+    shuffle_simd_level = simd_level::avx512bw;
+  } else if(__builtin_cpu_supports("avx2") && shuffle_simd_level < simd_level::avx2) {
+    shuffle_simd_level = simd_level::avx2;
+  }
+#endif
+}
+
+inline const char * simd_level_name(const simd_level level) {
+  switch(level) {
+  case simd_level::avx512bw:
+    return "AVX512BW";
+  case simd_level::avx2:
+    return "AVX2";
+  case simd_level::sse2:
+    return "SSE2";
+  default:
+    return "no SIMD";
+  }
+}
+
+#endif
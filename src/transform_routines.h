@@ -0,0 +1,361 @@
+/* Delta and XOR transforms of integer and numeric vectors
+ * The transformed vector replaces the data (followed by byte shuffling) and the transform is recorded in the header of the vector
+ * Integer deltas are zigzag encoded, so that small negative deltas have as many leading zero bytes as small positive ones
+ * Logical vectors are packed to 2 bits per element instead
+ * Bit shuffling, an alternative to byte shuffling for integer and numeric vectors, is at the end
+ */
+
+#ifndef QS_TRANSFORM_ROUTINES_H
+#define QS_TRANSFORM_ROUTINES_H
+
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include "emmintrin.h"
+#endif
+
+enum class vector_transform : uint8_t {none = 0, delta = 1, delta2 = 2, xor_prev = 3, real_delta = 4,
+                                       logical_pack = 5}; // logical_pack is implied by packed_logical_header, and never written
+
+static inline uint32_t zigzag32(const uint32_t d) {
+  return (d << 1) ^ (0U - (d >> 31));
+}
+
+static inline uint32_t unzigzag32(const uint32_t z) {
+  return (z >> 1) ^ (0U - (z & 1U));
+}
+
+// The encoders take the state left by the previous call (zero at the start of the vector), so that a vector can be encoded in chunks
+
+// integers: difference to the previous value (wrapping, so NA and overflow are exact)
+static void delta_encode_int(const int * const src, uint32_t * const dest, const uint64_t n, uint32_t & prev) {
+  for(uint64_t i=0; i<n; i++) {
+    dest[i] = zigzag32(static_cast<uint32_t>(src[i]) - prev);
+    prev = static_cast<uint32_t>(src[i]);
+  }
+}
+
+// in place prefix sum of the zigzag decoded deltas
+static void delta_decode_int(uint32_t * const data, const uint64_t n) {
+  uint64_t i = 0;
+  uint32_t last = 0;
+#if defined(__SSE2__)
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i prev = zero;
+  for(; i + 4 <= n; i += 4) {
+    __m128i z = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    __m128i d = _mm_xor_si128(_mm_srli_epi32(z, 1), _mm_sub_epi32(zero, _mm_and_si128(z, one)));
+    d = _mm_add_epi32(d, _mm_slli_si128(d, 4));
+    d = _mm_add_epi32(d, _mm_slli_si128(d, 8));
+    d = _mm_add_epi32(d, prev);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), d);
+    prev = _mm_shuffle_epi32(d, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  if(i > 0) last = data[i-1];
+#endif
+  for(; i<n; i++) {
+    last += unzigzag32(data[i]);
+    data[i] = last;
+  }
+}
+
+// integers: difference of consecutive deltas, for values with a (nearly) constant step such as timestamps
+static void delta2_encode_int(const int * const src, uint32_t * const dest, const uint64_t n, uint32_t & prev, uint32_t & prev_delta) {
+  for(uint64_t i=0; i<n; i++) {
+    uint32_t delta = static_cast<uint32_t>(src[i]) - prev;
+    dest[i] = zigzag32(delta - prev_delta);
+    prev = static_cast<uint32_t>(src[i]);
+    prev_delta = delta;
+  }
+}
+
+static void delta2_decode_int(uint32_t * const data, const uint64_t n) {
+  delta_decode_int(data, n); // deltas, zigzag encoded again so that the second pass can decode them
+  for(uint64_t i=0; i<n; i++) data[i] = zigzag32(data[i]);
+  delta_decode_int(data, n);
+}
+
+// doubles: XOR with the previous value, so that the sign, exponent and leading mantissa bits shared with it become zero
+static void xor_encode_real(const double * const src, uint64_t * const dest, const uint64_t n, uint64_t & prev) {
+  for(uint64_t i=0; i<n; i++) {
+    uint64_t v;
+    std::memcpy(&v, src + i, 8);
+    dest[i] = v ^ prev;
+    prev = v;
+  }
+}
+
+static void xor_decode_real(double * const data, const uint64_t n) {
+  uint64_t prev = 0;
+  for(uint64_t i=0; i<n; i++) {
+    uint64_t v;
+    std::memcpy(&v, data + i, 8);
+    prev ^= v;
+    std::memcpy(data + i, &prev, 8);
+  }
+}
+
+// doubles with integer values (e.g. Date and POSIXct in whole seconds): difference to the previous value
+// Only integers below 2^52 in magnitude are allowed, so that the differences and their sums are exact; NaN (and NA) values are kept as is
+static inline bool real_delta_allowed(const double x) {
+  return std::isnan(x) || (std::fabs(x) < 4503599627370496.0 && x == std::floor(x) && !(x == 0 && std::signbit(x)));
+}
+
+static bool real_delta_allowed(const double * const src, const uint64_t n) {
+  for(uint64_t i=0; i<n; i++) {
+    if(!real_delta_allowed(src[i])) return false;
+  }
+  return true;
+}
+
+// Returns false if some value is not allowed
+static bool real_delta_encode(const double * const src, double * const dest, const uint64_t n, double & prev) {
+  for(uint64_t i=0; i<n; i++) {
+    double x = src[i];
+    if(!real_delta_allowed(x)) return false;
+    if(std::isnan(x)) {
+      std::memcpy(dest + i, src + i, 8); // keeps the NaN payload, which distinguishes NA from NaN
+      continue;
+    }
+    dest[i] = x - prev;
+    prev = x;
+  }
+  return true;
+}
+
+static void real_delta_decode(double * const data, const uint64_t n) {
+  double prev = 0;
+  for(uint64_t i=0; i<n; i++) {
+    if(std::isnan(data[i])) continue; // differences are never NaN
+    prev += data[i];
+    data[i] = prev;
+  }
+}
+
+// inverts any of the transforms above, in place
+static void inverse_transform(char * const data, const uint64_t n, const vector_transform transform) {
+  switch(transform) {
+  case vector_transform::delta:
+    delta_decode_int(reinterpret_cast<uint32_t*>(data), n);
+    break;
+  case vector_transform::delta2:
+    delta2_decode_int(reinterpret_cast<uint32_t*>(data), n);
+    break;
+  case vector_transform::xor_prev:
+    xor_decode_real(reinterpret_cast<double*>(data), n);
+    break;
+  case vector_transform::real_delta:
+    real_delta_decode(reinterpret_cast<double*>(data), n);
+    break;
+  default:
+    break;
+  }
+}
+
+// logicals: 2 bits per element (0 FALSE, 1 TRUE, 2 NA), the first element in the lowest bits of the first byte
+static inline uint64_t packed_logical_bytes(const uint64_t n) {
+  return (n + 3) / 4;
+}
+
+// true if every value is TRUE, FALSE or NA, i.e. logical_pack cannot fail (other values are possible from C code)
+static bool logical_packable(const int * const src, const uint64_t n) {
+  for(uint64_t i=0; i<n; i++) {
+    if(src[i] != 0 && src[i] != 1 && src[i] != NA_LOGICAL) return false;
+  }
+  return true;
+}
+
+// Returns false if some value is not TRUE, FALSE or NA (possible from C code), in which case dest is incomplete
+static bool logical_pack(const int * const src, uint8_t * const dest, const uint64_t n) {
+  uint64_t i = 0;
+#if defined(__SSE2__)
+  // 16 elements per iteration: the codes are narrowed to bytes, then 4 bytes in each 32 bit lane are merged into the low byte
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i na = _mm_set1_epi32(NA_LOGICAL);
+  const __m128i two = _mm_set1_epi32(2);
+  const __m128i low_byte = _mm_set1_epi32(0xFF);
+  for(; i + 16 <= n; i += 16) {
+    __m128i v[4];
+    __m128i valid = _mm_set1_epi32(-1);
+    for(int k=0; k<4; k++) {
+      v[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 4*k));
+      __m128i is_one = _mm_cmpeq_epi32(v[k], one);
+      __m128i is_na = _mm_cmpeq_epi32(v[k], na);
+      valid = _mm_and_si128(valid, _mm_or_si128(_mm_or_si128(is_one, is_na), _mm_cmpeq_epi32(v[k], zero)));
+      v[k] = _mm_or_si128(_mm_and_si128(is_one, one), _mm_and_si128(is_na, two));
+    }
+    if(_mm_movemask_epi8(valid) != 0xFFFF) return false;
+    __m128i codes = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+    codes = _mm_or_si128(codes, _mm_srli_epi32(codes, 6));
+    codes = _mm_and_si128(_mm_or_si128(codes, _mm_srli_epi32(codes, 12)), low_byte);
+    codes = _mm_packus_epi16(_mm_packs_epi32(codes, zero), zero);
+    uint32_t packed = static_cast<uint32_t>(_mm_cvtsi128_si32(codes));
+    std::memcpy(dest + i / 4, &packed, 4);
+  }
+#endif
+  for(; i<n; i += 4) {
+    uint8_t packed = 0;
+    for(uint64_t k=0; k<4 && i+k<n; k++) {
+      int x = src[i+k];
+      uint8_t code;
+      if(x == 0) {
+        code = 0;
+      } else if(x == 1) {
+        code = 1;
+      } else if(x == NA_LOGICAL) {
+        code = 2;
+      } else {
+        return false;
+      }
+      packed |= static_cast<uint8_t>(code << (2*k));
+    }
+    dest[i / 4] = packed;
+  }
+  return true;
+}
+
+// the 4 logical values of every packed byte (code 3 is invalid and marked with 3)
+struct logical_unpack_table {
+  std::array<std::array<int, 4>, 256> values;
+  logical_unpack_table() {
+    for(int b=0; b<256; b++) {
+      for(int k=0; k<4; k++) {
+        int code = (b >> (2*k)) & 3;
+        values[b][k] = code == 0 ? 0 : (code == 1 ? 1 : (code == 2 ? NA_LOGICAL : 3));
+      }
+    }
+  }
+};
+
+// Returns false if the data contains an invalid code
+static bool logical_unpack(const uint8_t * const src, int * const dest, const uint64_t n) {
+  static const logical_unpack_table table;
+  uint8_t invalid = 0; // code 3 has both bits set
+  uint64_t i = 0;
+  for(; i + 4 <= n; i += 4) {
+    uint8_t b = src[i / 4];
+    invalid |= b & (b >> 1);
+#if defined(__SSE2__)
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(table.values[b].data())));
+#else
+    std::memcpy(dest + i, table.values[b].data(), 16);
+#endif
+  }
+  if(i < n) {
+    uint8_t b = src[i / 4];
+    invalid |= b & (b >> 1);
+    std::memcpy(dest + i, table.values[b].data(), (n - i) * 4);
+  }
+  return (invalid & 0x55) == 0;
+}
+
+// Estimated size in bits of n elements of bytesoftype bytes once byte shuffled and compressed
+// In each byte plane, a byte that repeats one of the two bytes before it is taken to be free (part of a match), and the other bytes
+// cost their order-0 entropy plus one bit
+static uint64_t shuffled_cost(const uint8_t * const data, const uint64_t n, const uint64_t bytesoftype) {
+  double cost = 0;
+  std::array<uint32_t, 256> counts;
+  for(uint64_t k=0; k<bytesoftype; k++) {
+    counts.fill(0);
+    uint64_t literals = 0;
+    for(uint64_t i=1; i<n; i++) {
+      uint8_t b = data[i*bytesoftype + k];
+      if(b == data[(i-1)*bytesoftype + k] || (i > 1 && b == data[(i-2)*bytesoftype + k])) continue;
+      counts[b]++;
+      literals++;
+    }
+    for(uint32_t c : counts) {
+      if(c > 0) cost += c * std::log2(static_cast<double>(literals) / c);
+    }
+    cost += literals;
+  }
+  return static_cast<uint64_t>(cost);
+}
+
+// Bit shuffle: bit k of every element is stored together, 8 elements per byte (element 8j+t in bit t of byte j)
+// Vectors are bit shuffled in blocks of BITSHUFFLE_BLOCK elements, each done as a byte shuffle, a transpose of the 8x8 bit matrix in every
+// 8 bytes, and a byte shuffle of each byte plane as 8 byte elements, which reuses the SIMD byte shuffle kernels
+// Only the first n - n % 8 elements of a block are bit shuffled, the remaining elements are copied as is
+static constexpr uint64_t BITSHUFFLE_BLOCK = 4096;
+
+// transposes the 8x8 bit matrix of each 64 bit word (byte t, bit b) -> (byte b, bit t), in place; its own inverse
+static inline uint64_t transpose_bits8x8(uint64_t x) {
+  uint64_t t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+  return x ^ t ^ (t << 28);
+}
+
+static void transpose_bits8x8(uint8_t * const data, const uint64_t nwords) {
+  uint64_t i = 0;
+#if defined(__SSE2__)
+  const __m128i m1 = _mm_set1_epi64x(0x00AA00AA00AA00AALL);
+  const __m128i m2 = _mm_set1_epi64x(0x0000CCCC0000CCCCLL);
+  const __m128i m3 = _mm_set1_epi64x(0x00000000F0F0F0F0LL);
+  for(; i + 2 <= nwords; i += 2) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 8*i));
+    __m128i t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 7)), m1);
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 7));
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 14)), m2);
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 14));
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 28)), m3);
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 28));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(data + 8*i), x);
+  }
+#endif
+  for(; i<nwords; i++) {
+    uint64_t x;
+    std::memcpy(&x, data + 8*i, 8);
+    x = transpose_bits8x8(x);
+    std::memcpy(data + 8*i, &x, 8);
+  }
+}
+
+// n (at most BITSHUFFLE_BLOCK) elements of bytesoftype bytes; buffer is temporary space
+static void bitshuffle(const uint8_t * const src, uint8_t * const dest, const uint64_t n, const uint64_t bytesoftype,
+                       std::vector<uint8_t> & buffer) {
+  uint64_t n8 = n - n % 8;
+  if(n8 > 0) {
+    if(buffer.size() < n8 * bytesoftype) buffer.resize(n8 * bytesoftype);
+    blosc_shuffle(src, buffer.data(), n8 * bytesoftype, bytesoftype);
+    transpose_bits8x8(buffer.data(), n8 * bytesoftype / 8);
+    for(uint64_t k=0; k<bytesoftype; k++) {
+      blosc_shuffle(buffer.data() + k*n8, dest + k*n8, n8, 8);
+    }
+  }
+  std::memcpy(dest + n8 * bytesoftype, src + n8 * bytesoftype, (n - n8) * bytesoftype);
+}
+
+static void bitunshuffle(const uint8_t * const src, uint8_t * const dest, const uint64_t n, const uint64_t bytesoftype,
+                         std::vector<uint8_t> & buffer) {
+  uint64_t n8 = n - n % 8;
+  if(n8 > 0) {
+    if(buffer.size() < n8 * bytesoftype) buffer.resize(n8 * bytesoftype);
+    for(uint64_t k=0; k<bytesoftype; k++) {
+      blosc_unshuffle(src + k*n8, buffer.data() + k*n8, n8, 8);
+    }
+    transpose_bits8x8(buffer.data(), n8 * bytesoftype / 8);
+    blosc_unshuffle(buffer.data(), dest, n8 * bytesoftype, bytesoftype);
+  }
+  std::memcpy(dest + n8 * bytesoftype, src + n8 * bytesoftype, (n - n8) * bytesoftype);
+}
+
+// consecutive blocks of a vector in memory, all but the last of BITSHUFFLE_BLOCK elements
+static void bitunshuffle_blocks(const uint8_t * const src, uint8_t * const dest, const uint64_t n, const uint64_t bytesoftype) {
+  std::vector<uint8_t> buffer;
+  for(uint64_t i=0; i<n; i += BITSHUFFLE_BLOCK) {
+    uint64_t block_n = std::min(BITSHUFFLE_BLOCK, n - i);
+    bitunshuffle(src + i * bytesoftype, dest + i * bytesoftype, block_n, bytesoftype, buffer);
+  }
+}
+
+#endif